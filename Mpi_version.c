@@ -1,13 +1,37 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
 #include <math.h>
+#include <unistd.h>
 #include <mpi.h>
 
-#define MAX_DAYS 1000000   // الحد الأقصى للسجلات اللي نسمح بتحميلها
+#include "arena.h"
+#include "catalog.h"
+#include "decade_stats.h"
+#include "manifest.h"
+#include "mpi_node.h"
+#include "shard_plan.h"
+#include "stock_cache.h"
+#include "stock_options.h"
+#include "year_layout.h"
+
+// عدد السجلات في كل دفعة يقرأها الرانك 0 ويوزعها (يحدد حجم الذاكرة)
+#ifndef MPI_STREAM_RECORDS
+#define MPI_STREAM_RECORDS 65536
+#endif
+
+// عدد مرات تكرار الجمع لقياس زمن الـ reduction في وضع --hier
+#define REDUCE_REPS 200
 
 // هيكل بسيط يمثل بيانات كل يوم بالسهم
+// (day مفتاح التاريخ، أو NO_DAY إذا السطر ما فيه تاريخ مفهوم)
+#define NO_DAY INT_MIN
 typedef struct {
     double open, high, low, close;
+    int day;
 } StockData;
 
 // دالة حساب متوسط السعر لليوم الواحد
@@ -23,6 +47,796 @@ double daily_return(double prev_close, double curr_close) {
     return (curr_close - prev_close) / prev_close;
 }
 
+// الإحصائيات المحلية لكل عملية، تتحدث مع كل دفعة سجلات
+typedef struct {
+    double sum_avg;
+    double prev_close;      // آخر إغلاق من الدفعة السابقة
+    long long seen;
+
+    // الفولاتيليتي بطريقة Welford: متوسط ومجموع مربعات الفروق بدون تخزين العوائد
+    long long ret_count;
+    double mean_ret;
+    double m2;
+
+    // نفس السجلات بالعقود (DecadeAcc كامل: الصفوف، العوائد، ومدى السنين)
+    DecadeAcc decades;
+    int prev_day;
+    double first_close;     // أول إغلاق بالجزء، لعائد الحد مع الرانك السابق
+} LocalStats;
+
+void local_stats_init(LocalStats *st) {
+    memset(st, 0, sizeof(*st));
+    decade_acc_init(&st->decades);
+    st->prev_day = NO_DAY;
+}
+
+// سجل واحد بعقده: متوسط السعر بعد التنظيف، والعائد من السجل السابق
+// ينحسب لليوم الأول مثل وضع المجلد
+void add_decade_record(LocalStats *st, const StockData *d) {
+    if (st->seen > 0 && st->prev_day != NO_DAY)
+        decade_acc_add_return(&st->decades, st->prev_day, st->prev_close, d->close);
+    if (d->day == NO_DAY)
+        return;
+    int year = day_year(d->day);
+    int decade_index = decade_index_of_year(year);
+    if (decade_index < 0)
+        return;
+    if (year < st->decades.min_year) st->decades.min_year = year;
+    if (year > st->decades.max_year) st->decades.max_year = year;
+    if (d->open >= MIN_PRICE && d->open <= MAX_PRICE &&
+        d->high >= MIN_PRICE && d->high <= MAX_PRICE &&
+        d->low >= MIN_PRICE && d->low <= MAX_PRICE &&
+        d->close >= MIN_PRICE && d->close <= MAX_PRICE) {
+        st->decades.sum_avg[decade_index] += daily_average(*d);
+        st->decades.rows[decade_index]    += 1;
+    }
+}
+
+// نضيف سجلات متتالية للإحصائيات (العائد الأول يستخدم إغلاق الدفعة السابقة)
+void add_records(LocalStats *st, const StockData *d, int count) {
+    for (int i = 0; i < count; i++, st->seen++) {
+        st->sum_avg += daily_average(d[i]);
+        add_decade_record(st, &d[i]);
+
+        if (st->seen > 0) {
+            double r = daily_return(st->prev_close, d[i].close);
+            st->ret_count++;
+            double delta = r - st->mean_ret;
+            st->mean_ret += delta / st->ret_count;
+            st->m2 += delta * (r - st->mean_ret);
+        }
+        if (st->seen == 0)
+            st->first_close = d[i].close;
+        st->prev_close = d[i].close;
+        st->prev_day = d[i].day;
+    }
+}
+
+// كل رانك يرسل آخر سجل عنده للرانك اللي بعده، عشان العائد اللي على حد
+// الجزئين ينحسب بالعقود مثل ما ينحسب لما الملف كله عند عملية وحدة
+void add_seam_return(LocalStats *st, int rank, int size) {
+    double tail[2] = { st->prev_close, st->seen > 0 ? st->prev_day : NO_DAY };
+    double prev[2] = { 0.0, NO_DAY };
+    MPI_Sendrecv(tail, 2, MPI_DOUBLE, rank + 1 < size ? rank + 1 : MPI_PROC_NULL, 0,
+                 prev, 2, MPI_DOUBLE, rank > 0 ? rank - 1 : MPI_PROC_NULL, 0,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (st->seen > 0 && (int)prev[1] != NO_DAY)
+        decade_acc_add_return(&st->decades, (int)prev[1], prev[0], st->first_close);
+}
+
+// نقرأ لحد count سجل من الملف، فقط الأعمدة المهمة: التاريخ و open, high, low, close
+long long read_records(FILE *file, StockData *out, long long count) {
+    char line[256];
+    long long i = 0;
+    for (; i < count && fgets(line, sizeof(line), file); i++) {
+        sscanf(line, "%*[^,],%lf,%lf,%lf,%lf",
+               &out[i].open, &out[i].high, &out[i].low, &out[i].close);
+        if (strlen(line) < 10 || parse_day(line, &out[i].day) != 0)
+            out[i].day = NO_DAY;
+    }
+    return i;
+}
+
+// وضع --rma: كل عملية تدفع نتايجها الجزئية لنافذة على الرانك 0 بعد كل دفعة
+// (MPI_Accumulate مع passive target)، فما أحد ينتظر الأبطأ في reduction
+// أخيرة، والرانك 0 يقرأ النافذة ويطبع النتايج أول بأول
+enum { RMA_SUM_AVG, RMA_SUM_VOL, RMA_RECORDS, RMA_DONE, RMA_FIELDS };
+
+// حدود جزء كل رانك (أول إغلاق وآخر سجل)، عشان الرانك 0 يحسب عائد الحد
+// بين كل جزئين بنفسه بدل ما كل رانك ينتظر جاره
+enum { SEAM_FIRST_CLOSE, SEAM_LAST_DAY, SEAM_LAST_CLOSE, SEAM_ROWS, SEAM_FIELDS };
+
+// النافذة (displacement بالبايت): الحقول فوق، ثم DecadeAcc للعقود، ثم
+// SEAM_FIELDS لكل رانك
+typedef struct {
+    double vals[RMA_FIELDS];
+    DecadeAcc decades;
+} RmaWindow;
+
+#define RMA_DECADE_AT(field) \
+    (MPI_Aint)(offsetof(RmaWindow, decades) + offsetof(DecadeAcc, field))
+#define RMA_SEAM_AT(r) (MPI_Aint)(sizeof(RmaWindow) + (size_t)(r) * SEAM_FIELDS * sizeof(double))
+
+typedef struct {
+    MPI_Win win;
+    long long total;        // كل السجلات الموزعة
+    int shown;              // آخر عُشر (10%) انطبع تقدمه
+} RmaResults;
+
+void rma_push(RmaResults *r, double sum_avg, double sum_vol, double records, double done) {
+    double delta[RMA_FIELDS] = { sum_avg, sum_vol, records, done };
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, r->win);
+    MPI_Accumulate(delta, RMA_FIELDS, MPI_DOUBLE, 0, 0, RMA_FIELDS, MPI_DOUBLE,
+                   MPI_SUM, r->win);
+    MPI_Win_unlock(0, r->win);
+}
+
+// نضيف عقود الدفعة للنافذة: المجاميع بـ MPI_SUM، ومدى السنين بـ MPI_MIN / MPI_MAX
+void rma_push_decades(RmaResults *r, const DecadeAcc *acc) {
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, r->win);
+    MPI_Accumulate(acc->sum_avg, MAX_DECADES, MPI_DOUBLE, 0, RMA_DECADE_AT(sum_avg),
+                   MAX_DECADES, MPI_DOUBLE, MPI_SUM, r->win);
+    MPI_Accumulate(acc->rows, MAX_DECADES, MPI_LONG, 0, RMA_DECADE_AT(rows),
+                   MAX_DECADES, MPI_LONG, MPI_SUM, r->win);
+    MPI_Accumulate(acc->sum_ret, MAX_DECADES, MPI_DOUBLE, 0, RMA_DECADE_AT(sum_ret),
+                   MAX_DECADES, MPI_DOUBLE, MPI_SUM, r->win);
+    MPI_Accumulate(acc->sum_ret_sq, MAX_DECADES, MPI_DOUBLE, 0, RMA_DECADE_AT(sum_ret_sq),
+                   MAX_DECADES, MPI_DOUBLE, MPI_SUM, r->win);
+    MPI_Accumulate(acc->ret_count, MAX_DECADES, MPI_LONG, 0, RMA_DECADE_AT(ret_count),
+                   MAX_DECADES, MPI_LONG, MPI_SUM, r->win);
+    MPI_Accumulate(&acc->min_year, 1, MPI_INT, 0, RMA_DECADE_AT(min_year),
+                   1, MPI_INT, MPI_MIN, r->win);
+    MPI_Accumulate(&acc->max_year, 1, MPI_INT, 0, RMA_DECADE_AT(max_year),
+                   1, MPI_INT, MPI_MAX, r->win);
+    MPI_Win_unlock(0, r->win);
+}
+
+// حدود جزء هذا الرانك بخانته (كل رانك يكتب خانته بس، مرة وحدة بالآخر)
+void rma_push_seam(RmaResults *r, const LocalStats *st, int rank) {
+    double seam[SEAM_FIELDS] = { st->first_close, st->seen > 0 ? st->prev_day : NO_DAY,
+                                 st->prev_close, (double)st->seen };
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, r->win);
+    MPI_Accumulate(seam, SEAM_FIELDS, MPI_DOUBLE, 0, RMA_SEAM_AT(rank), SEAM_FIELDS,
+                   MPI_DOUBLE, MPI_REPLACE, r->win);
+    MPI_Win_unlock(0, r->win);
+}
+
+// قراءة النافذة بشكل ذري بالنسبة للـ Accumulate (MPI_NO_OP)
+void rma_read(RmaResults *r, double *out) {
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, r->win);
+    MPI_Get_accumulate(NULL, 0, MPI_DOUBLE, out, RMA_FIELDS, MPI_DOUBLE,
+                       0, 0, RMA_FIELDS, MPI_DOUBLE, MPI_NO_OP, r->win);
+    MPI_Win_unlock(0, r->win);
+}
+
+// الرانك 0، بعد ما كل العمليات تعلن إنها خلصت: عقود النافذة، وعوائد
+// الحدود بين الأجزاء (آخر سجل للرانك r-1 مع أول إغلاق للرانك r)
+void rma_read_decades(RmaResults *r, DecadeAcc *out, int size) {
+    MPI_Datatype bytes;
+    MPI_Type_contiguous(sizeof(DecadeAcc), MPI_BYTE, &bytes);
+    MPI_Type_commit(&bytes);
+    double *seams = malloc((size_t)size * SEAM_FIELDS * sizeof(double));
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, r->win);
+    MPI_Get(out, 1, bytes, 0, offsetof(RmaWindow, decades), 1, bytes, r->win);
+    MPI_Get(seams, size * SEAM_FIELDS, MPI_DOUBLE, 0, RMA_SEAM_AT(0), size * SEAM_FIELDS,
+            MPI_DOUBLE, r->win);
+    MPI_Win_unlock(0, r->win);
+    MPI_Type_free(&bytes);
+
+    for (int k = 1; k < size; k++) {
+        const double *prev = seams + (size_t)(k - 1) * SEAM_FIELDS;
+        const double *next = seams + (size_t)k * SEAM_FIELDS;
+        if (prev[SEAM_ROWS] > 0 && next[SEAM_ROWS] > 0 && (int)prev[SEAM_LAST_DAY] != NO_DAY)
+            decade_acc_add_return(out, (int)prev[SEAM_LAST_DAY], prev[SEAM_LAST_CLOSE],
+                                  next[SEAM_FIRST_CLOSE]);
+    }
+    free(seams);
+}
+
+// الرانك 0: يطبع سطر تقدم كل ما خلص 10% زيادة من السجلات
+void rma_progress(RmaResults *r, double *vals) {
+    rma_read(r, vals);
+    int tenths = r->total > 0 ? (int)(vals[RMA_RECORDS] * 10 / r->total) : 10;
+    if (tenths > r->shown && vals[RMA_RECORDS] > 0) {
+        r->shown = tenths;
+        printf("Progress: %3d%% (%.0f records), average price so far %.4f\n",
+               tenths * 10, vals[RMA_RECORDS], vals[RMA_SUM_AVG] / vals[RMA_RECORDS]);
+        fflush(stdout);
+    }
+}
+
+// نضيف دفعة للإحصائيات، وفي وضع --rma ندفع مساهمتها للرانك 0 (عقود
+// الدفعة تنبدأ من الصفر كل مرة، فالمدفوع مجموعها بالضبط مو فرق مجاميع)
+void add_batch(LocalStats *st, const StockData *d, int count, RmaResults *rma, int rank) {
+    double before = st->sum_avg;
+    add_records(st, d, count);
+    if (rma && count > 0) {
+        rma_push_decades(rma, &st->decades);
+        decade_acc_init(&st->decades);
+        rma_push(rma, st->sum_avg - before, 0.0, count, 0.0);
+        if (rank == 0) {
+            double vals[RMA_FIELDS];
+            rma_progress(rma, vals);
+        }
+    }
+}
+
+// ذاكرة العملية الفعلية (PSS) بالكيلوبايت: الصفحات المشتركة تنقسم على
+// العمليات اللي تشاركها، فمجموعها على العقدة هو استهلاك العقدة الحقيقي
+long pss_kb(void) {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return 0;
+    char line[256];
+    long kb = 0;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "Pss: %ld kB", &kb) == 1) break;
+    fclose(f);
+    return kb;
+}
+
+// ================= وضع المجلد: ./mpi <stocks_directory> [options] =================
+// كل ملف CSV بالمجلد يروح لعملية وحدة، والنتايج بالعقود (decades) تتجمع بالآخر
+
+// دمج إحصائيات العقود (عملية MPI_Op خاصة فوق DecadeAcc)
+void decade_merge_op(void *in, void *inout, int *len, MPI_Datatype *type) {
+    (void)type;
+    for (int i = 0; i < *len; i++)
+        decade_acc_merge((DecadeAcc *)inout + i, (const DecadeAcc *)in + i);
+}
+
+// قائمة الملفات تنبني مرة وحدة بالتوازي: كل رانك يقرأ ويعمل stat لقسم من
+// المجلد (حسب hash اسم الملف أو المجلد الفرعي، والمجلدات الفرعية بس مع
+// --recursive)، والرانك 0 يجمع الأقسام
+// بـ MPI_Gatherv ويدمجها ويرقّم الأسهم ويرتبها من الأكبر للأصغر.
+// ترجع buffer بصيغة manifest_pack على الرانك 0 (NULL بباقي الرانكات)
+void *gather_manifest(const char *dirpath, int recursive, int rank, int size, size_t *len) {
+    Catalog part;
+    int failed = catalog_build_part(&part, dirpath, recursive, 0, rank, size) != 0;
+    size_t part_len = 0;
+    void *packed = failed ? NULL : manifest_pack(&part, &part_len);
+    if (!failed) catalog_free(&part);
+    failed = failed || !packed || part_len > INT_MAX;
+
+    int any_failed;
+    MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (any_failed) {
+        free(packed);
+        return NULL;
+    }
+
+    int my_len = (int)part_len;
+    int *lens = NULL, *displs = NULL;
+    char *all = NULL;
+    if (rank == 0) {
+        lens = (int *)malloc(size * sizeof(int));
+        displs = (int *)malloc(size * sizeof(int));
+    }
+    MPI_Gather(&my_len, 1, MPI_INT, lens, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        long long total = 0;
+        for (int r = 0; r < size; r++) {
+            displs[r] = (int)total;
+            total += lens[r];
+        }
+        if (total > INT_MAX) {
+            printf("Error: directory listing too large to gather (%lld bytes)\n", total);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        all = (char *)malloc(total);
+    }
+    MPI_Gatherv(packed, my_len, MPI_BYTE, all, lens, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+    free(packed);
+    if (rank != 0)
+        return NULL;
+
+    // الرانك 0 يدمج الأقسام بترتيب الرانكات
+    Catalog merged, view;
+    int ok = catalog_init_root(&merged, dirpath) == 0;
+    for (int r = 0; ok && r < size; r++)
+        ok = manifest_view(&view, all + displs[r], lens[r]) == 0 && manifest_merge(&merged, &view) == 0;
+    ok = ok && catalog_assign_tickers(&merged) == 0;
+    free(all);
+    free(lens);
+    free(displs);
+    if (!ok) {
+        printf("Error: cannot merge the directory listing\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    catalog_sort_by_size(&merged);
+    void *out = manifest_pack(&merged, len);
+    catalog_free(&merged);
+    return out;
+}
+
+// الـ catalog عند كل الرانكات: من ملف الـ manifest (mmap بكل رانك) إذا موجود
+// ومحدّث، وإلا يُبنى بالتوازي ويُحفظ بالملف؛ بدون --manifest أو إذا في رانك
+// ما قدر يفتح الملف، الرانك 0 يبث الـ manifest نفسه بـ MPI_Bcast.
+// *buf يرجع الذاكرة اللي لازم تنحرر بالآخر (NULL إذا الـ catalog من mmap)
+int load_catalog(Catalog *c, void **buf, const char *dirpath, const char *file, int recursive,
+                 int check, int rank, int size, int *built) {
+    *buf = NULL;
+
+    // الرانك 0 وحده يتأكد إن الملف محدّث (stat للمجلدات مرة وحدة مو بكل رانك)
+    int fresh = 0;
+    if (rank == 0 && file) {
+        Catalog probe;
+        fresh = manifest_open(&probe, file, dirpath, recursive, check, 0) == 0;
+        if (fresh) catalog_free(&probe);
+    }
+    MPI_Bcast(&fresh, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    *built = !fresh;
+
+    size_t len = 0;
+    void *packed = NULL;
+    int written = fresh;
+    if (!fresh) {
+        packed = gather_manifest(dirpath, recursive, rank, size, &len);
+        if (rank == 0 && !packed) written = -1;
+        if (rank == 0 && packed && file) {
+            Catalog view;
+            manifest_view(&view, packed, len);
+            written = manifest_write(&view, file) == 0;
+            if (!written) printf("Warning: cannot write manifest %s\n", file);
+        }
+        MPI_Bcast(&written, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (written < 0) return -1;
+    }
+
+    // كل رانك يعمل mmap للملف، وإذا فشل عند أي رانك نرجع للبث
+    int failed = !written || manifest_open(c, file, dirpath, recursive,
+                                                 MANIFEST_CHECK_NONE, 0) != 0;
+    int any_failed;
+    MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (!any_failed) {
+        free(packed);
+        return 0;
+    }
+    if (!failed) {
+        if (rank == 0 && !packed) packed = manifest_pack(c, &len);
+        catalog_free(c);
+    }
+
+    long long blen = (long long)len;
+    MPI_Bcast(&blen, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if (blen > INT_MAX) {
+        if (rank == 0) printf("Error: manifest too large to broadcast (%lld bytes)\n", blen);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (rank != 0) packed = malloc(blen);
+    MPI_Bcast(packed, (int)blen, MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (manifest_view(c, packed, (size_t)blen) != 0) {
+        printf("Error: bad manifest\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    *buf = packed;
+    return 0;
+}
+
+// نضيف ملف i من الـ catalog لإحصائيات العقود (من الكاش أو الـ CSV)
+// وترجع عدد بايتات الـ CSV اللي انقرأت
+double add_catalog_file(DecadeAcc *acc, const Catalog *c, int i, NodeArena *arena,
+                        const StockOptions *opts, const LoadSpec *spec, int chunk_rows) {
+    if (opts->cache_dir) {
+        CacheView view;
+        if (stock_cache_load(&view, opts->cache_dir, c, i, arena, opts->cache_flags) == 0) {
+            double bytes = (double)view.text_bytes;
+            decade_acc_add_cached(acc, &view, opts->metrics, opts->from_day, opts->to_day);
+            stock_cache_close(&view);
+            return bytes;
+        }
+    }
+    if (chunk_rows > 0)
+        return (double)decade_acc_add_streamed(acc, catalog_path(c, i), arena, spec,
+                                               opts->metrics, chunk_rows, NULL);
+    return (double)decade_acc_add_file(acc, catalog_path(c, i), arena, spec, opts->metrics);
+}
+
+// --shard: كل عقدة تنسخ ملفاتها (حسب shard_plan) للقرص المحلي، ورانكات
+// العقدة يتقاسمون النسخ. الملف الموجود بنفس الحجم والـ mtime ما ينعاد نسخه،
+// فإذا انقطع النسخ نعيد تشغيل الأمر ويكمّل من مكانه
+void shard_dataset(const Catalog *c, const int *node_of, const MpiNodes *topo,
+                   const char *local_dir, int rank) {
+    // [ملفات انتسخت، بايتاتها، ملفات موجودة أصلاً، ملفات فشلت]
+    long long mine[4] = { 0, 0, 0, 0 }, all[4];
+    char path[4096];
+    for (int i = 0, k = 0; i < c->count; i++) {
+        if (node_of[i] != topo->node_index || k++ % topo->node_size != topo->node_rank)
+            continue;
+        if (shard_local_path(path, sizeof(path), local_dir, c, i) != 0) {
+            mine[3]++;
+        } else if (shard_resident(path, c, i)) {
+            mine[2]++;
+        } else if (shard_copy(c, i, path) == 0) {
+            mine[0]++;
+            mine[1] += c->entries[i].size;
+        } else {
+            fprintf(stderr, "Cannot copy %s to %s\n", catalog_path(c, i), path);
+            mine[3]++;
+        }
+    }
+    MPI_Reduce(mine, all, 4, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+        printf("Sharded to %s on %d node(s): %lld files copied (%.1f MB), %lld already present,"
+               " %lld failed\n", local_dir, topo->nodes, all[0], all[1] / 1e6, all[2], all[3]);
+}
+
+// --build-cache: الملفات تتوزع على الرانكات بـ LPT (الأكبر أول، لأخف رانك)
+// وكل ملف ينكتب باسم مؤقت ثم rename؛ الملفات الجاهزة ما تنعاد، فإذا انقطع
+// البناء نعيد نفس الأمر ويكمّل
+int build_cache(Catalog *c, const StockOptions *opts, int rank, int size) {
+    char manifest[4096];
+    int usable = opts->cache_dir &&
+                 stock_cache_manifest(manifest, sizeof(manifest), opts->cache_dir) == 0;
+    int all_usable;
+    MPI_Allreduce(&usable, &all_usable, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!all_usable) {
+        if (rank == 0) printf("Cannot use cache directory: %s\n", opts->cache_dir);
+        return 1;
+    }
+
+    int *part_of = (int *)malloc(c->count * sizeof(int));
+    if (!part_of || catalog_partition(c, size, part_of) != 0) {
+        printf("Memory allocation failed for the cache build plan\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // بقايا بناء سابق انقطع (ملفات .tmp) ننظفها قبل ما يبدأ أي رانك
+    if (rank == 0) stock_cache_clean(opts->cache_dir);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t0 = MPI_Wtime();
+
+    CacheBuildStats mine = { 0, 0, 0, 0 }, all;
+    NodeArena arena;
+    arena_init(&arena, -1);
+    for (int i = 0; i < c->count; i++) {
+        if (part_of[i] != rank) continue;
+        size_t bytes;
+        int status = stock_cache_build(opts->cache_dir, c, i, &arena, opts->cache_flags, &bytes);
+        cache_build_count(&mine, status, bytes);
+    }
+    arena_release(&arena);
+    free(part_of);
+
+    MPI_Reduce(&mine, &all, 4, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    double seconds = MPI_Wtime() - t0;
+    if (rank == 0) {
+        if (manifest_save(c, manifest) != 0)
+            printf("Warning: cannot write manifest %s\n", manifest);
+        printf("Total Processes: %d\n", size);
+        stock_cache_report(opts->cache_dir, &all, seconds);
+    }
+    int failed = rank == 0 ? all.failed > 0 : 0;
+    MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return failed;
+}
+
+// الـ catalog المبثوث مجرد view فوق الـ buffer، فنحرر الـ buffer بس
+void release_catalog(Catalog *c, void *buf) {
+    if (buf)
+        free(buf);
+    else
+        catalog_free(c);
+}
+
+// طباعة ملخص العقود (نفس شكل النسخة التسلسلية و OpenMP)
+void print_decades(const DecadeAcc *t, unsigned metrics) {
+    printf("Market Summary by Decade (MPI):\n");
+    printf("------------------------------------------------------------\n");
+
+    int first_decade = (t->min_year / 10) * 10;
+    for (int decade_start = first_decade; decade_start <= 2010; decade_start += 10) {
+        int d = (decade_start - MIN_YEAR_GLOBAL) / 10;
+        if (d < 0 || d >= MAX_DECADES)
+            continue;
+        long rows = t->rows[d];
+        long rets = t->ret_count[d];
+        if (rows == 0 && rets == 0)
+            continue;
+
+        double mean_price = rows > 0 ? t->sum_avg[d] / (double)rows : 0.0;
+        double vol = 0.0, mean_r = 0.0;
+        if (rets > 0) {
+            mean_r = t->sum_ret[d] / (double)rets;
+            double var = t->sum_ret_sq[d] / (double)rets - mean_r * mean_r;
+            vol = sqrt(var < 0.0 ? 0.0 : var);
+        }
+        double annual_r = mean_r * 252.0;       // تقريباً 252 يوم تداول بالسنة
+
+        printf("Decade %d–%d:\n", decade_start, decade_start == 2010 ? 2020 : decade_start + 9);
+        if (metrics & METRIC_PRICES) {
+            printf("  Rows used:             %ld\n", rows);
+            printf("  Mean market price:     %.4f\n", mean_price);
+        }
+        if (!(metrics & METRIC_RETURNS)) {
+            printf("\n");
+            continue;
+        }
+        printf("  Market volatility:     %.4f (%.4f%%)\n", vol, vol * 100.0);
+        if (rets > 0) {
+            printf("  Mean daily return:     %.6f (%.4f%%)\n", mean_r, mean_r * 100.0);
+            printf("  Approx annual return:  %.6f (%.4f%%)\n\n", annual_r, annual_r * 100.0);
+        } else {
+            printf("  Mean daily return:     N/A\n");
+            printf("  Approx annual return:  N/A\n\n");
+        }
+    }
+    printf("Overall Years Range in Data: %d–%d\n", t->min_year, t->max_year);
+}
+
+int analyse_directory(int argc, char *argv[], int rank, int size) {
+    // خيارات MPI (--hier / --bcast) نشيلها، والباقي نفس خيارات النسخ الثانية
+    // --shard=DIR: ننسخ الداتا للأقراص المحلية للعقد ونطلع
+    // --local=DIR: كل عقدة تقرأ ملفاتها من DIR، والناقص من المجلد المشترك
+    int hier = 0, bcast = 0, nargs = 1;
+    const char *shard_dir = NULL, *local_dir = NULL;
+    char **args = (char **)malloc((argc + 1) * sizeof(char *));
+    args[0] = argv[0];
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hier") == 0) {
+            hier = 1;
+        } else if (strcmp(argv[i], "--bcast") == 0) {
+            bcast = 1;
+        } else if (strncmp(argv[i], "--shard=", 8) == 0 && argv[i][8]) {
+            shard_dir = argv[i] + 8;
+        } else if (strncmp(argv[i], "--local=", 8) == 0 && argv[i][8]) {
+            local_dir = argv[i] + 8;
+        } else if (strcmp(argv[i], "--shared") == 0 || strcmp(argv[i], "--rma") == 0) {
+            if (rank == 0) printf("%s works on stock_data.csv, not on a directory\n", argv[i]);
+            free(args);
+            return 1;
+        } else {
+            args[nargs++] = argv[i];
+        }
+    }
+    StockOptions opts;
+    int bad = parse_options(nargs, args, &opts) != 0;
+    free(args);
+    if (bad) {
+        if (rank == 0)
+            printf("Usage: %s [--shared] [--hier] [--bcast] [--rma]\n"
+                   "       %s " STOCK_OPTIONS_USAGE " [--hier] [--bcast]"
+                   " [--shard=LOCAL_DIR | --local=LOCAL_DIR]\n", argv[0], argv[0]);
+        return 1;
+    }
+    if (opts.validate || opts.autotune || opts.readers || opts.counters || opts.market) {
+        if (rank == 0)
+            printf("--validate, --autotune, --pipeline, --counters and --market are not supported"
+                   " by the MPI version\n");
+        return 1;
+    }
+    if (shard_dir && local_dir) {
+        if (rank == 0) printf("--shard copies the dataset and exits; run --local afterwards\n");
+        return 1;
+    }
+    if (opts.years_dir && (shard_dir || local_dir)) {
+        if (rank == 0) printf("--years reads the year layout and cannot be combined with --shard or --local\n");
+        return 1;
+    }
+    const char *dirpath = opts.dirpath;
+
+    // -------- قائمة الملفات (manifest) --------
+    // بدون --manifest، الكاش اللي بناه --build-cache فيه manifest نستخدمه
+    // (مع فحص كل ملف، لأن الملف اللي ينكتب فوقه ما يغيّر mtime المجلد)
+    char cache_manifest[4096];
+    int manifest_check = MANIFEST_CHECK_DIRS, use_cache_manifest = 0;
+    if (rank == 0 && !opts.manifest && opts.cache_dir && !opts.build_cache &&
+        stock_cache_manifest(cache_manifest, sizeof(cache_manifest), opts.cache_dir) == 0)
+        use_cache_manifest = access(cache_manifest, F_OK) == 0;
+    MPI_Bcast(&use_cache_manifest, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (use_cache_manifest) {
+        stock_cache_manifest(cache_manifest, sizeof(cache_manifest), opts.cache_dir);
+        opts.manifest = cache_manifest;
+        manifest_check = MANIFEST_CHECK_FILES;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t0 = MPI_Wtime();
+    Catalog catalog;
+    void *catalog_buf;
+    int built;
+    if (load_catalog(&catalog, &catalog_buf, dirpath, opts.manifest, opts.recursive,
+                     manifest_check, rank, size, &built) != 0) {
+        if (rank == 0) printf("Cannot open directory: %s\n", dirpath);
+        return 1;
+    }
+    double manifest_time = MPI_Wtime() - t0;
+
+    if (catalog.count == 0) {
+        if (rank == 0) printf("No CSV files found in directory: %s\n", dirpath);
+        release_catalog(&catalog, catalog_buf);
+        return 0;
+    }
+    if (opts.cache_dir && stock_cache_prepare(opts.cache_dir) != 0)
+        opts.cache_dir = NULL;
+
+    // --build-cache: كل رانك يحوّل مجموعة ملفات متوازنة بالحجم، والرانك 0
+    // يحفظ القائمة المدمجة بالكاش بالآخر عشان يصير جاهز للاستخدام فوراً
+    if (opts.build_cache) {
+        int status = build_cache(&catalog, &opts, rank, size);
+        release_catalog(&catalog, catalog_buf);
+        return status;
+    }
+
+    // --years: الرانك 0 يبني تقسيم السنين (بكل الثريدات) إذا كان ناقص أو
+    // قديم، والباقي يفتحونه بعده؛ كل رانك بعدين ياخذ سنين كاملة بدل ملفات
+    YearLayout years;
+    int years_built = 0;
+    memset(&years, 0, sizeof(years));
+    if (opts.years_dir) {
+        if (rank == 0)
+            years_built = year_layout_prepare(&years, opts.years_dir, &catalog, 1);
+        MPI_Bcast(&years_built, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        int bad = years_built < 0;
+        if (!bad && rank != 0)
+            bad = year_layout_open(&years, opts.years_dir, year_layout_fingerprint(&catalog)) != 0;
+        MPI_Allreduce(MPI_IN_PLACE, &bad, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        if (bad) {
+            if (rank == 0) printf("Cannot build the year layout in %s\n", opts.years_dir);
+            year_layout_free(&years);
+            release_catalog(&catalog, catalog_buf);
+            return 1;
+        }
+    }
+
+    // --mem-budget: كل عملية تقرأ ملفاتها على دفعات بحدود الميزانية
+    LoadSpec spec = { metric_columns(opts.metrics), opts.from_day, opts.to_day };
+    int chunk_rows = 0;
+    if (opts.mem_budget) {
+        chunk_rows = csv_stream_rows(opts.mem_budget, spec.columns);
+        if (chunk_rows == 0) {
+            if (rank == 0)
+                printf("--mem-budget too small: at least %zu MB are needed\n",
+                       (CSV_STREAM_MIN_BUDGET + (1u << 20) - 1) >> 20);
+            release_catalog(&catalog, catalog_buf);
+            return 1;
+        }
+    }
+
+    MpiNodes topo;
+    int use_topo = hier || shard_dir || local_dir;
+    if (use_topo)
+        mpi_nodes_init(&topo, MPI_COMM_WORLD);
+
+    // توزيع الأسهم على العقد (نفسه بكل تشغيل طالما عدد العقد ما تغيّر)
+    int *node_of = NULL;
+    if (shard_dir || local_dir) {
+        node_of = (int *)malloc(catalog.count * sizeof(int));
+        if (!node_of || shard_plan(&catalog, topo.nodes, node_of) != 0) {
+            printf("Memory allocation failed for the shard plan\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    if (shard_dir) {
+        shard_dataset(&catalog, node_of, &topo, shard_dir, rank);
+        free(node_of);
+        mpi_nodes_free(&topo);
+        release_catalog(&catalog, catalog_buf);
+        return 0;
+    }
+
+    if (rank == 0) {
+        printf("\nMPI Stock Analysis - Market Metrics by Decade (Cleaned)\n");
+        printf("Directory: %s\n", dirpath);
+        printf("Files found: %d (%d tickers)\n", catalog.count, catalog.tickers);
+        printf("Total Processes: %d\n", size);
+        printf("Manifest: %s (%s in %.6f seconds)\n", opts.manifest ? opts.manifest : "broadcast",
+               built ? "listed by all ranks" : "mapped", manifest_time);
+        if (opts.years_dir)
+            printf("Year layout: %s (%d years, %d tickers, %s)\n", opts.years_dir,
+                   years.segments, years.tickers, years_built ? "built now by rank 0" : "current");
+        printf("============================================================\n\n");
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start_time = MPI_Wtime();
+
+    // الملفات مرتبة من الأكبر للأصغر، فالتوزيع الدوري يوازن الحمل تقريباً
+    DecadeAcc acc;
+    decade_acc_init(&acc);
+    NodeArena arena;
+    arena_init(&arena, -1);
+    double bytes = 0.0;
+    // --local: [ملفات محلية، بايتاتها، ملفات من المجلد المشترك، بايتاتها]
+    long long reads[4] = { 0, 0, 0, 0 };
+    int segments_read = 0;
+    if (opts.years_dir) {
+        if (year_layout_scan(&years, &acc, opts.metrics, opts.from_day, opts.to_day, rank, size, 0,
+                             &segments_read, &bytes) != 0) {
+            printf("Rank %d cannot read the year layout in %s\n", rank, opts.years_dir);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    } else if (!local_dir) {
+        for (int i = rank; i < catalog.count; i += size)
+            bytes += add_catalog_file(&acc, &catalog, i, &arena, &opts, &spec, chunk_rows);
+    } else {
+        // ملفات عقدتنا تتوزع دورياً على رانكات العقدة؛ الموجود على القرص
+        // المحلي ينقرأ من هناك (catalog ثاني جذره local_dir) والناقص من المشترك
+        Catalog local;
+        if (catalog_init_root(&local, local_dir) != 0) {
+            printf("Memory allocation failed for the local catalog\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        size_t root_len = strlen(local.paths);
+        char path[4096];
+        for (int i = 0, k = 0; i < catalog.count; i++) {
+            if (node_of[i] != topo.node_index || k++ % topo.node_size != topo.node_rank)
+                continue;
+            if (shard_local_path(path, sizeof(path), local_dir, &catalog, i) == 0 &&
+                shard_resident(path, &catalog, i)) {
+                const char *rel = catalog_relpath(&catalog, i);
+                size_t off = catalog_push_path(&local, 0, root_len, rel, strlen(rel));
+                if (off == (size_t)-1 || catalog_add(&local, off) != 0) {
+                    printf("Memory allocation failed for the local catalog\n");
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                local.entries[local.count - 1] = catalog.entries[i];
+                local.entries[local.count - 1].path_off = off;
+                continue;
+            }
+            bytes += add_catalog_file(&acc, &catalog, i, &arena, &opts, &spec, chunk_rows);
+            reads[2]++;
+            reads[3] += catalog.entries[i].size;
+        }
+        for (int i = 0; i < local.count; i++) {
+            bytes += add_catalog_file(&acc, &local, i, &arena, &opts, &spec, chunk_rows);
+            reads[0]++;
+            reads[1] += local.entries[i].size;
+        }
+        catalog_free(&local);
+    }
+    arena_release(&arena);
+
+    // -------- جمع إحصائيات العقود من كل العمليات --------
+    MPI_Datatype acc_type;
+    MPI_Op merge_op;
+    MPI_Type_contiguous(sizeof(DecadeAcc), MPI_BYTE, &acc_type);
+    MPI_Type_commit(&acc_type);
+    MPI_Op_create(decade_merge_op, 1, &merge_op);
+
+    DecadeAcc totals;
+    decade_acc_init(&totals);
+    if (hier)
+        mpi_node_reduce(&topo, &acc, &totals, 1, acc_type, merge_op, bcast);
+    else if (bcast)
+        MPI_Allreduce(&acc, &totals, 1, acc_type, merge_op, MPI_COMM_WORLD);
+    else
+        MPI_Reduce(&acc, &totals, 1, acc_type, merge_op, 0, MPI_COMM_WORLD);
+    double total_bytes = 0.0;
+    MPI_Reduce(&bytes, &total_bytes, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    long long total_reads[4];
+    MPI_Reduce(reads, total_reads, 4, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    int total_segments = 0;
+    MPI_Reduce(&segments_read, &total_segments, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start_time;
+
+    if (rank == 0) {
+        print_decades(&totals, opts.metrics);
+        printf("Execution time (MPI): %.6f seconds\n", elapsed);
+        if (opts.years_dir)
+            printf("Scan throughput:      %.3f GB/s (%.1f MB of columns, %d of %d year segments)\n",
+                   total_bytes / elapsed / 1e9, total_bytes / 1e6, total_segments,
+                   years.segments);
+        else
+            printf("Ingest throughput:    %.3f GB/s (%.1f MB of CSV)\n",
+                   total_bytes / elapsed / 1e9, total_bytes / 1e6);
+        if (local_dir)
+            printf("Node-local reads: %lld files (%.1f MB), shared-directory fallback: %lld files"
+                   " (%.1f MB), %d node(s)\n", total_reads[0], total_reads[1] / 1e6,
+                   total_reads[2], total_reads[3] / 1e6, topo.nodes);
+    }
+
+    MPI_Op_free(&merge_op);
+    MPI_Type_free(&acc_type);
+    free(node_of);
+    if (use_topo)
+        mpi_nodes_free(&topo);
+    year_layout_free(&years);
+    release_catalog(&catalog, catalog_buf);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
 
     int rank, size;
@@ -31,92 +845,299 @@ int main(int argc, char *argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);           // رقم العملية الحالية
     MPI_Comm_size(MPI_COMM_WORLD, &size);           // عدد العمليات كلها
 
+    // إذا انعطى مجلد، نحلل كل ملفات الـ CSV فيه بدل stock_data.csv
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            int status = analyse_directory(argc, argv, rank, size);
+            MPI_Finalize();
+            return status;
+        }
+    }
+
+    // --shared: نسخة وحدة من الداتا لكل عقدة بدل توزيعها على دفعات
+    // --hier:   جمع النتايج على مستويين (داخل العقدة ثم بين العقد)
+    // --bcast:  النتيجة النهائية توصل لكل العمليات مو بس للرانك 0
+    // --rma:    النتايج الجزئية تتجمع بـ MPI_Accumulate بدل الـ reduction
+    int shared = 0, hier = 0, bcast = 0, rma_mode = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--shared") == 0) {
+            shared = 1;
+        } else if (strcmp(argv[i], "--hier") == 0) {
+            hier = 1;
+        } else if (strcmp(argv[i], "--bcast") == 0) {
+            bcast = 1;
+        } else if (strcmp(argv[i], "--rma") == 0) {
+            rma_mode = 1;
+        } else {
+            if (rank == 0)
+                printf("Usage: %s [--shared] [--hier] [--bcast] [--rma]\n", argv[0]);
+            MPI_Finalize();
+            return 1;
+        }
+    }
+    if (rma_mode && (hier || bcast)) {
+        if (rank == 0) printf("--rma replaces the final reduction (no --hier / --bcast)\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    // تقسيم العمليات حسب العقد (نحتاجه للذاكرة المشتركة وللجمع الهرمي)
+    MpiNodes topo;
+    if (shared || hier)
+        mpi_nodes_init(&topo, MPI_COMM_WORLD);
+
     double start_time, end_time;
     int n;                                          // عدد السجلات الكلي
-    StockData *data = NULL;
+    FILE *file = NULL;
+    char line[256];
 
     // عملية الرانك 0 هي اللي تقرأ الداتا من الملف
+    // القراءة الأولى تعد السجلات فقط، ما نحمّل الملف كله بالذاكرة
     if (rank == 0) {
 
-        FILE *file = fopen("stock_data.csv", "r");
+        file = fopen("stock_data.csv", "r");
         if (!file) {
             printf("Error: cannot open file\n");
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
 
-        char line[256];
         fgets(line, sizeof(line), file);            // نتجاهل الهيدر
-
-        data = malloc(sizeof(StockData) * MAX_DAYS);
         n = 0;
-
-        // قراءة الملف سطر سطر
-        // نقرأ فقط الأعمدة المهمة: open, high, low, close
-        while (fgets(line, sizeof(line), file) && n < MAX_DAYS) {
-            sscanf(line, "%*[^,],%lf,%lf,%lf,%lf,%*lf",
-                   &data[n].open, &data[n].high, &data[n].low, &data[n].close);
+        while (fgets(line, sizeof(line), file))
             n++;
-        }
 
-        fclose(file);
         printf("Total records read: %d\n", n);
     }
 
     // نرسل عدد السجلات لكل العمليات
     MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-    // كل عملية تأخذ جزء من البيانات (chunk)
+    // كل عملية مسؤولة عن جزء متصل من السجلات (chunk)
     int chunk = n / size;
-    StockData *local_data = malloc(sizeof(StockData) * chunk);
+    long long used = (long long)chunk * size;       // السجلات اللي توزعت
 
-    // توزيع البيانات بين العمليات
-    MPI_Scatter(data, chunk * sizeof(StockData), MPI_BYTE,
-                local_data, chunk * sizeof(StockData), MPI_BYTE,
-                0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        rewind(file);
+        fgets(line, sizeof(line), file);            // نتجاهل الهيدر
+    }
 
     MPI_Barrier(MPI_COMM_WORLD);
     start_time = MPI_Wtime();       // بدء حساب الوقت
 
     // -------- الحسابات المحلية لكل عملية --------
 
-    double local_sum_avg = 0.0;
-    double *local_returns = malloc(sizeof(double) * (chunk - 1));
+    LocalStats st;
+    local_stats_init(&st);
 
-    // حساب المتوسطات والعوائد
-    for (int i = 0; i < chunk; i++) {
-        local_sum_avg += daily_average(local_data[i]);
-
-        if (i > 0)
-            local_returns[i - 1] = daily_return(local_data[i - 1].close,
-                                               local_data[i].close);
+    // نافذة النتايج على الرانك 0 (باقي العمليات حجمها صفر)
+    RmaResults results, *rma = NULL;
+    if (rma_mode) {
+        RmaWindow *base;
+        MPI_Aint bytes = RMA_SEAM_AT(size);
+        MPI_Win_allocate(rank == 0 ? bytes : 0, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &base,
+                         &results.win);
+        if (rank == 0) {
+            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, results.win);
+            memset(base, 0, (size_t)bytes);
+            decade_acc_init(&base->decades);
+            MPI_Win_unlock(0, results.win);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        results.total = used;
+        results.shown = 0;
+        rma = &results;
     }
+    double startup = 0.0;           // وقت تحميل الداتا للذاكرة المشتركة
+    long node_kb = 0;               // ذاكرة العقدة (PSS) عند قائد العقدة
+    int node_rank = 0, node_size = 1, nodes = 1;
 
-    // حساب الفولاتيليتي محلياً
-    double sum_ret = 0.0;
-    for (int i = 0; i < chunk - 1; i++)
-        sum_ret += local_returns[i];
+    if (shared) {
+        // العمليات اللي على نفس العقدة تتشارك نافذة ذاكرة وحدة (shared window):
+        // قائد العقدة (node_rank 0) يحجز الداتا كلها، والباقي يقرأ منها مباشرة
+        node_rank = topo.node_rank;
+        node_size = topo.node_size;
 
-    double mean_ret = sum_ret / (chunk - 1);
+        StockData *all;
+        MPI_Win win;
+        MPI_Aint bytes = node_rank == 0 ? (MPI_Aint)used * (MPI_Aint)sizeof(StockData) : 0;
+        MPI_Win_allocate_shared(bytes, sizeof(StockData), MPI_INFO_NULL, topo.node,
+                                &all, &win);
+        MPI_Aint win_size;
+        int disp_unit;
+        MPI_Win_shared_query(win, 0, &win_size, &disp_unit, &all);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
 
-    double var = 0.0;
-    for (int i = 0; i < chunk - 1; i++)
-        var += pow(local_returns[i] - mean_ret, 2);
+        // الرانك 0 يقرأ الملف مرة وحدة، ويرسله لقادة العقد الثانية على دفعات
+        if (rank == 0)
+            read_records(file, all, used);
+        if (node_rank == 0) {
+            nodes = topo.nodes;
+            for (long long first = 0; first < used; first += MPI_STREAM_RECORDS) {
+                long long len = used - first < MPI_STREAM_RECORDS ? used - first
+                                                                  : MPI_STREAM_RECORDS;
+                MPI_Bcast(all + first, (int)(len * sizeof(StockData)), MPI_BYTE, 0,
+                          topo.leaders);
+            }
+        }
+        MPI_Win_sync(win);
+        MPI_Barrier(topo.node);     // الداتا جاهزة لكل عمليات العقدة
+        MPI_Win_sync(win);
+        startup = MPI_Wtime() - start_time;
 
-    double local_vol = sqrt(var / (chunk - 1));
+        // كل عملية تحسب جزءها المتصل مباشرة من الذاكرة المشتركة، دفعة دفعة
+        const StockData *mine = all + (long long)rank * chunk;
+        for (int first = 0; first < chunk; first += MPI_STREAM_RECORDS)
+            add_batch(&st, mine + first, chunk - first < MPI_STREAM_RECORDS ? chunk - first
+                                                                         : MPI_STREAM_RECORDS,
+                      rma, rank);
 
-    // -------- جمع نتايج كل العمليات --------
+        // ذاكرة كل عقدة = مجموع PSS لعملياتها، ونطبع أكبر عقدة
+        long my_kb = pss_kb();
+        MPI_Reduce(&my_kb, &node_kb, 1, MPI_LONG, MPI_SUM, 0, topo.node);
+        if (node_rank == 0) {
+            long kb = node_kb;
+            MPI_Reduce(&kb, &node_kb, 1, MPI_LONG, MPI_MAX, 0, topo.leaders);
+        }
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &node_size, &node_size, 1, MPI_INT,
+                   MPI_MAX, 0, MPI_COMM_WORLD);
 
-    double global_sum_avg = 0.0;
-    MPI_Reduce(&local_sum_avg, &global_sum_avg, 1,
-               MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Win_unlock_all(win);
+        MPI_Win_free(&win);
+    } else {
+        // الرانك 0 يقرأ ويوزع على دفعات ثابتة الحجم، فالذاكرة ما تعتمد على حجم الملف
+        StockData *batch = NULL;
+        StockData *local_data = malloc(sizeof(StockData) * MPI_STREAM_RECORDS);
+        int *counts = malloc(sizeof(int) * size);
+        int *displs = malloc(sizeof(int) * size);
+        if (rank == 0)
+            batch = malloc(sizeof(StockData) * MPI_STREAM_RECORDS);
 
-    double global_vol = 0.0;
-    MPI_Reduce(&local_vol, &global_vol, 1,
-               MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        for (long long first = 0; first < used; first += MPI_STREAM_RECORDS) {
+            int batch_len = (int)(used - first < MPI_STREAM_RECORDS ? used - first
+                                                                    : MPI_STREAM_RECORDS);
 
-    MPI_Barrier(MPI_COMM_WORLD);
+            // نصيب كل عملية من هذه الدفعة
+            for (int r = 0; r < size; r++) {
+                long long lo = (long long)r * chunk, hi = lo + chunk;
+                if (lo < first) lo = first;
+                if (hi > first + batch_len) hi = first + batch_len;
+                counts[r] = hi > lo ? (int)(hi - lo) * (int)sizeof(StockData) : 0;
+                displs[r] = hi > lo ? (int)(lo - first) * (int)sizeof(StockData) : 0;
+            }
+
+            if (rank == 0)
+                read_records(file, batch, batch_len);
+
+            // توزيع الدفعة بين العمليات
+            MPI_Scatterv(batch, counts, displs, MPI_BYTE,
+                         local_data, counts[rank], MPI_BYTE,
+                         0, MPI_COMM_WORLD);
+
+            add_batch(&st, local_data, counts[rank] / (int)sizeof(StockData), rma, rank);
+        }
+
+        free(local_data);
+        free(counts);
+        free(displs);
+        free(batch);
+    }
+
+    if (rank == 0) fclose(file);
+    if (!rma)
+        add_seam_return(&st, rank, size);
+
+    // حساب الفولاتيليتي محلياً
+    double local_vol = sqrt(st.m2 / (chunk - 1));
+
+    // -------- جمع نتايج كل العمليات --------
+
+    // النتايج الجزئية لكل عملية: مجموع متوسطات الأسعار ومجموع الفولاتيليتي
+    double partial[2] = { st.sum_avg, local_vol };
+    double global[2] = { 0.0, 0.0 };
+    DecadeAcc decades;
+    decade_acc_init(&decades);
+    if (rma) {
+        // كل عملية تدفع حدود جزئها، وبعدين (epoch ثاني، فالحدود توصل قبل)
+        // الفولاتيليتي وإنها خلصت، والرانك 0 وحده ينتظر الباقين ويقرأ العقود
+        rma_push_seam(rma, &st, rank);
+        rma_push(rma, 0.0, local_vol, 0.0, 1.0);
+        if (rank == 0) {
+            double vals[RMA_FIELDS];
+            for (rma_progress(rma, vals); vals[RMA_DONE] < size; rma_progress(rma, vals))
+                usleep(1000);
+            global[0] = vals[RMA_SUM_AVG];
+            global[1] = vals[RMA_SUM_VOL];
+            rma_read_decades(rma, &decades, size);
+        }
+    } else if (hier)
+        mpi_node_reduce(&topo, partial, global, 2, MPI_DOUBLE, MPI_SUM, bcast);
+    else if (bcast)
+        MPI_Allreduce(partial, global, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    else
+        MPI_Reduce(partial, global, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    double global_sum_avg = global[0];
+    double global_vol = global[1];
+
+    // إحصائيات العقود كاملة (DecadeAcc) تتجمع بنفس الطريقة: هرمياً مع --hier،
+    // وإلا بالـ collective العادي؛ وضع --rma قرأها من النافذة فوق، وما فيه
+    // لا collective ولا barrier: الرانك 0 يوقف الوقت أول ما توصل النتايج
+    MPI_Datatype acc_type;
+    MPI_Op merge_op;
+    MPI_Type_contiguous(sizeof(DecadeAcc), MPI_BYTE, &acc_type);
+    MPI_Type_commit(&acc_type);
+    MPI_Op_create(decade_merge_op, 1, &merge_op);
+    if (!rma) {
+        if (hier)
+            mpi_node_reduce(&topo, &st.decades, &decades, 1, acc_type, merge_op, bcast);
+        else if (bcast)
+            MPI_Allreduce(&st.decades, &decades, 1, acc_type, merge_op, MPI_COMM_WORLD);
+        else
+            MPI_Reduce(&st.decades, &decades, 1, acc_type, merge_op, 0, MPI_COMM_WORLD);
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
     end_time = MPI_Wtime();      // نهاية الوقت
 
+    // --hier: نقيس زمن الجمع الهرمي للـ DecadeAcc مقابل الـ collective العادي
+    // لنفس البيانات، ونتأكد إن الطريقتين يطلعون نفس النتيجة
+    double hier_us = 0.0, flat_us = 0.0;
+    int same = 1;
+    if (hier) {
+        double t0;
+        DecadeAcc scratch;
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        for (int k = 0; k < REDUCE_REPS; k++)
+            mpi_node_reduce(&topo, &st.decades, &scratch, 1, acc_type, merge_op, bcast);
+        MPI_Barrier(MPI_COMM_WORLD);
+        hier_us = (MPI_Wtime() - t0) / REDUCE_REPS * 1e6;
+
+        t0 = MPI_Wtime();
+        for (int k = 0; k < REDUCE_REPS; k++) {
+            if (bcast)
+                MPI_Allreduce(&st.decades, &scratch, 1, acc_type, merge_op, MPI_COMM_WORLD);
+            else
+                MPI_Reduce(&st.decades, &scratch, 1, acc_type, merge_op, 0, MPI_COMM_WORLD);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        flat_us = (MPI_Wtime() - t0) / REDUCE_REPS * 1e6;
+
+        // الصفوف والعوائد والسنين لازم تطابق تماماً، والمجاميع لحد خطأ التقريب
+        // (ترتيب الجمع يختلف بين الطريقتين)
+        if (rank == 0)
+            for (int d = 0; d < MAX_DECADES; d++)
+                if (scratch.rows[d] != decades.rows[d] ||
+                    scratch.ret_count[d] != decades.ret_count[d] ||
+                    fabs(scratch.sum_avg[d] - decades.sum_avg[d]) >
+                        1e-9 * (fabs(decades.sum_avg[d]) + 1.0) ||
+                    fabs(scratch.sum_ret_sq[d] - decades.sum_ret_sq[d]) >
+                        1e-9 * (fabs(decades.sum_ret_sq[d]) + 1.0))
+                    same = 0;
+        same = same && (rank != 0 || (scratch.min_year == decades.min_year &&
+                                      scratch.max_year == decades.max_year));
+    }
+    MPI_Op_free(&merge_op);
+    MPI_Type_free(&acc_type);
+
     // -------- طباعة النتايج --------
     if (rank == 0) {
 
@@ -128,14 +1149,25 @@ int main(int argc, char *argv[]) {
         printf("Average Daily Price: %.4f\n", avg_price);
         printf("Average Volatility: %.6f\n", avg_vol);
         printf("Execution Time: %.6f seconds\n", end_time - start_time);
-        printf("=====================================\n");
+        if (shared) {
+            printf("Shared dataset: %.1f MB per node (%d node(s), up to %d ranks each)\n",
+                   used * (double)sizeof(StockData) / 1e6, nodes, node_size);
+            printf("Startup (load + share): %.6f seconds\n", startup);
+            printf("Node memory (PSS): %.1f MB\n", node_kb / 1024.0);
+        }
+        if (hier)
+            printf("Reduction latency (DecadeAcc, %zu bytes): %.2f us hierarchical, %.2f us flat"
+                   " %s (%d node(s), %s)\n", sizeof(DecadeAcc), hier_us, flat_us,
+                   bcast ? "MPI_Allreduce" : "MPI_Reduce", topo.nodes,
+                   same ? "same result" : "RESULTS DIFFER");
+        printf("=====================================\n\n");
+        print_decades(&decades, METRIC_PRICES | METRIC_RETURNS);
     }
 
-    // تنظيف الذاكرة
-    free(local_data);
-    free(local_returns);
-    if (rank == 0) free(data);
-
+    if (rma)
+        MPI_Win_free(&rma->win);
+    if (shared || hier)
+        mpi_nodes_free(&topo);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
@@ -1,30 +1,24 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <omp.h>
-#include <dirent.h>
 
-#define MAX_LINE_LEN 256
-
-// logical price for cleaning the data
-#define MIN_PRICE 0.01
-#define MAX_PRICE 10000.0
-
-// Allowed range for the years to be wide and safe
-#define MIN_YEAR_GLOBAL 1900
-#define MAX_YEAR_GLOBAL 2100
-#define MAX_DECADES (((MAX_YEAR_GLOBAL - MIN_YEAR_GLOBAL) / 10) + 1)
-
-// data structure representing one row of stock data
-typedef struct {
-    char date[20];
-    double open, high, low, close, volume;
-} StockData;
+#include "arena.h"
+#include "catalog.h"
+#include "decade_stats.h"
+#include "manifest.h"
+#include "market_stats.h"
+#include "perf_counters.h"
+#include "stock_cache.h"
+#include "stock_loader.h"
+#include "stock_options.h"
+#include "year_layout.h"
 
 // compute daily avg price from OHLC
-double daily_average(const StockData *s) {
-    return (s->open + s->high + s->low + s->close) / 4.0;
+double daily_average(const StockSeries *s, int i) {
+    return (s->open[i] + s->high[i] + s->low[i] + s->close[i]) / 4.0;
 }
 
 // compute daily returns (curr - prev) / prev
@@ -34,210 +28,559 @@ double daily_return(double prev, double curr) {
     return (curr - prev) / prev;
 }
 
-// Read the data form the CSV files to insert it to the dynamic array of StocksData
-// Returns number of rows; set *data_out
-// expected CSV format
-// data we read is open, high, low, close, adj_close, volume
-int read_csv(const char *filename, StockData **data_out) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Cannot open file: %s\n", filename);
-        *data_out = NULL;
-        return 0;
+// --parse-bench[=N]: the price parser (decimal_parse.h) against the
+// sscanf("%lf") of the original read_csv and strtod, on N (default 2M)
+// fields shaped like the CSVs: prices printed with "%.6f" and integer
+// volumes.  Every parsed value is checked to be bit-identical to strtod.
+#define PARSE_BENCH_FIELDS (1 << 21)
+
+// Nanoseconds per field of one parser over all fields, summing the values
+// into *sum so the work cannot be optimized away
+static double parse_bench_run(const char *text, const int *start, int n, int parser,
+                              double *sum) {
+    double s = 0.0;
+    double t0 = omp_get_wtime();
+    for (int i = 0; i < n; i++) {
+        const char *p = text + start[i], *e = text + start[i + 1] - 1;
+        double v = 0.0;
+        if (parser == 0) sscanf(p, "%lf", &v);
+        else if (parser == 1) v = strtod(p, NULL);
+        else parse_decimal(p, e, &v);
+        s += v;
+    }
+    double t = omp_get_wtime() - t0;
+    *sum = s;
+    return t * 1e9 / n;
+}
+
+static int parse_bench(const char *arg) {
+    int n = arg ? atoi(arg) : PARSE_BENCH_FIELDS;
+    if (n < 1) {
+        fprintf(stderr, "Bad parse bench field count: %s\n", arg);
+        return 1;
+    }
+    // fields back to back, each NUL-terminated (for sscanf / strtod)
+    char *text = (char *)malloc((size_t)n * 24 + DECIMAL_PAD);
+    int *start = (int *)malloc(((size_t)n + 1) * sizeof(int));
+    if (!text || !start) {
+        free(text);
+        free(start);
+        fprintf(stderr, "Memory allocation failed for the parse bench\n");
+        return 1;
+    }
+    unsigned long long x = 88172645463325252ULL;
+    int len = 0;
+    for (int i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;        // xorshift64
+        start[i] = len;
+        if (i % 6 == 5)
+            len += sprintf(text + len, "%llu", x % 100000000ULL) + 1;
+        else
+            len += sprintf(text + len, "%.6f",
+                           MIN_PRICE + (double)(x >> 11) / 9007199254740992.0 * 1000.0) + 1;
+    }
+    start[n] = len;
+    memset(text + len, 0, DECIMAL_PAD);
+
+    long long mismatches = 0;
+    for (int i = 0; i < n; i++) {
+        const char *p = text + start[i], *e = text + start[i + 1] - 1;
+        double a = strtod(p, NULL), b;
+        if (parse_decimal(p, e, &b) != 0 || memcmp(&a, &b, sizeof(a)) != 0)
+            mismatches++;
+    }
+
+    static const char *names[3] = { "sscanf(\"%lf\")", "strtod", "SWAR parser" };
+    double ns[3], sums[3];
+    printf("Parse bench: %d fields, %.1f MB\n", n, len / 1e6);
+    for (int p = 0; p < 3; p++) {
+        ns[p] = parse_bench_run(text, start, n, p, &sums[p]);
+        printf("  %-22s %7.1f ns/field  (%.2fx sscanf)\n", names[p], ns[p], ns[0] / ns[p]);
+    }
+    printf("  Mismatches vs strtod:  %lld%s\n", mismatches,
+           sums[0] == sums[1] && sums[1] == sums[2] ? "" : " (sums differ)");
+    free(text);
+    free(start);
+    return mismatches ? 1 : 0;
+}
+
+// --codec-bench[=DIR]: the cache encodings of --cache-compress and
+// --cache-precision (column_codec.h), on the CSVs of DIR or, without DIR,
+// on CODEC_BENCH_ROWS synthetic rows (a random walk in cents with integer
+// volumes).  Every layout prints its raw and encoded bytes (chunk table
+// included), then per codec the decode speed in GB/s of decoded column
+// bytes, one block of one column at a time as cache_block decodes.  The
+// lossless layout is checked to decode bit-identically.
+#define CODEC_BENCH_ROWS    (1 << 22)
+#define CODEC_BENCH_SECONDS 0.2
+#define CODEC_BENCH_LAYOUTS 3
+
+// One encoded block of one column
+typedef struct {
+    const uint8_t *in;
+    CodecChunk c;
+    int n;
+    int is_day;
+} CodecBenchChunk;
+
+// Everything encoded under one cache layout
+typedef struct {
+    unsigned flags;
+    const char *name;
+    CodecBenchChunk *chunks;
+    long long count, cap;
+    uint8_t **payloads;
+    int payload_count, payload_cap;
+    double raw, encoded;
+    long long mismatches;
+} CodecBenchSet;
+
+// Encode a COL_ALL series into set b; `day` and `col` hold a block
+static int codec_bench_add(CodecBenchSet *b, const StockSeries *s, int *day, double *col,
+                           uint64_t *tmp) {
+    int64_t blocks = (s->n + CACHE_BLOCK_ROWS - 1) / CACHE_BLOCK_ROWS;
+    CodecChunk *chunks = (CodecChunk *)calloc((size_t)blocks * CACHE_COLUMNS, sizeof(CodecChunk));
+    size_t bytes = 0;
+    uint8_t *payload = chunks ? cache_encode(s, blocks, b->flags, chunks, &bytes) : NULL;
+    long long need = b->count + blocks * CACHE_COLUMNS;
+    if (payload && need > b->cap) {
+        long long cap = need > 2 * b->cap ? need : 2 * b->cap;
+        CodecBenchChunk *grown = (CodecBenchChunk *)realloc(b->chunks, (size_t)cap *
+                                                            sizeof(CodecBenchChunk));
+        if (grown) {
+            b->chunks = grown;
+            b->cap = cap;
+        }
+    }
+    if (payload && b->payload_count == b->payload_cap) {
+        int cap = b->payload_cap ? 2 * b->payload_cap : 64;
+        uint8_t **grown = (uint8_t **)realloc(b->payloads, (size_t)cap * sizeof(uint8_t *));
+        if (grown) {
+            b->payloads = grown;
+            b->payload_cap = cap;
+        }
+    }
+    if (!payload || need > b->cap || b->payload_count == b->payload_cap) {
+        free(chunks);
+        free(payload);
+        return -1;
+    }
+    b->payloads[b->payload_count++] = payload;
+    b->raw += (double)s->n * (sizeof(int) + SERIES_COLUMNS * sizeof(double));
+    b->encoded += (double)(bytes - CODEC_PAD) +
+                  (double)blocks * CACHE_COLUMNS * sizeof(CodecChunk);
+
+    for (int64_t k = 0; k < blocks; k++) {
+        int lo = (int)(k * CACHE_BLOCK_ROWS);
+        int n = lo + CACHE_BLOCK_ROWS < s->n ? CACHE_BLOCK_ROWS : s->n - lo;
+        for (int c = 0; c < CACHE_COLUMNS; c++) {
+            CodecBenchChunk *ch = &b->chunks[b->count++];
+            ch->c = chunks[k * CACHE_COLUMNS + c];
+            ch->in = payload + ch->c.off;
+            ch->n = n;
+            ch->is_day = c == 0;
+            if (b->flags != CACHE_COMPRESSED)
+                continue;
+            if (c == 0) {
+                codec_decode_days(ch->in, &ch->c, n, day, tmp);
+                b->mismatches += memcmp(day, s->day + lo, (size_t)n * sizeof(int)) != 0;
+            } else {
+                codec_decode_doubles(ch->in, &ch->c, n, col, tmp);
+                const double *x = *series_column((StockSeries *)s, c - 1) + lo;
+                b->mismatches += memcmp(col, x, (size_t)n * sizeof(double)) != 0;
+            }
+        }
     }
+    free(chunks);
+    return 0;
+}
 
-    char line[MAX_LINE_LEN];
-    int count = 0, capacity = 0;
-    StockData *data = NULL;
-
-    // skip header
-    fgets(line, sizeof(line), file);
-
-    while (fgets(line, sizeof(line), file)) {
-        // scaling if needed(Grow array )
-        if (count >= capacity) {
-            int new_cap = (capacity == 0) ? 1024 : capacity * 2;
-            StockData *tmp = realloc(data, new_cap * sizeof(StockData));
-            if (!tmp) {
-                fprintf(stderr, "Memory allocation failed\n");
-                free(data);
-                fclose(file);
-                *data_out = NULL;
-                return 0;
+// GB/s of decoded bytes over the chunks of set b with encoding `enc`,
+// repeated for at least CODEC_BENCH_SECONDS; *chunks, *raw and *encoded
+// get their count and bytes
+static double codec_bench_decode(const CodecBenchSet *b, int enc, int *day, double *col,
+                                 uint64_t *tmp, long long *chunks, double *raw,
+                                 double *encoded) {
+    *chunks = 0;
+    *raw = *encoded = 0.0;
+    for (long long i = 0; i < b->count; i++)
+        if (b->chunks[i].c.enc == enc) {
+            (*chunks)++;
+            *raw += (double)b->chunks[i].n * (b->chunks[i].is_day ? sizeof(int) : sizeof(double));
+            *encoded += b->chunks[i].c.bytes;
+        }
+    if (*chunks == 0)
+        return 0.0;
+
+    volatile double sink = 0.0;
+    int reps = 0;
+    double t0 = omp_get_wtime(), t;
+    do {
+        for (long long i = 0; i < b->count; i++) {
+            const CodecBenchChunk *ch = &b->chunks[i];
+            if (ch->c.enc != enc)
+                continue;
+            if (ch->is_day) {
+                codec_decode_days(ch->in, &ch->c, ch->n, day, tmp);
+                sink += day[ch->n - 1];
+            } else {
+                codec_decode_doubles(ch->in, &ch->c, ch->n, col, tmp);
+                sink += col[ch->n - 1];
             }
-            data = tmp;
-            capacity = new_cap;
         }
+        reps++;
+        t = omp_get_wtime() - t0;
+    } while (t < CODEC_BENCH_SECONDS);
+    return *raw * reps / t / 1e9;
+}
+
+// Synthetic rows: weekdays from 1990, closes walking in cents around 50
+static int codec_bench_synthetic(StockSeries *s, int n) {
+    series_init(s, COL_ALL);
+    s->day = (int *)malloc((size_t)n * sizeof(int));
+    int ok = s->day != NULL;
+    for (int k = 0; k < SERIES_COLUMNS; k++) {
+        *series_column(s, k) = (double *)malloc((size_t)n * sizeof(double));
+        ok = ok && *series_column(s, k);
+    }
+    if (!ok) return -1;
+    s->n = s->cap = n;
+
+    unsigned long long x = 88172645463325252ULL;
+    int day = days_from_civil(1990, 1, 1);
+    long long cents = 5000;
+    for (int i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;        // xorshift64
+        day += (day + 4) % 7 == 5 ? 3 : 1;              // Friday -> Monday
+        cents += (long long)(x % 41) - 20 + (cents < 1000) * 10 - (cents > 20000) * 10;
+        s->day[i] = day;
+        s->open[i] = (double)(cents + (long long)((x >> 8) % 21) - 10) / 100.0;
+        s->high[i] = (double)(cents + (long long)((x >> 16) % 30)) / 100.0;
+        s->low[i] = (double)(cents - (long long)((x >> 24) % 30)) / 100.0;
+        s->close[i] = (double)cents / 100.0;
+        s->volume[i] = (double)((x >> 32) % 5000000);
+    }
+    return 0;
+}
 
-        double adj_temp;
-        
-        // read all 7 fields
-        int parsed = sscanf(
-            line,
-            "%19[^,],%lf,%lf,%lf,%lf,%lf,%lf",
-            data[count].date,
-            &data[count].open,
-            &data[count].high,
-            &data[count].low,
-            &data[count].close,
-            &adj_temp,
-            &data[count].volume
-        );
-
-        if (parsed == 7) {
-            count++;
+static int codec_bench(const char *dir) {
+    CodecBenchSet sets[CODEC_BENCH_LAYOUTS] = {
+        { .flags = CACHE_COMPRESSED, .name = "--cache-compress" },
+        { .flags = CACHE_FLOAT32,    .name = "--cache-precision=float32" },
+        { .flags = CACHE_MICRO,      .name = "--cache-precision=micro" },
+    };
+    int *day = (int *)malloc(CACHE_BLOCK_ROWS * sizeof(int));
+    double *col = (double *)malloc(CACHE_BLOCK_ROWS * sizeof(double));
+    uint64_t *tmp = (uint64_t *)malloc(CACHE_BLOCK_ROWS * sizeof(uint64_t));
+    int err = !day || !col || !tmp, files = 0;
+    long long rows = 0;
+
+    if (!err && dir) {
+        Catalog catalog;
+        if (catalog_build(&catalog, dir, 0, 0) != 0) {
+            fprintf(stderr, "Cannot open directory: %s\n", dir);
+            free(day); free(col); free(tmp);
+            return 1;
+        }
+        NodeArena arena;
+        arena_init(&arena, -1);
+        LoadSpec all = { COL_ALL, DAY_RANGE_MIN, DAY_RANGE_MAX };
+        StockSeries data;
+        for (int f = 0; !err && f < catalog.count; f++) {
+            if (read_csv(catalog_path(&catalog, f), &data, &arena, &all) < 1)
+                continue;
+            for (int l = 0; !err && l < CODEC_BENCH_LAYOUTS; l++)
+                err = codec_bench_add(&sets[l], &data, day, col, tmp) != 0;
+            files++;
+            rows += data.n;
+        }
+        arena_release(&arena);
+        catalog_free(&catalog);
+    } else if (!err) {
+        StockSeries data;
+        err = codec_bench_synthetic(&data, CODEC_BENCH_ROWS) != 0;
+        for (int l = 0; !err && l < CODEC_BENCH_LAYOUTS; l++)
+            err = codec_bench_add(&sets[l], &data, day, col, tmp) != 0;
+        rows = data.n;
+        free(data.day);
+        for (int k = 0; k < SERIES_COLUMNS; k++) free(*series_column(&data, k));
+    }
+
+    static const char *codecs[] = { "raw", "delta-of-delta", "scaled delta",
+                                    "frame of reference", "float32", "micro-units" };
+    long long mismatches = 0;
+    if (!err) {
+        if (dir) printf("Codec bench: %s (%d files, %lld rows)\n", dir, files, rows);
+        else     printf("Codec bench: %lld synthetic rows\n", rows);
+    }
+    for (int l = 0; !err && l < CODEC_BENCH_LAYOUTS; l++) {
+        CodecBenchSet *b = &sets[l];
+        printf("  %-26s %.1f MB -> %.1f MB (ratio %.2f)", b->name, b->raw / 1e6,
+               b->encoded / 1e6, b->encoded > 0.0 ? b->raw / b->encoded : 0.0);
+        if (b->flags == CACHE_COMPRESSED)
+            printf(", %lld mismatches", b->mismatches);
+        printf("\n");
+        mismatches += b->mismatches;
+        for (int enc = CODEC_RAW; enc <= CODEC_MICRO; enc++) {
+            long long chunks;
+            double raw, encoded;
+            double gbs = codec_bench_decode(b, enc, day, col, tmp, &chunks, &raw, &encoded);
+            if (chunks > 0)
+                printf("    %-20s %8lld chunks  %8.1f MB -> %8.1f MB  %6.2f GB/s decode\n",
+                       codecs[enc], chunks, raw / 1e6, encoded / 1e6, gbs);
         }
     }
+    if (err)
+        fprintf(stderr, "Memory allocation failed for the codec bench\n");
 
-    fclose(file);
-    *data_out = data;
-    return count;
+    for (int l = 0; l < CODEC_BENCH_LAYOUTS; l++) {
+        for (int p = 0; p < sets[l].payload_count; p++) free(sets[l].payloads[p]);
+        free(sets[l].payloads);
+        free(sets[l].chunks);
+    }
+    free(day);
+    free(col);
+    free(tmp);
+    return err || mismatches ? 1 : 0;
 }
 
 // cleans data, groups statistics by decade, price results 
 int main(int argc, char *argv[]) {
 
+    if (argc == 2 && strncmp(argv[1], "--parse-bench", 13) == 0 &&
+        (argv[1][13] == '\0' || argv[1][13] == '='))
+        return parse_bench(argv[1][13] ? argv[1] + 14 : NULL);
+    if (argc == 2 && strncmp(argv[1], "--codec-bench", 13) == 0 &&
+        (argv[1][13] == '\0' || argv[1][13] == '='))
+        return codec_bench(argv[1][13] ? argv[1] + 14 : NULL);
+
     double total_time_exe = 0.0;
+    double total_time_load = 0.0;
+    double bytes_parsed = 0.0;
     double start;
     double end;
-    if (argc != 2) {
-        printf("Usage: %s <stocks_directory>\n", argv[0]);
+    StockOptions opts;
+    if (parse_options(argc, argv, &opts) != 0) {
+        printf("Usage: %s " STOCK_OPTIONS_USAGE "\n", argv[0]);
+        return 1;
+    }
+
+    const char *dirpath = opts.dirpath;
+    if (opts.autotune || opts.readers) {
+        fprintf(stderr, "%s is only supported by the OpenMP version\n",
+                opts.autotune ? "--autotune" : "--pipeline");
         return 1;
     }
 
-    const char *dirpath = argv[1];
-    DIR *dir = opendir(dirpath);
-    if (!dir) {
+    // list the .csv files (and those of subdirectories with --recursive), or map
+    // them from the --manifest file, or from the manifest a --build-cache
+    // run left in the cache (checked file by file)
+    char cache_manifest[4096];
+    int manifest_check = MANIFEST_CHECK_DIRS;
+    if (!opts.manifest && opts.cache_dir && !opts.build_cache &&
+        stock_cache_manifest(cache_manifest, sizeof(cache_manifest), opts.cache_dir) == 0 &&
+        access(cache_manifest, F_OK) == 0) {
+        opts.manifest = cache_manifest;
+        manifest_check = MANIFEST_CHECK_FILES;
+    }
+    Catalog catalog;
+    int manifest_built = 0;
+    if ((opts.manifest ? manifest_catalog(&catalog, dirpath, opts.manifest, opts.recursive,
+                                          manifest_check, 0, &manifest_built)
+                       : catalog_build(&catalog, dirpath, opts.recursive, 0)) != 0) {
         fprintf(stderr, "Cannot open directory: %s\n", dirpath);
         return 1;
     }
+    if (opts.cache_dir && stock_cache_prepare(opts.cache_dir) != 0)
+        opts.cache_dir = NULL;
+
+    // --build-cache: convert every file, then leave the listing in the cache
+    if (opts.build_cache) {
+        if (!opts.cache_dir || stock_cache_manifest(cache_manifest, sizeof(cache_manifest),
+                                                    opts.cache_dir) != 0) {
+            catalog_free(&catalog);
+            return 1;
+        }
+        stock_cache_clean(opts.cache_dir);
+        CacheBuildStats built = { 0, 0, 0, 0 };
+        NodeArena arena;
+        arena_init(&arena, -1);
+        double t0 = omp_get_wtime();
+        for (int f = 0; f < catalog.count; f++) {
+            size_t bytes;
+            int status = stock_cache_build(opts.cache_dir, &catalog, f, &arena,
+                                           opts.cache_flags, &bytes);
+            cache_build_count(&built, status, bytes);
+        }
+        double seconds = omp_get_wtime() - t0;
+        arena_release(&arena);
+        if (manifest_save(&catalog, cache_manifest) != 0)
+            fprintf(stderr, "Cannot write manifest: %s\n", cache_manifest);
+        stock_cache_report(opts.cache_dir, &built, seconds);
+        catalog_free(&catalog);
+        return built.failed ? 1 : 0;
+    }
+
+    // --mem-budget: stream each file in chunks that fit the budget
+    int chunk_rows = 0;
+    if (opts.mem_budget) {
+        chunk_rows = csv_stream_rows(opts.mem_budget, metric_columns(opts.metrics));
+        if (chunk_rows == 0) {
+            fprintf(stderr, "--mem-budget too small: at least %zu MB are needed\n",
+                    (CSV_STREAM_MIN_BUDGET + (1u << 20) - 1) >> 20);
+            catalog_free(&catalog);
+            return 1;
+        }
+    }
+
+    // --years: the rows come from the year layout (built first if it is
+    // missing or stale)
+    YearLayout years;
+    int years_built = 0;
+    double years_build_time = 0.0;
+    if (opts.years_dir) {
+        double t0 = omp_get_wtime();
+        years_built = year_layout_prepare(&years, opts.years_dir, &catalog, 0);
+        years_build_time = omp_get_wtime() - t0;
+        if (years_built < 0) {
+            fprintf(stderr, "Cannot build the year layout in %s\n", opts.years_dir);
+            catalog_free(&catalog);
+            return 1;
+        }
+    }
 
     printf("\nSerial Stock Analysis - Market Metrics by Decade (Cleaned)\n");
     printf("Directory: %s\n", dirpath);
+    if (opts.manifest)
+        printf("Manifest: %s (%s, %d tickers)\n", opts.manifest,
+               manifest_built ? "built now" : "mapped", catalog.tickers);
+    if (opts.years_dir) {
+        printf("Year layout: %s (%d years, %d tickers, ", opts.years_dir, years.segments,
+               years.tickers);
+        if (years_built)
+            printf("built now in %.2f seconds)\n", years_build_time);
+        else
+            printf("current)\n");
+    }
     printf("============================================================\n\n");
 
-    struct dirent *entry;
-    char filepath[1024];
-
   // Accumulators per decade 
-    double sum_avg_decade[MAX_DECADES]    = {0.0};
-    long   count_rows_decade[MAX_DECADES] = {0};
-
-    double sum_ret_decade[MAX_DECADES]    = {0.0};
-    double sum_ret_sq_decade[MAX_DECADES] = {0.0};
-    long   count_ret_decade[MAX_DECADES]  = {0};
-
-    int global_min_year = 9999;
-    int global_max_year = 0;
-
-
-    // Iterate through files
-    while ((entry = readdir(dir)) != NULL) {
-
-        const char *name = entry->d_name;
-
-        // ingro the file that has '..'
-        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-            continue;
-
-        // take only the file with  .csv
-        size_t len = strlen(name);
-        if (len < 4 || strcmp(name + len - 4, ".csv") != 0)
-            continue;
-
-        snprintf(filepath, sizeof(filepath), "%s/%s", dirpath, name);
-
-        StockData *data = NULL;
-        int n = read_csv(filepath, &data);
-        if (n <= 1 || !data) {
-            if (data) free(data);
-            continue;
-        }
-
-        start = omp_get_wtime();
-
-        // track min & max year in data
-        for (int i = 0; i < n; i++) {
-            int year = 0;
-            sscanf(data[i].date, "%d", &year);
-            if (year < global_min_year) global_min_year = year;
-            if (year > global_max_year) global_max_year = year;
+    DecadeAcc totals;
+    decade_acc_init(&totals);
+
+    // --validate: the same statistics from the CSVs in double precision
+    DecadeAcc reference;
+    decade_acc_init(&reference);
+
+    // one reusable buffer for the rows of the current file
+    NodeArena arena;
+    arena_init(&arena, -1);
+    StockSeries data;
+    LoadSpec spec = { metric_columns(opts.metrics), opts.from_day, opts.to_day };
+
+    // --counters: whole scan, loading included
+    long faults = perf_minor_faults();
+    int dtlb_fd = opts.counters ? perf_dtlb_open() : -1;
+    double scan_start = omp_get_wtime();
+
+    // --years: one year segment after the other instead of the files
+    int segments_read = 0;
+    if (opts.years_dir) {
+        if (year_layout_scan(&years, &totals, opts.metrics, opts.from_day, opts.to_day, 0, 1, 0,
+                             &segments_read, &bytes_parsed) != 0) {
+            fprintf(stderr, "Cannot read the year layout in %s\n", opts.years_dir);
+            year_layout_free(&years);
+            catalog_free(&catalog);
+            arena_release(&arena);
+            return 1;
         }
+        total_time_exe = omp_get_wtime() - scan_start;
+    } else {
+        // Iterate through files
+        for (int f = 0; f < catalog.count; f++) {
+
+            const char *filepath = catalog_path(&catalog, f);
+
+            if (opts.cache_dir) {
+                // mapped columns and zone maps instead of the CSV text
+                CacheView view;
+                start = omp_get_wtime();
+                int cached = stock_cache_load(&view, opts.cache_dir, &catalog, f, &arena,
+                                              opts.cache_flags) == 0;
+                total_time_load += omp_get_wtime() - start;
+                if (cached) {
+                    bytes_parsed += (double)view.text_bytes;
+                    start = omp_get_wtime();
+                    decade_acc_add_cached(&totals, &view, opts.metrics, opts.from_day, opts.to_day);
+                    total_time_exe += omp_get_wtime() - start;
+                    stock_cache_close(&view);
+                    if (opts.validate && read_csv(filepath, &data, &arena, &spec) > 1)
+                        decade_acc_add_series(&reference, &data, opts.metrics);
+                    continue;
+                }
+            }
 
-        // collective daily average prices per decade
-        for (int i = 0; i < n; i++) {
-            double o = data[i].open;
-            double h = data[i].high;
-            double l = data[i].low;
-            double c = data[i].close;
-
-            int year = 0;
-            sscanf(data[i].date, "%d", &year);
-
-            if (year < MIN_YEAR_GLOBAL || year > MAX_YEAR_GLOBAL)
-                continue;
-
-            int decade_index = (year - MIN_YEAR_GLOBAL) / 10;
-            if (decade_index < 0 || decade_index >= MAX_DECADES)
+            if (chunk_rows > 0) {
+                // parsing and analysis interleave chunk by chunk: the adding is
+                // timed per chunk as execution time, the rest counts as load time
+                double added = 0.0;
+                start = omp_get_wtime();
+                bytes_parsed += (double)decade_acc_add_streamed(&totals, filepath, &arena, &spec,
+                                                                opts.metrics, chunk_rows,
+                                                                &added);
+                total_time_load += omp_get_wtime() - start - added;
+                total_time_exe += added;
                 continue;
-
-            //Clean unrealistic prices
-            if (o >= MIN_PRICE && o <= MAX_PRICE &&
-                h >= MIN_PRICE && h <= MAX_PRICE &&
-                l >= MIN_PRICE && l <= MAX_PRICE &&
-                c >= MIN_PRICE && c <= MAX_PRICE)
-            {
-                double avg = (o + h + l + c) / 4.0;
-                sum_avg_decade[decade_index]    += avg;
-                count_rows_decade[decade_index] += 1;
             }
-        }
-
-        // collective daily returns prices per decade
-        for (int i = 0; i < n - 1; i++) {
-            double p = data[i].close;
-            double q = data[i + 1].close;
 
-            int year = 0;
-            sscanf(data[i].date, "%d", &year);
-
-            if (year < MIN_YEAR_GLOBAL || year > MAX_YEAR_GLOBAL)
+            start = omp_get_wtime();
+            int n = read_csv(filepath, &data, &arena, &spec);
+            total_time_load += omp_get_wtime() - start;
+            bytes_parsed += (double)data.text_bytes;
+            if (n <= 1)
                 continue;
 
-            int decade_index = (year - MIN_YEAR_GLOBAL) / 10;
-            if (decade_index < 0 || decade_index >= MAX_DECADES)
-                continue;
+            start = omp_get_wtime();
 
-            if (p >= MIN_PRICE && p <= MAX_PRICE &&
-                q >= MIN_PRICE && q <= MAX_PRICE &&
-                p != 0.0)
-            {
-                double r = (q - p) / p;
+            // collective daily average prices and daily returns per decade
+            decade_acc_add_series(&totals, &data, opts.metrics);
 
-                // exclude extreme outliers (> 100 daily move)
-                if (fabs(r) > 1.0)
-                    continue;
+            end = omp_get_wtime();
+            if (opts.validate)
+                decade_acc_add_series(&reference, &data, opts.metrics);
 
-                sum_ret_decade[decade_index]    += r;
-                sum_ret_sq_decade[decade_index] += r * r;
-                count_ret_decade[decade_index]  += 1;
-            }
+            // total computiation time 
+            total_time_exe += (end - start);
         }
-        end = omp_get_wtime();
-
-        // total computiation time 
-        total_time_exe += (end - start);
-        free(data);
     }
 
-    closedir(dir);
+    double scan_time = omp_get_wtime() - scan_start;
+    long long dtlb_misses = perf_dtlb_close(dtlb_fd);
+    faults = perf_minor_faults() - faults;
+
+    // --market: all files merged by date (one interval, this thread), or
+    // one pass over the year segments with --years
+    MarketAcc market;
+    MarketInfo market_info;
+    int market_ok = opts.market &&
+                    (opts.years_dir
+                     ? market_compute_years(&market, &market_info, &years, opts.from_day,
+                                            opts.to_day)
+                     : market_compute(&market, &market_info, &catalog, opts.cache_dir,
+                                      opts.cache_flags, opts.from_day, opts.to_day, 0)) == 0;
+    if (opts.market && !market_ok)
+        fprintf(stderr, opts.years_dir ? "Cannot read the year layout for --market\n"
+                                       : "Memory allocation failed for the market merge\n");
+
+    catalog_free(&catalog);
+    arena_release(&arena);
 
 
     // print the analysis results by decade
     printf("Market Summary by Decade:\n");
     printf("------------------------------------------------------------\n");
 
-    int first_decade = (global_min_year / 10) * 10;
+    int first_decade = (totals.min_year / 10) * 10;
     int last_decade  = 2010;  // آخر فترة: 2010–2020
 
     for (int decade_start = first_decade; decade_start <= last_decade; decade_start += 10) {
@@ -245,8 +588,8 @@ int main(int argc, char *argv[]) {
         if (idx < 0 || idx >= MAX_DECADES)
             continue;
 
-        long rows = count_rows_decade[idx];
-        long rets = count_ret_decade[idx];
+        long rows = totals.rows[idx];
+        long rets = totals.ret_count[idx];
 
         if (rows == 0 && rets == 0)
             continue; 
@@ -257,12 +600,12 @@ int main(int argc, char *argv[]) {
         double annual_r = 0.0;
 
         if (rows > 0) {
-            mean_price = sum_avg_decade[idx] / (double)rows;
+            mean_price = totals.sum_avg[idx] / (double)rows;
         }
 
         if (rets > 0) {
-            mean_r  = sum_ret_decade[idx]    / (double)rets;  // daily average
-            double mean_r2 = sum_ret_sq_decade[idx] / (double)rets;
+            mean_r  = totals.sum_ret[idx]    / (double)rets;  // daily average
+            double mean_r2 = totals.sum_ret_sq[idx] / (double)rets;
             double var = mean_r2 - mean_r * mean_r;
             if (var < 0.0) var = 0.0;
             vol = sqrt(var);
@@ -274,8 +617,16 @@ int main(int argc, char *argv[]) {
         int decade_end = (decade_start == 2010) ? 2020 : (decade_start + 9);
 
         printf("Decade %d-%d:\n", decade_start, decade_end);
-        printf("  Rows used:             %ld\n", rows);
-        printf("  Mean market price:     %.4f\n", mean_price);
+        if (opts.metrics & METRIC_PRICES) {
+            printf("  Rows used:             %ld\n", rows);
+            printf("  Mean market price:     %.4f\n", mean_price);
+        }
+
+        if (!(opts.metrics & METRIC_RETURNS)) {
+            printf("\n");
+            continue;
+        }
+
         printf("  Market volatility:     %.4f (%.4f%%)\n",
                vol, vol * 100.0);
 
@@ -291,6 +642,30 @@ int main(int argc, char *argv[]) {
     }
 
     printf("Execution time (serial): %.6f seconds\n", total_time_exe);
+    if (opts.years_dir) {
+        printf("Scan throughput:         %.3f GB/s (%.1f MB of columns, %d of %d year segments)\n",
+               bytes_parsed / total_time_exe / 1e9, bytes_parsed / 1e6, segments_read,
+               years.segments);
+        year_layout_free(&years);
+    }
+    if (total_time_load > 0.0 && bytes_parsed > 0.0)
+        printf("CSV parse throughput:    %.3f GB/s (%.1f MB in %.3f seconds)\n",
+               bytes_parsed / total_time_load / 1e9, bytes_parsed / 1e6, total_time_load);
+    if (opts.counters)
+        perf_report(dtlb_misses, faults, scan_time, bytes_parsed);
+    if (market_ok)
+        market_print(&market, &market_info, "-");
+
+    if (opts.validate) {
+        const char *mode = (opts.cache_flags & CACHE_FLOAT32) ? "float32" :
+                           (opts.cache_flags & CACHE_MICRO)   ? "micro" : "double";
+        printf("\nValidation against the double CSV path (%s cache):\n", mode);
+        if (decade_acc_validate(&reference, &totals, cache_price_error(opts.cache_flags)) != 0) {
+            printf("Validation FAILED\n");
+            return 1;
+        }
+        printf("Validation passed\n");
+    }
 
     return 0;
 }
@@ -0,0 +1,183 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22
+#define MADV_POPULATE_WRITE 23
+#endif
+
+// Growable page-backed buffer owned by one worker thread.
+//
+// The pages are only reserved by mmap and nothing touches them here, so
+// the first write decides where they live: the worker that parses a file
+// into its own arena places the rows on its own NUMA node (first touch).
+// The arena is reused from file to file; reset keeps the pages mapped, so
+// later files neither page-fault nor land on a remote node.
+typedef struct {
+    unsigned char *base;
+    size_t used;        // bytes handed out for the current file
+    size_t mapped;      // bytes currently mapped
+    int node;           // NUMA node of the owning thread (-1 = unknown)
+} NodeArena;
+
+#define ARENA_MIN_MAP (1u << 20)
+
+
+// ---------------------------------------------------------------------
+// Page policy
+// ---------------------------------------------------------------------
+
+// Large buffers are scanned linearly, so with 4K pages a scan pays one
+// TLB miss every 4K.  Mappings of at least ARENA_HUGE_PAGE are backed by
+// 2MB pages instead (see --huge-pages):
+//   PAGES_THP      2MB-aligned mappings advised with MADV_HUGEPAGE
+//                  (transparent huge pages; the default)
+//   PAGES_HUGETLB  MAP_HUGETLB pages from the reserved hugetlbfs pool
+//                  (vm.nr_hugepages); falls back to THP when the pool is
+//                  empty
+// With `arena_populate` (--populate) new pages are prefaulted in one call
+// instead of one fault per page on first touch.
+#define ARENA_HUGE_PAGE ((size_t)2 << 20)
+
+enum { PAGES_SMALL, PAGES_THP, PAGES_HUGETLB };
+
+static int arena_page_mode = PAGES_THP;
+static int arena_populate = 0;
+
+static inline void arena_set_pages(int mode, int populate) {
+    arena_page_mode = mode;
+    arena_populate = populate;
+}
+
+// Advise the 2MB-aligned part of [p, p + len) to use transparent huge pages
+static inline void arena_advise_huge(void *p, size_t len) {
+    if (arena_page_mode == PAGES_SMALL || len < ARENA_HUGE_PAGE)
+        return;
+    uintptr_t lo = ((uintptr_t)p + ARENA_HUGE_PAGE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE - 1);
+    uintptr_t hi = ((uintptr_t)p + len) & ~(uintptr_t)(ARENA_HUGE_PAGE - 1);
+    if (hi > lo)
+        madvise((void *)lo, hi - lo, MADV_HUGEPAGE);
+}
+
+// Fault in [p, p + len) now.  Read-only (file) mappings are split into
+// tasks so idle threads share the work; `write` mappings are prefaulted
+// by the calling thread, which keeps first-touch placement on its node.
+static inline void arena_prefault(void *p, size_t len, int write) {
+    if (len == 0) return;
+    if (write) {
+        if (madvise(p, len, MADV_POPULATE_WRITE) != 0) {
+            // kernels before 5.14: touch one byte per page
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            for (size_t off = 0; off < len; off += page)
+                ((volatile unsigned char *)p)[off] = 0;
+        }
+        return;
+    }
+    size_t slices = (len + ARENA_HUGE_PAGE * 8 - 1) / (ARENA_HUGE_PAGE * 8);
+    #pragma omp taskloop grainsize(1)
+    for (size_t i = 0; i < slices; i++) {
+        size_t off = i * ARENA_HUGE_PAGE * 8;
+        size_t n = len - off < ARENA_HUGE_PAGE * 8 ? len - off : ARENA_HUGE_PAGE * 8;
+        if (madvise((char *)p + off, n, MADV_POPULATE_READ) != 0) {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            for (size_t o = 0; o < n; o += page)
+                (void)((volatile const unsigned char *)p)[off + o];
+        }
+    }
+}
+
+// Anonymous mapping of `bytes` (a multiple of ARENA_MIN_MAP) laid out for
+// the page policy; when `old` is given its pages are moved into the new
+// mapping (mremap moves page tables, not pages).  Returns NULL on failure.
+static inline void *arena_map(void *old, size_t old_len, size_t bytes) {
+    static int hugetlb_warned = 0;
+    void *p;
+
+    if (arena_page_mode == PAGES_HUGETLB && bytes >= ARENA_HUGE_PAGE) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            if (old) {
+                memcpy(p, old, old_len);
+                munmap(old, old_len);
+            }
+            return p;
+        }
+        if (!__atomic_exchange_n(&hugetlb_warned, 1, __ATOMIC_RELAXED))
+            fprintf(stderr, "No hugetlbfs pages available, using transparent huge pages\n");
+    }
+
+    if (arena_page_mode == PAGES_SMALL || bytes < ARENA_HUGE_PAGE) {
+        p = old ? mremap(old, old_len, bytes, MREMAP_MAYMOVE)
+                : mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? NULL : p;
+    }
+
+    // reserve 2MB more than needed and trim to a 2MB-aligned range, so
+    // every 2MB of the buffer can be one huge page
+    unsigned char *raw = (unsigned char *)mmap(NULL, bytes + ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    unsigned char *al = (unsigned char *)(((uintptr_t)raw + ARENA_HUGE_PAGE - 1) &
+                                          ~(uintptr_t)(ARENA_HUGE_PAGE - 1));
+    if (al > raw) munmap(raw, (size_t)(al - raw));
+    if (raw + ARENA_HUGE_PAGE > al) munmap(al + bytes, (size_t)(raw + ARENA_HUGE_PAGE - al));
+
+    // the moved pages bring their old mapping flags, so advise afterwards
+    if (old && mremap(old, old_len, bytes, MREMAP_MAYMOVE | MREMAP_FIXED, al) == MAP_FAILED) {
+        munmap(al, bytes);
+        return NULL;
+    }
+    madvise(al, bytes, MADV_HUGEPAGE);
+    return al;
+}
+
+static inline void arena_init(NodeArena *a, int node) {
+    a->base   = NULL;
+    a->used   = 0;
+    a->mapped = 0;
+    a->node   = node;
+}
+
+// Make sure the arena can hold `bytes` and return its base.
+// Existing contents are kept; the base may move (mremap moves the page
+// tables, not the pages, so node placement is preserved).  Sizes of 2MB
+// and more follow the page policy above.
+static inline void *arena_reserve(NodeArena *a, size_t bytes) {
+    if (bytes <= a->mapped)
+        return a->base;
+
+    size_t want = a->mapped ? a->mapped : ARENA_MIN_MAP;
+    while (want < bytes) want *= 2;
+
+    void *p = arena_map(a->base, a->mapped, want);
+    if (!p)
+        return NULL;
+    if (arena_populate)
+        arena_prefault((unsigned char *)p + a->mapped, want - a->mapped, 1);
+
+    a->base   = (unsigned char *)p;
+    a->mapped = want;
+    return p;
+}
+
+// Forget the current contents but keep the (already placed) pages.
+static inline void arena_reset(NodeArena *a) {
+    a->used = 0;
+}
+
+static inline void arena_release(NodeArena *a) {
+    if (a->base) munmap(a->base, a->mapped);
+    a->base   = NULL;
+    a->used   = 0;
+    a->mapped = 0;
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "catalog.h"
+
+// Autotune mode for the OpenMP driver (--autotune[=FILE]).
+//
+// Instead of hand-trying OMP_NUM_THREADS / OMP_SCHEDULE, the driver
+//   - looks at the file size distribution: files larger than a thread's
+//     fair share are split into tasks (see decade_acc_add_tasks)
+//   - reads a sample of the files to measure the I/O rate, and parses
+//     the sample on one thread to measure the per-thread compute rate;
+//     more threads than the I/O can feed are not tried
+//   - times a few thread counts and schedules on the sample
+// and keeps the fastest setting as a profile.  Profiles are stored one
+// per line in a text file, keyed by a fingerprint of the dataset (paths,
+// sizes, mtimes and the options that change the work) and by the host,
+// so later runs on the same data and machine reuse them directly.
+
+#define AUTOTUNE_FILE ".stock_autotune"
+#define AUTOTUNE_SAMPLE_MIN (64LL << 20)   // sample at least this much CSV
+#define AUTOTUNE_SAMPLE_DIV 20             // ... or 1/20 of the dataset
+#define AUTOTUNE_HOST_MAX 96
+
+typedef struct {
+    int threads;
+    omp_sched_t schedule;
+    int chunk;                  // schedule chunk (0 = runtime default)
+    long long split_bytes;      // plain CSVs this large are split into tasks
+    double io_rate;             // measured bytes/s: reading
+    double compute_rate;        //   parsing and analysis on one thread
+} TuneProfile;
+
+static inline const char *autotune_schedule_name(omp_sched_t s) {
+    switch ((int)s & ~(int)omp_sched_monotonic) {
+    case omp_sched_static:  return "static";
+    case omp_sched_dynamic: return "dynamic";
+    case omp_sched_guided:  return "guided";
+    default:                return "auto";
+    }
+}
+
+static inline int autotune_schedule_parse(const char *name, omp_sched_t *s) {
+    if (strcmp(name, "static") == 0)       *s = omp_sched_static;
+    else if (strcmp(name, "dynamic") == 0) *s = omp_sched_dynamic;
+    else if (strcmp(name, "guided") == 0)  *s = omp_sched_guided;
+    else if (strcmp(name, "auto") == 0)    *s = omp_sched_auto;
+    else return -1;
+    return 0;
+}
+
+static inline uint64_t autotune_hash(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;          // FNV-1a
+    }
+    return h;
+}
+
+// Fingerprint of the dataset and of the work asked for: any added,
+// removed, resized or touched file gives a new profile.  `work` holds
+// the options that change the cost per byte (metrics, range, cache).
+static inline uint64_t autotune_fingerprint(const Catalog *c, const void *work, size_t work_len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = autotune_hash(h, &c->count, sizeof(c->count));
+    for (int i = 0; i < c->count; i++) {
+        const char *rel = catalog_relpath(c, i);
+        h = autotune_hash(h, rel, strlen(rel) + 1);
+        h = autotune_hash(h, &c->entries[i].size, sizeof(c->entries[i].size));
+        h = autotune_hash(h, &c->entries[i].mtime, sizeof(c->entries[i].mtime));
+    }
+    return autotune_hash(h, work, work_len);
+}
+
+// "hostname/cpus" (no spaces, so it is one field of a profile line)
+static inline void autotune_host(char *host, size_t cap) {
+    char name[64];
+    if (gethostname(name, sizeof(name)) != 0) strcpy(name, "unknown");
+    name[sizeof(name) - 1] = '\0';
+    for (char *p = name; *p; p++)
+        if (*p == ' ') *p = '_';
+    snprintf(host, cap, "%s/%d", name, omp_get_num_procs());
+}
+
+// Profile file: the given path, else ~/.stock_autotune, else ./.stock_autotune
+static inline void autotune_path(const char *given, char *path, size_t cap) {
+    const char *home = getenv("HOME");
+    if (given && *given)
+        snprintf(path, cap, "%s", given);
+    else if (home && *home)
+        snprintf(path, cap, "%s/" AUTOTUNE_FILE, home);
+    else
+        snprintf(path, cap, AUTOTUNE_FILE);
+}
+
+// Parse one profile line; returns 0 if it is well formed
+static inline int autotune_parse_line(const char *line, uint64_t *fp, char *host,
+                                      TuneProfile *p) {
+    char sched[16];
+    unsigned long long f;
+    if (sscanf(line, "%llx %95s threads=%d schedule=%15[a-z],%d split=%lld io=%lf compute=%lf",
+               &f, host, &p->threads, sched, &p->chunk, &p->split_bytes,
+               &p->io_rate, &p->compute_rate) != 8)
+        return -1;
+    if (p->threads < 1 || p->chunk < 0 || autotune_schedule_parse(sched, &p->schedule) != 0)
+        return -1;
+    *fp = (uint64_t)f;
+    return 0;
+}
+
+// Look up the profile of (fp, host).  Returns 0 if found.
+static inline int autotune_load(const char *path, uint64_t fp, const char *host,
+                                TuneProfile *p) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[512], h[AUTOTUNE_HOST_MAX];
+    int found = -1;
+    while (found != 0 && fgets(line, sizeof(line), f)) {
+        uint64_t lfp;
+        TuneProfile lp;
+        if (autotune_parse_line(line, &lfp, h, &lp) == 0 && lfp == fp && strcmp(h, host) == 0) {
+            *p = lp;
+            found = 0;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// Store the profile of (fp, host), replacing an older one.  The file is
+// rewritten to a temporary name and renamed, so concurrent runs never
+// see it half written.  Returns 0 on success.
+static inline int autotune_save(const char *path, uint64_t fp, const char *host,
+                                const TuneProfile *p) {
+    char tmp[4096 + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *out = fopen(tmp, "w");
+    if (!out) return -1;
+
+    FILE *in = fopen(path, "r");
+    if (in) {
+        char line[512], h[AUTOTUNE_HOST_MAX];
+        while (fgets(line, sizeof(line), in)) {
+            uint64_t lfp;
+            TuneProfile lp;
+            if (autotune_parse_line(line, &lfp, h, &lp) != 0)
+                continue;
+            if (lfp == fp && strcmp(h, host) == 0)
+                continue;
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%016llx %s threads=%d schedule=%s,%d split=%lld io=%.0f compute=%.0f\n",
+            (unsigned long long)fp, host, p->threads, autotune_schedule_name(p->schedule),
+            p->chunk, p->split_bytes, p->io_rate, p->compute_rate);
+    int err = fclose(out) != 0;
+    if (err || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Pick a sample of files spread over the size distribution: every k-th
+// entry of the largest-first catalog, until AUTOTUNE_SAMPLE_MIN bytes or
+// 1/AUTOTUNE_SAMPLE_DIV of the data are covered.  Returns the number of
+// indices written to `idx` (capacity c->count).
+static inline int autotune_sample(const Catalog *c, int *idx) {
+    long long total = 0;
+    for (int i = 0; i < c->count; i++) total += c->entries[i].size;
+    long long want = total / AUTOTUNE_SAMPLE_DIV;
+    if (want < AUTOTUNE_SAMPLE_MIN) want = AUTOTUNE_SAMPLE_MIN;
+
+    int step = 1;
+    if (total > want && c->count > 1) {
+        step = (int)(total / want);
+        if (step > c->count) step = c->count;
+    }
+    int n = 0;
+    long long got = 0;
+    for (int start = 0; start < step && got < want; start++)
+        for (int i = start; i < c->count && got < want; i += step) {
+            idx[n++] = i;
+            got += c->entries[i].size;
+        }
+    return n;
+}
+
+// Bytes per second of plain read(2) over the sample files
+static inline double autotune_read_rate(const Catalog *c, const int *idx, int n) {
+    char *buf = (char *)malloc(1 << 20);
+    if (!buf) return 0.0;
+    long long bytes = 0;
+    double t0 = omp_get_wtime();
+    for (int k = 0; k < n; k++) {
+        int fd = open(catalog_path(c, idx[k]), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        ssize_t r;
+        while ((r = read(fd, buf, 1 << 20)) > 0) bytes += r;
+        close(fd);
+    }
+    double t = omp_get_wtime() - t0;
+    free(buf);
+    return t > 0.0 ? (double)bytes / t : 0.0;
+}
+
+#endif
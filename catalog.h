@@ -0,0 +1,429 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "csv_source.h"
+
+// Directory catalog: the list of CSV files to analyse.
+//
+// Directories are listed with raw getdents64 calls and a large buffer
+// (one syscall returns thousands of names), every path is stored in one
+// contiguous arena instead of one malloc per path, and the per-file
+// stat() calls (size, mtime) run in parallel.  Subdirectories can be
+// walked as well, for datasets sharded as stocks/A/AAPL.csv, ...
+// After catalog_sort_by_size() the entries form a largest-first manifest,
+// which is the order the schedulers want.  The listing can also be split
+// into hash partitions of the root directory (catalog_build_part), so
+// several processes can list and stat one tree together, and a catalog
+// can be saved and mapped back as a binary manifest (manifest.h).
+
+#define CATALOG_DENTS_BUF (1 << 20)
+
+typedef struct {
+    size_t path_off;        // offset of the path in Catalog.paths
+    long long size;         // bytes
+    long long mtime;        // seconds since the epoch
+    int ticker;             // ticker id (catalog_assign_tickers), -1 before
+} CatalogEntry;
+
+// A directory that was listed, with its modification time when it was
+// opened (a file added, removed or renamed in it changes the mtime)
+typedef struct {
+    size_t path_off;
+    long long mtime_ns;
+} CatalogDir;
+
+typedef struct {
+    char *paths;            // all paths, NUL-terminated, back to back
+    size_t path_bytes;
+    size_t path_cap;
+
+    CatalogEntry *entries;
+    int count;
+    int cap;
+
+    CatalogDir *dirs;       // dirs[0] is the root
+    int dir_count;
+    int dir_cap;
+
+    long long total_bytes;
+    int tickers;            // distinct ticker ids
+    int sorted;             // entries are largest first
+    int recursive;          // subdirectories were listed too
+    void *map;              // mapped manifest holding all of the above
+    size_t map_len;
+} Catalog;
+
+// Layout of one record returned by getdents64
+struct catalog_dirent64 {
+    unsigned long long d_ino;
+    long long          d_off;
+    unsigned short     d_reclen;
+    unsigned char      d_type;
+    char               d_name[];
+};
+
+static inline const char *catalog_path(const Catalog *c, int i) {
+    return c->paths + c->entries[i].path_off;
+}
+
+// Path of entry i relative to the root directory (the root is the first
+// string of the path arena)
+static inline const char *catalog_relpath(const Catalog *c, int i) {
+    return catalog_path(c, i) + strlen(c->paths) + 1;
+}
+
+// Make room for `need` more bytes in the path arena; returns 0 or -1
+static inline int catalog_reserve_paths(Catalog *c, size_t need) {
+    if (c->path_bytes + need > c->path_cap) {
+        size_t new_cap = c->path_cap ? c->path_cap : (1 << 16);
+        while (new_cap < c->path_bytes + need) new_cap *= 2;
+        char *tmp = (char *)realloc(c->paths, new_cap);
+        if (!tmp) return -1;
+        c->paths = tmp;
+        c->path_cap = new_cap;
+    }
+    return 0;
+}
+
+// Append a complete path to the arena; returns its offset or (size_t)-1
+static inline size_t catalog_push_string(Catalog *c, const char *path, size_t len) {
+    if (catalog_reserve_paths(c, len + 1) != 0) return (size_t)-1;
+    size_t off = c->path_bytes;
+    memcpy(c->paths + off, path, len);
+    c->paths[off + len] = '\0';
+    c->path_bytes += len + 1;
+    return off;
+}
+
+// Append "<dir>/<name>" to the path arena, where <dir> is a path already
+// in the arena; returns the new offset or (size_t)-1
+static inline size_t catalog_push_path(Catalog *c, size_t dir_off, size_t dir_len,
+                                       const char *name, size_t name_len) {
+    size_t need = dir_len + 1 + name_len + 1;
+    if (catalog_reserve_paths(c, need) != 0) return (size_t)-1;
+
+    size_t off = c->path_bytes;
+    char *p = c->paths + off;
+    memcpy(p, c->paths + dir_off, dir_len);
+    p[dir_len] = '/';
+    memcpy(p + dir_len + 1, name, name_len);
+    p[dir_len + 1 + name_len] = '\0';
+    c->path_bytes += need;
+    return off;
+}
+
+static inline int catalog_add(Catalog *c, size_t path_off) {
+    if (c->count >= c->cap) {
+        int new_cap = (c->cap == 0) ? 1024 : c->cap * 2;
+        CatalogEntry *tmp = (CatalogEntry *)realloc(c->entries,
+                                                    new_cap * sizeof(CatalogEntry));
+        if (!tmp) return -1;
+        c->entries = tmp;
+        c->cap = new_cap;
+    }
+    c->entries[c->count].path_off = path_off;
+    c->entries[c->count].size  = 0;
+    c->entries[c->count].mtime = 0;
+    c->entries[c->count].ticker = -1;
+    c->count++;
+    return 0;
+}
+
+static inline int catalog_add_dir(Catalog *c, size_t path_off, long long mtime_ns) {
+    if (c->dir_count >= c->dir_cap) {
+        int new_cap = c->dir_cap ? c->dir_cap * 2 : 64;
+        CatalogDir *tmp = (CatalogDir *)realloc(c->dirs, new_cap * sizeof(CatalogDir));
+        if (!tmp) return -1;
+        c->dirs = tmp;
+        c->dir_cap = new_cap;
+    }
+    c->dirs[c->dir_count].path_off = path_off;
+    c->dirs[c->dir_count].mtime_ns = mtime_ns;
+    c->dir_count++;
+    return 0;
+}
+
+static inline long long catalog_mtime_ns(const struct stat *st) {
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+// Partition of a name in the root directory (FNV-1a)
+static inline unsigned catalog_name_hash(const char *name, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Does this file name look like one of our inputs?
+// (.csv, plus .csv.gz / .csv.zst when the loader can decompress them)
+static inline int catalog_wanted(const char *name, size_t len) {
+    return csv_source_supported(name, len);
+}
+
+// List directory `dir` of the catalog; files are added to the catalog,
+// subdirectories are appended to its directory list when recursing.  In
+// the root, only names of hash partition `part` (of `parts`) are kept;
+// a kept subdirectory is walked completely.
+static inline int catalog_scan_dir(Catalog *c, int dir, int recursive, int part, int parts,
+                                   char *buf) {
+    size_t dir_off = c->dirs[dir].path_off;
+    int fd = open(c->paths + dir_off, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    size_t dir_len = strlen(c->paths + dir_off);
+    struct stat dst;
+    if (fstat(fd, &dst) == 0)
+        c->dirs[dir].mtime_ns = catalog_mtime_ns(&dst);
+
+    for (;;) {
+        long nread = syscall(SYS_getdents64, fd, buf, CATALOG_DENTS_BUF);
+        if (nread <= 0)
+            break;
+
+        for (long pos = 0; pos < nread; ) {
+            struct catalog_dirent64 *d = (struct catalog_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+
+            // the name is NUL-terminated inside the record
+            const char *name = d->d_name;
+            size_t len = strnlen(name, d->d_reclen - offsetof(struct catalog_dirent64, d_name));
+
+            // Skip "." and ".."
+            if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))
+                continue;
+            if (dir == 0 && parts > 1 && catalog_name_hash(name, len) % parts != (unsigned)part)
+                continue;
+
+            int type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                // some file systems do not fill d_type
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR :
+                       S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+            }
+            if (type == DT_LNK) {
+                // follow links to files, never links to directories (cycles)
+                struct stat st;
+                if (fstatat(fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+                type = DT_REG;
+            }
+
+            if (type == DT_DIR) {
+                if (!recursive) continue;
+                size_t off = catalog_push_path(c, dir_off, dir_len, name, len);
+                if (off == (size_t)-1 || catalog_add_dir(c, off, 0) != 0) {
+                    close(fd);
+                    return -1;
+                }
+                continue;
+            }
+
+            if (type != DT_REG || !catalog_wanted(name, len))
+                continue;
+
+            size_t off = catalog_push_path(c, dir_off, dir_len, name, len);
+            if (off == (size_t)-1 || catalog_add(c, off) != 0) {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+// Fill in size and mtime of every entry (in parallel when asked to)
+static inline void catalog_stat(Catalog *c, int parallel) {
+    long long total = 0;
+
+    #pragma omp parallel for schedule(dynamic, 256) reduction(+:total) if (parallel)
+    for (int i = 0; i < c->count; i++) {
+        struct stat st;
+        if (stat(catalog_path(c, i), &st) == 0) {
+            c->entries[i].size  = (long long)st.st_size;
+            c->entries[i].mtime = (long long)st.st_mtime;
+            total += (long long)st.st_size;
+        }
+    }
+
+    c->total_bytes = total;
+}
+
+static inline void catalog_free(Catalog *c) {
+    if (c->map) {
+        munmap(c->map, c->map_len);
+    } else {
+        free(c->paths);
+        free(c->entries);
+        free(c->dirs);
+    }
+    memset(c, 0, sizeof(*c));
+}
+
+// Empty catalog whose path arena starts with the root directory (stored
+// without a trailing '/') and whose directory list holds the root.
+// Returns 0, or -1 if out of memory.
+static inline int catalog_init_root(Catalog *c, const char *dirpath) {
+    memset(c, 0, sizeof(*c));
+    size_t root_len = strlen(dirpath);
+    while (root_len > 1 && dirpath[root_len - 1] == '/') root_len--;
+    if (catalog_push_string(c, dirpath, root_len) == (size_t)-1)
+        return -1;
+    return catalog_add_dir(c, 0, 0);
+}
+
+// Build the part of the catalog of `dirpath` that falls in hash partition
+// `part` of `parts` (see catalog_scan_dir), walking subdirectories if
+// `recursive`.  Returns 0 on success, -1 if the directory cannot be read.
+static inline int catalog_build_part(Catalog *c, const char *dirpath, int recursive,
+                                     int parallel, int part, int parts) {
+    char *buf = (char *)malloc(CATALOG_DENTS_BUF);
+    if (catalog_init_root(c, dirpath) != 0 || !buf) {
+        free(buf);
+        catalog_free(c);
+        return -1;
+    }
+
+    c->recursive = recursive;
+    int status = catalog_scan_dir(c, 0, recursive, part, parts, buf);
+    for (int d = 1; status == 0 && d < c->dir_count; d++)
+        if (catalog_scan_dir(c, d, recursive, part, parts, buf) != 0)
+            fprintf(stderr, "Cannot read directory: %s\n", c->paths + c->dirs[d].path_off);
+
+    free(buf);
+    if (status != 0) {
+        catalog_free(c);
+        return -1;
+    }
+
+    catalog_stat(c, parallel);
+    return 0;
+}
+
+// Build the catalog of `dirpath` (and its subdirectories if `recursive`).
+// Returns 0 on success, -1 if the directory cannot be read.
+static inline int catalog_build(Catalog *c, const char *dirpath,
+                                int recursive, int parallel) {
+    return catalog_build_part(c, dirpath, recursive, parallel, 0, 1);
+}
+
+static inline int catalog_cmp_size_desc(const void *a, const void *b) {
+    long long sa = ((const CatalogEntry *)a)->size;
+    long long sb = ((const CatalogEntry *)b)->size;
+    return (sa < sb) - (sa > sb);
+}
+
+// Largest files first, so dynamic schedulers start the long jobs early
+// (a mapped manifest is stored in this order already)
+static inline void catalog_sort_by_size(Catalog *c) {
+    if (c->sorted) return;
+    qsort(c->entries, c->count, sizeof(CatalogEntry), catalog_cmp_size_desc);
+    c->sorted = 1;
+}
+
+// Subset a holds fewer bytes than b (ties by number)
+static inline int catalog_lighter(const long long *load, int a, int b) {
+    return load[a] < load[b] || (load[a] == load[b] && a < b);
+}
+
+// Split the entries into `parts` subsets of about the same number of
+// bytes: in catalog order (largest first once sorted), each file goes to
+// the subset with the fewest bytes so far (LPT), found with a min-heap.
+// part_of[i] receives the subset of entry i; the result depends only on
+// the catalog, so every process computes the same split.  Returns 0, or
+// -1 if out of memory.
+static inline int catalog_partition(const Catalog *c, int parts, int *part_of) {
+    long long *load = (long long *)calloc(parts, sizeof(long long));
+    int *heap = (int *)malloc(parts * sizeof(int));
+    if (!load || !heap) {
+        free(load);
+        free(heap);
+        return -1;
+    }
+    for (int p = 0; p < parts; p++) heap[p] = p;
+
+    for (int i = 0; i < c->count; i++) {
+        int p = heap[0];
+        part_of[i] = p;
+        load[p] += c->entries[i].size;
+
+        // sift the grown subset down from the top
+        int k = 0;
+        for (;;) {
+            int l = 2 * k + 1, r = l + 1, min = k;
+            if (l < parts && catalog_lighter(load, heap[l], heap[min])) min = l;
+            if (r < parts && catalog_lighter(load, heap[r], heap[min])) min = r;
+            if (min == k) break;
+            int t = heap[k]; heap[k] = heap[min]; heap[min] = t;
+            k = min;
+        }
+    }
+
+    free(load);
+    free(heap);
+    return 0;
+}
+
+// Ticker of a path: its file name without the .csv[.gz|.zst] suffix
+static inline const char *catalog_ticker(const char *path, size_t *len) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    const char *dot = strstr(name, ".csv");
+    *len = dot ? (size_t)(dot - name) : strlen(name);
+    return name;
+}
+
+typedef struct {
+    const char *name;
+    size_t len;
+    int entry;
+} CatalogTicker;
+
+static inline int catalog_cmp_ticker(const void *a, const void *b) {
+    const CatalogTicker *x = (const CatalogTicker *)a, *y = (const CatalogTicker *)b;
+    size_t n = x->len < y->len ? x->len : y->len;
+    int r = memcmp(x->name, y->name, n);
+    if (r) return r;
+    if (x->len != y->len) return x->len < y->len ? -1 : 1;
+    return x->entry - y->entry;
+}
+
+// Number the tickers in name order; files of the same ticker (e.g. in
+// different shard directories) share the id.  Returns 0, or -1 if out of
+// memory.
+static inline int catalog_assign_tickers(Catalog *c) {
+    CatalogTicker *t = (CatalogTicker *)malloc((c->count ? c->count : 1) * sizeof(*t));
+    if (!t) return -1;
+    for (int i = 0; i < c->count; i++) {
+        t[i].name = catalog_ticker(catalog_path(c, i), &t[i].len);
+        t[i].entry = i;
+    }
+    qsort(t, c->count, sizeof(*t), catalog_cmp_ticker);
+    int id = -1;
+    for (int k = 0; k < c->count; k++) {
+        if (k == 0 || t[k].len != t[k - 1].len || memcmp(t[k].name, t[k - 1].name, t[k].len))
+            id++;
+        c->entries[t[k].entry].ticker = id;
+    }
+    c->tickers = id + 1;
+    free(t);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef COLUMN_CODEC_H
+#define COLUMN_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "decimal_parse.h"
+
+// Lightweight column encodings for the binary cache (one block of rows
+// at a time, so blocks decode independently):
+//
+//   CODEC_DOD    day keys: delta-of-delta, zigzag, bit-packed.  Trading
+//                days step by 1 or 3 (weekends), so most values are 0..2
+//                and pack into 2-3 bits.
+//   CODEC_DELTA  prices: the smallest decimal scale s with x = m / 10^s
+//                exactly for every value (the CSV has few decimals), then
+//                zigzag deltas of m, bit-packed.
+//   CODEC_FOR    volumes: frame of reference (m - min) on the same scaled
+//                integers, bit-packed.
+//   CODEC_RAW    anything that does not round-trip exactly.
+//
+// Two lossy price storage modes halve or fix the bytes per value:
+//
+//   CODEC_F32    float32 (relative error <= 2^-24)
+//   CODEC_MICRO  int64 micro-units, x = m / 10^6 (exact up to 6 decimals,
+//                absolute error <= 5e-7 beyond)
+//
+// The first four are lossless: m / 10^s is the same correctly rounded
+// division parse_decimal performs, so decoded prices are bit-identical to
+// parsed ones.  Gorilla-style XOR coding was left out: it is bit-serial, while
+// fixed-width unpacking does four values per AVX2 gather.
+//
+// Packed data is read with 8-byte loads, so CODEC_PAD readable bytes must
+// follow it.
+
+#define CODEC_RAW   0
+#define CODEC_DOD   1
+#define CODEC_DELTA 2
+#define CODEC_FOR   3
+#define CODEC_F32   4
+#define CODEC_MICRO 5
+
+#define CODEC_MICRO_SCALE 6
+
+#define CODEC_PAD       8
+#define CODEC_MAX_WIDTH 56          // one 8-byte load holds any value
+#define CODEC_MAX_SCALE 8
+
+// Where and how one block of one column is stored
+typedef struct {
+    uint64_t off;           // byte offset of the payload in the file
+    uint32_t bytes;         // payload size
+    uint8_t  enc;           // CODEC_*
+    uint8_t  width;         // bits per packed value
+    uint8_t  scale;         // decimal digits of the scaled integers
+    uint8_t  pad;
+    int64_t  base;          // first value, or the frame of reference
+} CodecChunk;
+
+static inline uint64_t codec_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t codec_unzigzag(uint64_t u) {
+    return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+static inline int codec_bits(uint64_t max) {
+    return max ? 64 - __builtin_clzll(max) : 0;
+}
+
+static inline size_t codec_packed_bytes(int n, int width) {
+    return ((size_t)n * (size_t)width + 7) / 8;
+}
+
+// Pack n values of `width` bits; out needs codec_packed_bytes + CODEC_PAD
+// bytes and is cleared here
+static inline void codec_pack(const uint64_t *v, int n, int width, uint8_t *out) {
+    memset(out, 0, codec_packed_bytes(n, width) + CODEC_PAD);
+    if (width == 0) return;
+    for (int i = 0; i < n; i++) {
+        size_t bit = (size_t)i * width;
+        uint64_t w;
+        memcpy(&w, out + bit / 8, 8);
+        w |= v[i] << (bit % 8);
+        memcpy(out + bit / 8, &w, 8);
+    }
+}
+
+// Unpack n values of `width` (<= CODEC_MAX_WIDTH) bits.  The AVX2 path
+// gathers four 8-byte words and shifts each lane by its own bit offset.
+static inline void codec_unpack(const uint8_t *in, int n, int width, uint64_t *out) {
+    if (width == 0) {
+        memset(out, 0, (size_t)n * sizeof(uint64_t));
+        return;
+    }
+    const uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i vmask = _mm256_set1_epi64x((long long)mask);
+    const __m256i seven = _mm256_set1_epi64x(7);
+    const __m256i step  = _mm256_set1_epi64x(4LL * width);
+    __m256i bit = _mm256_setr_epi64x(0, width, 2LL * width, 3LL * width);
+    for (; i + 4 <= n; i += 4) {
+        __m256i byte = _mm256_srli_epi64(bit, 3);
+        __m256i w = _mm256_i64gather_epi64((const long long *)in, byte, 1);
+        w = _mm256_srlv_epi64(w, _mm256_and_si256(bit, seven));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_and_si256(w, vmask));
+        bit = _mm256_add_epi64(bit, step);
+    }
+#endif
+    for (; i < n; i++) {
+        size_t bit = (size_t)i * width;
+        uint64_t w;
+        memcpy(&w, in + bit / 8, 8);
+        out[i] = (w >> (bit % 8)) & mask;
+    }
+}
+
+// Smallest scale s (0..CODEC_MAX_SCALE) at which every x[i] is exactly
+// m[i] / 10^s with |m| < 2^53; fills m and returns s, or -1
+static inline int codec_decimal_scale(const double *x, int n, int64_t *m) {
+    for (int s = 0; s <= CODEC_MAX_SCALE; s++) {
+        double p = decimal_pow10[s];
+        int i = 0;
+        for (; i < n; i++) {
+            double t = x[i] * p;
+            if (!(fabs(t) < 9007199254740992.0)) break;
+            m[i] = llround(t);
+            double back = (double)m[i] / p;
+            if (memcmp(&back, &x[i], sizeof(double)) != 0) break;
+        }
+        if (i == n) return s;
+    }
+    return -1;
+}
+
+// Encode n >= 1 day keys; returns the payload size written to out
+// (capacity n * 4 + CODEC_PAD), tmp holds n values
+static inline size_t codec_encode_days(const int *day, int n, CodecChunk *c,
+                                       uint8_t *out, uint64_t *tmp) {
+    memset(c, 0, sizeof(*c));
+    c->base = day[0];
+
+    uint64_t max = 0;
+    int64_t prev_delta = 0;
+    for (int i = 1; i < n; i++) {
+        int64_t delta = (int64_t)day[i] - day[i - 1];
+        tmp[i - 1] = codec_zigzag(delta - prev_delta);
+        prev_delta = delta;
+        if (tmp[i - 1] > max) max = tmp[i - 1];
+    }
+
+    int width = codec_bits(max);
+    if (width <= 32 && codec_packed_bytes(n - 1, width) < (size_t)n * sizeof(int)) {
+        c->enc = CODEC_DOD;
+        c->width = (uint8_t)width;
+        codec_pack(tmp, n - 1, width, out);
+        c->bytes = (uint32_t)codec_packed_bytes(n - 1, width);
+    } else {
+        c->enc = CODEC_RAW;
+        c->bytes = (uint32_t)(n * sizeof(int));
+        memcpy(out, day, c->bytes);
+    }
+    return c->bytes;
+}
+
+// Encode n >= 1 doubles as scaled deltas (or as frame of reference when
+// `use_for`); returns the payload size (capacity n * 8 + CODEC_PAD).
+// m and tmp hold n values each.
+static inline size_t codec_encode_doubles(const double *x, int n, int use_for,
+                                          CodecChunk *c, uint8_t *out,
+                                          int64_t *m, uint64_t *tmp) {
+    memset(c, 0, sizeof(*c));
+
+    int s = codec_decimal_scale(x, n, m);
+    int width = 64;
+    if (s >= 0) {
+        uint64_t max = 0;
+        if (use_for) {
+            int64_t lo = m[0];
+            for (int i = 1; i < n; i++) if (m[i] < lo) lo = m[i];
+            for (int i = 0; i < n; i++) {
+                tmp[i] = (uint64_t)(m[i] - lo);
+                if (tmp[i] > max) max = tmp[i];
+            }
+            c->base = lo;
+        } else {
+            for (int i = 1; i < n; i++) {
+                tmp[i - 1] = codec_zigzag(m[i] - m[i - 1]);
+                if (tmp[i - 1] > max) max = tmp[i - 1];
+            }
+            c->base = m[0];
+        }
+        width = codec_bits(max);
+    }
+
+    int count = use_for ? n : n - 1;
+    if (s >= 0 && width <= CODEC_MAX_WIDTH &&
+        codec_packed_bytes(count, width) < (size_t)n * sizeof(double)) {
+        c->enc = use_for ? CODEC_FOR : CODEC_DELTA;
+        c->width = (uint8_t)width;
+        c->scale = (uint8_t)s;
+        codec_pack(tmp, count, width, out);
+        c->bytes = (uint32_t)codec_packed_bytes(count, width);
+    } else {
+        c->enc = CODEC_RAW;
+        c->base = 0;
+        c->bytes = (uint32_t)(n * sizeof(double));
+        memcpy(out, x, c->bytes);
+    }
+    return c->bytes;
+}
+
+// Store n values as they are
+static inline size_t codec_encode_raw(const void *x, size_t bytes, CodecChunk *c,
+                                      uint8_t *out) {
+    memset(c, 0, sizeof(*c));
+    c->enc = CODEC_RAW;
+    c->bytes = (uint32_t)bytes;
+    memcpy(out, x, bytes);
+    return bytes;
+}
+
+// Store n doubles as float32 (capacity n * 4)
+static inline size_t codec_encode_f32(const double *x, int n, CodecChunk *c,
+                                      uint8_t *out) {
+    memset(c, 0, sizeof(*c));
+    c->enc = CODEC_F32;
+    c->bytes = (uint32_t)(n * sizeof(float));
+    for (int i = 0; i < n; i++) {
+        float f = (float)x[i];
+        memcpy(out + i * sizeof(float), &f, sizeof(float));
+    }
+    return c->bytes;
+}
+
+// Store n doubles as int64 micro-units (capacity n * 8); falls back to raw
+// when a value is too large for exact micro-units
+static inline size_t codec_encode_micro(const double *x, int n, CodecChunk *c,
+                                        uint8_t *out) {
+    double p = decimal_pow10[CODEC_MICRO_SCALE];
+    for (int i = 0; i < n; i++)
+        if (!(fabs(x[i] * p) < 9007199254740992.0))
+            return codec_encode_raw(x, (size_t)n * sizeof(double), c, out);
+
+    memset(c, 0, sizeof(*c));
+    c->enc = CODEC_MICRO;
+    c->scale = CODEC_MICRO_SCALE;
+    c->bytes = (uint32_t)(n * sizeof(int64_t));
+    for (int i = 0; i < n; i++) {
+        int64_t m = llround(x[i] * p);
+        memcpy(out + i * sizeof(int64_t), &m, sizeof(int64_t));
+    }
+    return c->bytes;
+}
+
+// Decode n day keys; tmp holds n values
+static inline void codec_decode_days(const uint8_t *in, const CodecChunk *c, int n,
+                                     int *out, uint64_t *tmp) {
+    if (c->enc == CODEC_RAW) {
+        memcpy(out, in, (size_t)n * sizeof(int));
+        return;
+    }
+    codec_unpack(in, n - 1, c->width, tmp);
+    int64_t day = c->base, delta = 0;
+    out[0] = (int)day;
+    for (int i = 1; i < n; i++) {
+        delta += codec_unzigzag(tmp[i - 1]);
+        day += delta;
+        out[i] = (int)day;
+    }
+}
+
+// Decode n doubles; tmp holds n values
+static inline void codec_decode_doubles(const uint8_t *in, const CodecChunk *c, int n,
+                                        double *out, uint64_t *tmp) {
+    if (c->enc == CODEC_RAW) {
+        memcpy(out, in, (size_t)n * sizeof(double));
+        return;
+    }
+    if (c->enc == CODEC_F32) {
+        const float *f = (const float *)in;
+        for (int i = 0; i < n; i++)
+            out[i] = (double)f[i];
+        return;
+    }
+
+    int64_t *m = (int64_t *)tmp;
+    if (c->enc == CODEC_MICRO) {
+        memcpy(m, in, (size_t)n * sizeof(int64_t));
+    } else if (c->enc == CODEC_FOR) {
+        codec_unpack(in, n, c->width, tmp);
+        for (int i = 0; i < n; i++)
+            m[i] = c->base + (int64_t)tmp[i];
+    } else {
+        // unpack into tmp[1..n), then prefix-sum in place
+        codec_unpack(in, n - 1, c->width, tmp + 1);
+        m[0] = c->base;
+        for (int i = 1; i < n; i++)
+            m[i] = m[i - 1] + codec_unzigzag(tmp[i]);
+    }
+
+    // exact operands, one correctly rounded division (as parse_decimal)
+    double p = decimal_pow10[c->scale];
+    for (int i = 0; i < n; i++)
+        out[i] = (double)m[i] / p;
+}
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef CSV_SOURCE_H
+#define CSV_SOURCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Byte source for the CSV loader.
+//
+// Plain .csv files are read with read(2).  With the matching build flags,
+// .csv.gz (-DHAVE_ZLIB -lz) and .csv.zst (-DHAVE_ZSTD -lzstd) files are
+// decompressed on the fly, so archives never have to be unpacked on disk:
+//   - the source keeps two blocks; while the loader parses one, an OpenMP
+//     task decompresses the next, so idle threads overlap decompression
+//     with parsing (without idle threads the task simply runs inline)
+//   - big .zst files made of several independent frames (as written by
+//     pzstd) are decoded frame-parallel into one buffer
+//   - a byte range of an mmapped file can be served directly (the loader
+//     uses this to read only the rows of a date range)
+// A bounded source (streaming mode) never holds more than a couple of
+// blocks: .zst files are not decoded whole and the pages of a mapped
+// slice are dropped as soon as they have been read.
+
+#define CSV_SOURCE_BLOCK (256 * 1024)
+#ifndef CSV_ZSTD_PARALLEL_MIN
+#define CSV_ZSTD_PARALLEL_MIN (32LL * 1024 * 1024)   // compressed bytes
+#endif
+
+typedef enum {
+    CSV_SRC_PLAIN,
+    CSV_SRC_GZIP,
+    CSV_SRC_ZSTD,
+    CSV_SRC_MEMORY      // bytes already in memory (parallel zstd, mapped slice)
+} CsvSourceKind;
+
+typedef struct {
+    CsvSourceKind kind;
+    int fd;
+
+#ifdef HAVE_ZLIB
+    gzFile gz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zctx;
+    ZSTD_inBuffer zin;
+    char *zbuf;             // compressed input staging
+    int zeof;
+#endif
+
+    // decoded file for CSV_SRC_MEMORY
+    char *mem;
+    size_t mem_len, mem_pos;
+    void *map;              // mapping `mem` points into (NULL = mem is malloced)
+    size_t map_len;
+    int borrowed;           // `mem` belongs to the caller
+    int bounded;            // drop mapped pages once they are read
+    size_t released;        // mapping bytes already dropped
+
+    // double-buffered decoded blocks
+    char *blk[2];
+    long blk_len[2];        // bytes in each block, 0 = end, -1 = error
+    int front;
+    size_t pos;             // read position in the front block
+    int started;
+    int done;
+} CsvSource;
+
+static inline int csv_has_suffix(const char *name, size_t len, const char *suffix) {
+    size_t n = strlen(suffix);
+    return len >= n && memcmp(name + len - n, suffix, n) == 0;
+}
+
+// Is this a file name the loader can read with the current build?
+static inline int csv_source_supported(const char *name, size_t len) {
+    if (csv_has_suffix(name, len, ".csv")) return 1;
+#ifdef HAVE_ZLIB
+    if (csv_has_suffix(name, len, ".csv.gz")) return 1;
+#endif
+#ifdef HAVE_ZSTD
+    if (csv_has_suffix(name, len, ".csv.zst")) return 1;
+#endif
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+// Decode a multi-frame .zst file with one frame per loop iteration.
+// Returns 0 and fills s->mem on success; -1 if the file is not suitable
+// (single frame or unknown frame sizes), in which case we stream instead.
+static inline int csv_zstd_parallel(CsvSource *s, long long file_size) {
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, s->fd, 0);
+    if (map == MAP_FAILED) return -1;
+    const char *src = (const char *)map;
+
+    // collect frame boundaries and decoded sizes
+    int frames = 0, cap = 64;
+    size_t *in_off  = (size_t *)malloc(cap * sizeof(size_t));
+    size_t *in_len  = (size_t *)malloc(cap * sizeof(size_t));
+    size_t *out_off = (size_t *)malloc(cap * sizeof(size_t));
+    size_t pos = 0, total = 0;
+    int ok = (in_off && in_len && out_off);
+
+    while (ok && pos < (size_t)file_size) {
+        size_t clen = ZSTD_findFrameCompressedSize(src + pos, file_size - pos);
+        unsigned long long dlen = ZSTD_getFrameContentSize(src + pos, clen);
+        if (ZSTD_isError(clen) || dlen == ZSTD_CONTENTSIZE_UNKNOWN ||
+            dlen == ZSTD_CONTENTSIZE_ERROR) { ok = 0; break; }
+        if (frames == cap) {
+            cap *= 2;
+            size_t *a = (size_t *)realloc(in_off, cap * sizeof(size_t));
+            if (a) in_off = a;
+            size_t *b = (size_t *)realloc(in_len, cap * sizeof(size_t));
+            if (b) in_len = b;
+            size_t *c = (size_t *)realloc(out_off, cap * sizeof(size_t));
+            if (c) out_off = c;
+            if (!a || !b || !c) { ok = 0; break; }
+        }
+        in_off[frames] = pos;
+        in_len[frames] = clen;
+        out_off[frames] = total;
+        total += dlen;
+        pos += clen;
+        frames++;
+    }
+
+    char *out = (ok && frames > 1) ? (char *)malloc(total ? total : 1) : NULL;
+    int failed = 0;
+
+    if (out) {
+        #pragma omp taskloop grainsize(1) shared(failed)
+        for (int f = 0; f < frames; f++) {
+            size_t dlen = (f + 1 < frames ? out_off[f + 1] : total) - out_off[f];
+            size_t got = ZSTD_decompress(out + out_off[f], dlen,
+                                         src + in_off[f], in_len[f]);
+            if (ZSTD_isError(got) || got != dlen) {
+                #pragma omp atomic write
+                failed = 1;
+            }
+        }
+    }
+
+    munmap(map, file_size);
+    free(in_off);
+    free(in_len);
+    free(out_off);
+
+    if (!out || failed) {
+        free(out);
+        return -1;
+    }
+
+    s->kind = CSV_SRC_MEMORY;
+    s->mem = out;
+    s->mem_len = total;
+    s->mem_pos = 0;
+    return 0;
+}
+#endif
+
+static inline void csv_source_close(CsvSource *s);
+
+// Serve bytes [off, off + len) of a read-only file mapping; the source
+// takes ownership of the mapping and unmaps it on close.
+static inline void csv_source_open_slice(CsvSource *s, void *map, size_t map_len,
+                                         size_t off, size_t len) {
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->kind = CSV_SRC_MEMORY;
+    s->map = map;
+    s->map_len = map_len;
+    s->mem = (char *)map + off;
+    s->mem_len = len;
+    s->mem_pos = 0;
+}
+
+// Serve the `len` bytes at `text`, which stay owned by the caller (e.g.
+// one byte range of a mapping shared by several readers)
+static inline void csv_source_open_memory(CsvSource *s, const char *text, size_t len) {
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->kind = CSV_SRC_MEMORY;
+    s->borrowed = 1;
+    s->mem = (char *)text;
+    s->mem_len = len;
+}
+
+// Open `path`; the kind is picked from the file suffix.  `bounded` keeps
+// the memory use independent of the file size.
+// Returns 0 on success, -1 on failure (message already printed).
+static inline int csv_source_open(CsvSource *s, const char *path, int bounded) {
+    (void)bounded;              // only .zst files would be decoded whole
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    size_t len = strlen(path);
+
+    if (csv_has_suffix(path, len, ".gz")) {
+#ifdef HAVE_ZLIB
+        s->kind = CSV_SRC_GZIP;
+        s->gz = gzopen(path, "rb");
+        if (!s->gz) {
+            fprintf(stderr, "Cannot open file: %s\n", path);
+            return -1;
+        }
+        gzbuffer(s->gz, CSV_SOURCE_BLOCK);
+#else
+        fprintf(stderr, "Cannot open file: %s (built without zlib support)\n", path);
+        return -1;
+#endif
+    } else if (csv_has_suffix(path, len, ".zst")) {
+#ifdef HAVE_ZSTD
+        s->kind = CSV_SRC_ZSTD;
+        s->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (s->fd < 0) {
+            fprintf(stderr, "Cannot open file: %s\n", path);
+            return -1;
+        }
+        struct stat st;
+        if (!bounded && fstat(s->fd, &st) == 0 && st.st_size >= CSV_ZSTD_PARALLEL_MIN &&
+            csv_zstd_parallel(s, (long long)st.st_size) == 0)
+            return 0;
+
+        s->zctx = ZSTD_createDCtx();
+        s->zbuf = (char *)malloc(ZSTD_DStreamInSize());
+        if (!s->zctx || !s->zbuf) {
+            fprintf(stderr, "Memory allocation failed in csv_source_open\n");
+            csv_source_close(s);
+            return -1;
+        }
+        s->zin.src = s->zbuf;
+        s->zin.size = 0;
+        s->zin.pos = 0;
+#else
+        fprintf(stderr, "Cannot open file: %s (built without zstd support)\n", path);
+        return -1;
+#endif
+    } else {
+        s->kind = CSV_SRC_PLAIN;
+        s->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (s->fd < 0) {
+            fprintf(stderr, "Cannot open file: %s\n", path);
+            return -1;
+        }
+        posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (s->kind != CSV_SRC_MEMORY) {
+        s->blk[0] = (char *)malloc(CSV_SOURCE_BLOCK);
+        s->blk[1] = (char *)malloc(CSV_SOURCE_BLOCK);
+        if (!s->blk[0] || !s->blk[1]) {
+            fprintf(stderr, "Memory allocation failed in csv_source_open\n");
+            csv_source_close(s);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Decode up to `cap` bytes into dst.  Returns bytes, 0 at end, -1 on error.
+static inline long csv_source_decode(CsvSource *s, char *dst, size_t cap) {
+    switch (s->kind) {
+    case CSV_SRC_PLAIN: {
+        size_t got = 0;
+        while (got < cap) {
+            ssize_t r = read(s->fd, dst + got, cap - got);
+            if (r < 0) return -1;
+            if (r == 0) break;
+            got += (size_t)r;
+        }
+        return (long)got;
+    }
+#ifdef HAVE_ZLIB
+    case CSV_SRC_GZIP: {
+        int r = gzread(s->gz, dst, (unsigned)cap);
+        return r < 0 ? -1 : r;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case CSV_SRC_ZSTD: {
+        ZSTD_outBuffer out = { dst, cap, 0 };
+        while (out.pos < out.size) {
+            if (s->zin.pos == s->zin.size) {
+                if (s->zeof) break;
+                ssize_t r = read(s->fd, s->zbuf, ZSTD_DStreamInSize());
+                if (r < 0) return -1;
+                if (r == 0) { s->zeof = 1; break; }
+                s->zin.size = (size_t)r;
+                s->zin.pos = 0;
+            }
+            size_t ret = ZSTD_decompressStream(s->zctx, &out, &s->zin);
+            if (ZSTD_isError(ret)) return -1;
+        }
+        return (long)out.pos;
+    }
+#endif
+    default:
+        return -1;
+    }
+}
+
+// Make the next decoded block the front block and start decoding the one
+// after it in the background.  Returns 0 when data is available.
+static inline int csv_source_advance(CsvSource *s) {
+    if (s->done) return -1;
+
+    if (!s->started) {
+        s->started = 1;
+        s->blk_len[0] = csv_source_decode(s, s->blk[0], CSV_SOURCE_BLOCK);
+        s->front = 0;
+    } else {
+        #pragma omp taskwait
+        s->front ^= 1;
+    }
+    s->pos = 0;
+
+    if (s->blk_len[s->front] <= 0) {
+        if (s->blk_len[s->front] < 0)
+            fprintf(stderr, "Read error while decoding input\n");
+        s->done = 1;
+        return -1;
+    }
+
+    // decode the following block while the caller parses this one
+    int back = s->front ^ 1;
+    #pragma omp task firstprivate(back) shared(s)
+    s->blk_len[back] = csv_source_decode(s, s->blk[back], CSV_SOURCE_BLOCK);
+
+    return 0;
+}
+
+// Read up to `cap` decoded bytes (lines may be cut anywhere).
+// Returns the byte count, 0 at the end of the file.
+static inline long csv_source_read(CsvSource *s, char *dst, size_t cap) {
+    if (s->kind == CSV_SRC_MEMORY) {
+        size_t n = s->mem_len - s->mem_pos;
+        if (n > cap) n = cap;
+        memcpy(dst, s->mem + s->mem_pos, n);
+        s->mem_pos += n;
+        if (s->bounded && s->map) {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t read_to = (size_t)(s->mem + s->mem_pos - (char *)s->map) / page * page;
+            if (read_to > s->released) {
+                madvise((char *)s->map + s->released, read_to - s->released, MADV_DONTNEED);
+                s->released = read_to;
+            }
+        }
+        return (long)n;
+    }
+
+    size_t got = 0;
+    while (got < cap) {
+        if (!s->started || s->pos >= (size_t)s->blk_len[s->front])
+            if (csv_source_advance(s) != 0) break;
+        size_t n = (size_t)s->blk_len[s->front] - s->pos;
+        if (n > cap - got) n = cap - got;
+        memcpy(dst + got, s->blk[s->front] + s->pos, n);
+        s->pos += n;
+        got += n;
+    }
+    return (long)got;
+}
+
+static inline void csv_source_close(CsvSource *s) {
+    if (s->started && !s->done) {
+        // the background decode still uses the source
+        #pragma omp taskwait
+    }
+#ifdef HAVE_ZLIB
+    if (s->gz) gzclose(s->gz);
+#endif
+#ifdef HAVE_ZSTD
+    if (s->zctx) ZSTD_freeDCtx(s->zctx);
+    free(s->zbuf);
+#endif
+    if (s->fd >= 0) close(s->fd);
+    if (s->map)
+        munmap(s->map, s->map_len);
+    else if (!s->borrowed)
+        free(s->mem);
+    free(s->blk[0]);
+    free(s->blk[1]);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
+
+#endif
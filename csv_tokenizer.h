@@ -0,0 +1,76 @@
+#ifndef CSV_TOKENIZER_H
+#define CSV_TOKENIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Structural index for CSV text (simdjson style).
+//
+// One pass over the input, 64 bytes at a time, records the position of
+// every ',' and '\n'.  Each 64-byte block becomes a 64-bit mask of
+// separator bytes (AVX2: 2 x 32-byte compares, SSE2: 4 x 16-byte
+// compares, scalar loop elsewhere) and the set bits are appended to the
+// index.  The field parsers then jump from separator to separator, so
+// lines can be of any length and the text is scanned only once.
+
+// Separator mask of one full 64-byte block starting at p
+static inline uint64_t csv_block_mask(const char *p) {
+#if defined(__AVX2__)
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i nl    = _mm256_set1_epi8('\n');
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+    uint32_t lo = (uint32_t)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(a, comma), _mm256_cmpeq_epi8(a, nl)));
+    uint32_t hi = (uint32_t)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(b, comma), _mm256_cmpeq_epi8(b, nl)));
+    return (uint64_t)lo | ((uint64_t)hi << 32);
+#elif defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i nl    = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        uint32_t m = (uint32_t)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, nl)));
+        mask |= (uint64_t)m << (16 * k);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (int k = 0; k < 64; k++)
+        if (p[k] == ',' || p[k] == '\n')
+            mask |= (uint64_t)1 << k;
+    return mask;
+#endif
+}
+
+// Append the offsets (relative to buf) of all separators in buf[from..len)
+// to idx and return how many were written.  idx needs room for len - from
+// entries in the worst case.
+static inline size_t csv_index_structurals(const char *buf, size_t from, size_t len,
+                                           uint32_t *idx) {
+    size_t n = 0;
+    size_t pos = from;
+
+    for (; pos + 64 <= len; pos += 64) {
+        uint64_t mask = csv_block_mask(buf + pos);
+        while (mask) {
+            idx[n++] = (uint32_t)(pos + (size_t)__builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    // tail shorter than one block
+    for (; pos < len; pos++)
+        if (buf[pos] == ',' || buf[pos] == '\n')
+            idx[n++] = (uint32_t)pos;
+
+    return n;
+}
+
+#endif
@@ -0,0 +1,540 @@
+#ifndef DECADE_STATS_H
+#define DECADE_STATS_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include "stock_cache.h"
+#include "stock_data.h"
+
+// Analyses that can be requested (see --metrics)
+#define METRIC_PRICES   (1u << 0)   // mean market price from OHLC averages
+#define METRIC_RETURNS  (1u << 1)   // daily returns and volatility
+
+// Columns the loader has to parse for a set of metrics
+static inline unsigned metric_columns(unsigned metrics) {
+    unsigned cols = 0;
+    if (metrics & METRIC_PRICES)  cols |= COL_OPEN | COL_HIGH | COL_LOW | COL_CLOSE;
+    if (metrics & METRIC_RETURNS) cols |= COL_CLOSE;
+    return cols;
+}
+
+// Market statistics accumulated per decade
+typedef struct {
+    double sum_avg[MAX_DECADES];        // sum of daily OHLC averages
+    long   rows[MAX_DECADES];
+
+    double sum_ret[MAX_DECADES];        // sum of daily returns
+    double sum_ret_sq[MAX_DECADES];
+    long   ret_count[MAX_DECADES];
+
+    int min_year;                       // years seen in the data
+    int max_year;
+} DecadeAcc;
+
+static inline void decade_acc_init(DecadeAcc *acc) {
+    memset(acc, 0, sizeof(*acc));
+    acc->min_year = 9999;
+    acc->max_year = 0;
+}
+
+// Decade slot of a day key, or -1 outside MIN_YEAR_GLOBAL..MAX_YEAR_GLOBAL
+static inline int decade_index_of_year(int year) {
+    if (year < MIN_YEAR_GLOBAL || year > MAX_YEAR_GLOBAL)
+        return -1;
+    return (year - MIN_YEAR_GLOBAL) / 10;
+}
+
+// Daily average prices of rows [lo, hi) of a series
+static inline void decade_acc_prices_rows(DecadeAcc *acc, const StockSeries *s,
+                                          int lo, int hi) {
+    for (int i = lo; i < hi; i++) {
+        double o = s->open[i];
+        double h = s->high[i];
+        double l = s->low[i];
+        double c = s->close[i];
+
+        int decade_index = decade_index_of_year(day_year(s->day[i]));
+        if (decade_index < 0)
+            continue;
+
+        // Filter unrealistic prices
+        if (o >= MIN_PRICE && o <= MAX_PRICE &&
+            h >= MIN_PRICE && h <= MAX_PRICE &&
+            l >= MIN_PRICE && l <= MAX_PRICE &&
+            c >= MIN_PRICE && c <= MAX_PRICE)
+        {
+            double avg = (o + h + l + c) / 4.0;
+            acc->sum_avg[decade_index] += avg;
+            acc->rows[decade_index]    += 1;
+        }
+    }
+}
+
+// Return r = (q - p) / p between consecutive closes; 0 if the prices or
+// the move are not realistic and the return has to be left out
+static inline int daily_return_ok(double p, double q, double *r) {
+    // Filter unrealistic / invalid prices and zero division
+    if (!(p >= MIN_PRICE && p <= MAX_PRICE &&
+          q >= MIN_PRICE && q <= MAX_PRICE &&
+          p != 0.0))
+        return 0;
+
+    // Exclude extreme outliers (> 100% daily move)
+    *r = (q - p) / p;
+    return fabs(*r) <= 1.0;
+}
+
+// One daily return r = (q - p) / p between consecutive closes, the
+// first of them on `day`
+static inline void decade_acc_add_return(DecadeAcc *acc, int day, double p, double q) {
+    int decade_index = decade_index_of_year(day_year(day));
+    if (decade_index < 0)
+        return;
+
+    double r;
+    if (daily_return_ok(p, q, &r)) {
+        acc->sum_ret[decade_index]    += r;
+        acc->sum_ret_sq[decade_index] += r * r;
+        acc->ret_count[decade_index]  += 1;
+    }
+}
+
+// Daily returns starting at rows [lo, hi) of a series (hi <= n - 1)
+static inline void decade_acc_returns_rows(DecadeAcc *acc, const StockSeries *s,
+                                           int lo, int hi) {
+    for (int i = lo; i < hi; i++)
+        decade_acc_add_return(acc, s->day[i], s->close[i], s->close[i + 1]);
+}
+
+static inline void decade_acc_add_prices(DecadeAcc *acc, const StockSeries *s) {
+    decade_acc_prices_rows(acc, s, 0, s->n);
+}
+
+static inline void decade_acc_add_returns(DecadeAcc *acc, const StockSeries *s) {
+    decade_acc_returns_rows(acc, s, 0, s->n - 1);
+}
+
+// Add the rows of one (chronologically ordered) series.
+// `metrics` selects the analyses; the series must carry their columns.
+static inline void decade_acc_add_series(DecadeAcc *acc, const StockSeries *s,
+                                         unsigned metrics) {
+    if (s->n == 0)
+        return;
+
+    // rows are sorted, so the year range comes from the first/last day
+    int first_year = day_year(s->day[0]);
+    int last_year  = day_year(s->day[s->n - 1]);
+    if (first_year < acc->min_year) acc->min_year = first_year;
+    if (last_year  > acc->max_year) acc->max_year = last_year;
+
+    if (metrics & METRIC_PRICES)
+        decade_acc_add_prices(acc, s);
+    if (metrics & METRIC_RETURNS)
+        decade_acc_add_returns(acc, s);
+}
+
+static inline void decade_acc_merge(DecadeAcc *into, const DecadeAcc *from) {
+    for (int d = 0; d < MAX_DECADES; d++) {
+        into->sum_avg[d]    += from->sum_avg[d];
+        into->rows[d]       += from->rows[d];
+
+        into->sum_ret[d]    += from->sum_ret[d];
+        into->sum_ret_sq[d] += from->sum_ret_sq[d];
+        into->ret_count[d]  += from->ret_count[d];
+    }
+
+    if (from->min_year < into->min_year) into->min_year = from->min_year;
+    if (from->max_year > into->max_year) into->max_year = from->max_year;
+}
+
+// First and last row of the rows a stream has added, to join them to the
+// rows before and after
+typedef struct {
+    long rows;
+    int first_day, last_day;
+    double first_close, last_close;
+} StreamEnds;
+
+// Add every row of an open stream, parsed in chunks of `chunk_rows`
+// (>= 2); only the last day and close of a chunk are carried over for
+// the return into the next one.  Every sum is built in row order, as
+// decade_acc_add_series does.  With `add_time`, the seconds spent adding
+// (not parsing) the chunks are added to it.  Returns 0, 1 if the rows are
+// not in ascending date order (the caller has to roll back), -1 if memory
+// runs out.
+static inline int decade_acc_add_stream(DecadeAcc *acc, CsvStream *st, NodeArena *arena,
+                                        unsigned metrics, int chunk_rows,
+                                        StreamEnds *ends, size_t *bytes, double *add_time) {
+    StockSeries chunk;
+    memset(ends, 0, sizeof(*ends));
+
+    for (;;) {
+        int n = csv_stream_next(st, &chunk, arena, chunk_rows);
+        if (n < 0)
+            return -1;
+        *bytes += chunk.text_bytes;
+        if (n == 0)
+            break;
+        if (!st->ordered)
+            return 1;
+
+        double start = add_time ? omp_get_wtime() : 0.0;
+        if (ends->rows == 0) {
+            ends->first_day = chunk.day[0];
+            ends->first_close = chunk.close[0];
+            int first_year = day_year(chunk.day[0]);
+            if (first_year < acc->min_year) acc->min_year = first_year;
+        }
+        int last_year = day_year(chunk.day[n - 1]);
+        if (last_year > acc->max_year) acc->max_year = last_year;
+
+        if (metrics & METRIC_PRICES)
+            decade_acc_add_prices(acc, &chunk);
+        if (metrics & METRIC_RETURNS) {
+            if (ends->rows > 0)
+                decade_acc_add_return(acc, ends->last_day, ends->last_close, chunk.close[0]);
+            decade_acc_add_returns(acc, &chunk);
+        }
+        ends->last_day = chunk.day[n - 1];
+        ends->last_close = chunk.close[n - 1];
+        ends->rows += n;
+        if (add_time)
+            *add_time += omp_get_wtime() - start;
+        if (n < chunk_rows)
+            break;
+    }
+    return 0;
+}
+
+// Load a file whole and add it (files that cannot be streamed or split)
+static inline size_t decade_acc_add_file(DecadeAcc *acc, const char *filename,
+                                         NodeArena *arena, const LoadSpec *spec,
+                                         unsigned metrics) {
+    StockSeries data;
+    if (read_csv(filename, &data, arena, spec) > 1)
+        decade_acc_add_series(acc, &data, metrics);
+    return data.text_bytes;
+}
+
+// Add one CSV file in streaming mode (decade_acc_add_stream), so the
+// memory used does not depend on the file size.  A file with a single
+// row adds nothing, as in the whole-file path.  Streaming needs
+// ascending dates; if a file turns out not to be in order, what it added
+// so far is rolled back and the file is loaded whole and sorted instead
+// (the arena is released afterwards so it shrinks back).  `add_time` as
+// for decade_acc_add_stream.  Returns the CSV bytes read.
+static inline size_t decade_acc_add_streamed(DecadeAcc *acc, const char *filename,
+                                             NodeArena *arena, const LoadSpec *spec,
+                                             unsigned metrics, int chunk_rows,
+                                             double *add_time) {
+    CsvStream st;
+    if (csv_stream_open(&st, filename, spec, 1, 1) != 0)
+        return 0;
+
+    DecadeAcc saved = *acc;
+    StreamEnds ends;
+    size_t bytes = 0;
+    double added = 0.0;
+    int rc = decade_acc_add_stream(acc, &st, arena, metrics, chunk_rows, &ends, &bytes,
+                                   add_time ? &added : NULL);
+    csv_stream_close(&st);
+    if (rc == 0 && ends.rows != 1) {
+        if (add_time) *add_time += added;
+        return bytes;
+    }
+
+    *acc = saved;
+    if (rc <= 0)
+        return bytes;
+    StockSeries data;
+    if (read_csv(filename, &data, arena, spec) > 1) {
+        double start = add_time ? omp_get_wtime() : 0.0;
+        decade_acc_add_series(acc, &data, metrics);
+        if (add_time) *add_time += omp_get_wtime() - start;
+    }
+    arena_release(arena);
+    return data.text_bytes;
+}
+
+// Plain CSV files of at least this many bytes are split into tasks
+#ifndef DECADE_TASK_MIN_BYTES
+#define DECADE_TASK_MIN_BYTES (32LL << 20)
+#endif
+// CSV text per task, and rows parsed at a time inside a task
+#define DECADE_TASK_BYTES (4 << 20)
+#define DECADE_TASK_ROWS  (1 << 16)
+
+// One task's share of a file
+typedef struct {
+    DecadeAcc acc;
+    StreamEnds ends;
+    size_t bytes;
+    int rc;                     // decade_acc_add_stream result
+} DecadePart;
+
+// Add one large plain CSV file with a taskloop over byte ranges of its
+// rows, so threads that have run out of files help finish it (they pick
+// up the tasks at their next scheduling point, e.g. the barrier ending
+// the file loop).  Each task parses its lines into its own partial
+// accumulator; the partials are then merged in file order, adding the
+// return across each range boundary, so the result does not depend on
+// which thread ran what.  A day range is narrowed to its rows first when
+// the dates of the whole file are in order (see csv_pushdown_range).
+// Returns the CSV bytes read, or -1 if the file has to take the
+// whole-file path instead (not plain text, not in ascending date order,
+// or out of memory); nothing has been added in that case.
+static inline long long decade_acc_add_tasks(DecadeAcc *acc, const char *filename,
+                                             const LoadSpec *spec, unsigned metrics) {
+    size_t len = strlen(filename);
+    if (!csv_has_suffix(filename, len, ".csv")) return -1;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    const char *text = (const char *)map;
+
+    size_t data_start = csv_data_start(text, size);
+    size_t lo = data_start, hi = size;
+    if ((spec->from_day != DAY_RANGE_MIN || spec->to_day != DAY_RANGE_MAX) &&
+        csv_pushdown_range(text, size, data_start, spec->from_day, spec->to_day,
+                           &lo, &hi) != 0) {
+        lo = data_start;
+        hi = size;
+    }
+
+    int parts = (int)((hi - lo + DECADE_TASK_BYTES - 1) / DECADE_TASK_BYTES);
+    DecadePart *part = (DecadePart *)malloc((parts ? parts : 1) * sizeof(DecadePart));
+    // row buffers of the tasks: one per thread of the team (a tied task
+    // keeps its thread), released once the taskloop is done
+    int team = omp_get_num_threads();
+    NodeArena *arenas = (NodeArena *)malloc((size_t)team * sizeof(NodeArena));
+    if (!part || !arenas) {
+        free(part);
+        free(arenas);
+        munmap(map, size);
+        return -1;
+    }
+    for (int t = 0; t < team; t++)
+        arena_init(&arenas[t], -1);
+
+    // range k holds the lines starting in [lo + k * B, lo + (k + 1) * B)
+    #pragma omp taskloop grainsize(1)
+    for (int k = 0; k < parts; k++) {
+        NodeArena *task_arena = &arenas[omp_get_thread_num()];
+        DecadePart *p = &part[k];
+        size_t a = csv_line_at(text, size, data_start, lo + (size_t)k * DECADE_TASK_BYTES);
+        size_t b = k + 1 == parts ? hi
+                 : csv_line_at(text, size, data_start, lo + (size_t)(k + 1) * DECADE_TASK_BYTES);
+        if (a > hi) a = hi;
+        if (b > hi) b = hi;
+
+        decade_acc_init(&p->acc);
+        p->ends.rows = 0;
+        p->bytes = 0;
+        p->rc = -1;
+        CsvStream cs;
+        if (csv_stream_open_text(&cs, text + a, b - a, spec) == 0) {
+            p->rc = decade_acc_add_stream(&p->acc, &cs, task_arena, metrics,
+                                          DECADE_TASK_ROWS, &p->ends, &p->bytes, NULL);
+            csv_stream_close(&cs);
+        }
+    }
+    for (int t = 0; t < team; t++)
+        arena_release(&arenas[t]);
+    free(arenas);
+    munmap(map, size);
+
+    // the ranges have to join up in ascending order as well
+    long long bytes = 0;
+    long rows = 0;
+    int ok = 1, last_day = DAY_RANGE_MIN;
+    for (int k = 0; ok && k < parts; k++) {
+        ok = part[k].rc == 0 && (part[k].ends.rows == 0 || part[k].ends.first_day > last_day);
+        if (part[k].ends.rows > 0) last_day = part[k].ends.last_day;
+        bytes += (long long)part[k].bytes;
+        rows += part[k].ends.rows;
+    }
+    if (!ok) {
+        free(part);
+        return -1;
+    }
+
+    // merge in file order; a file with a single row adds nothing
+    const StreamEnds *prev = NULL;
+    for (int k = 0; rows > 1 && k < parts; k++) {
+        const StreamEnds *e = &part[k].ends;
+        if (e->rows == 0)
+            continue;
+        if (prev && (metrics & METRIC_RETURNS))
+            decade_acc_add_return(acc, prev->last_day, prev->last_close, e->first_close);
+        decade_acc_merge(acc, &part[k].acc);
+        prev = e;
+    }
+    free(part);
+    return bytes;
+}
+
+// Add the rows of [from_day, to_day] of a cache file, block by block.
+// The zone maps locate the first and last block of the range; a block
+// whose rows all lie in one decade and pass the price rules (per its
+// zone map) is summed without any per-row checks or decade lookups,
+// every other block takes the row-by-row path above.  Compressed blocks
+// are decoded one at a time (only the columns the metrics need), and the
+// last close of a block is carried over for the return into the next.
+static inline void decade_acc_add_cached(DecadeAcc *acc, const CacheView *v,
+                                         unsigned metrics, int from_day, int to_day) {
+    int n = v->series.n;
+    int lo = from_day == DAY_RANGE_MIN ? 0 : cache_lower_bound(v, from_day);
+    int hi = to_day == DAY_RANGE_MAX ? n : cache_lower_bound(v, to_day + 1);
+    if (lo < 0 || hi < 0 || hi - lo <= 1)
+        return;
+
+    unsigned columns = metric_columns(metrics);
+    int block_rows = (int)v->hdr->block_rows;
+    int prev_day = 0;
+    double prev_close = 0.0;
+
+    for (int b = lo / block_rows; b * block_rows < hi; b++) {
+        const CacheZone *z = &v->zones[b];
+        StockSeries blk;
+        if (cache_block(v, b, columns, &blk) != 0)
+            return;
+
+        // rows [b0, b1) of this block are in the range
+        int base = b * block_rows;
+        int b0 = base > lo ? 0 : lo - base;
+        int b1 = base + z->rows < hi ? z->rows : hi - base;
+
+        int d = decade_index_of_year(day_year(blk.day[b0]));
+        int one_decade = d >= 0 && d == decade_index_of_year(day_year(blk.day[b1 - 1]));
+
+        if (base + b0 == lo) {
+            int first_year = day_year(blk.day[b0]);
+            if (first_year < acc->min_year) acc->min_year = first_year;
+        }
+        if (base + b1 == hi) {
+            int last_year = day_year(blk.day[b1 - 1]);
+            if (last_year > acc->max_year) acc->max_year = last_year;
+        }
+
+        if (metrics & METRIC_PRICES) {
+            if (one_decade && z->bad_prices == 0) {
+                // four independent sums keep the adds pipelined
+                double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+                int i = b0;
+                for (; i + 4 <= b1; i += 4)
+                    for (int j = 0; j < 4; j++)
+                        sum[j] += (blk.open[i + j] + blk.high[i + j] +
+                                   blk.low[i + j] + blk.close[i + j]) / 4.0;
+                for (; i < b1; i++)
+                    sum[0] += (blk.open[i] + blk.high[i] + blk.low[i] + blk.close[i]) / 4.0;
+                acc->sum_avg[d] += (sum[0] + sum[1]) + (sum[2] + sum[3]);
+                acc->rows[d]    += b1 - b0;
+            } else {
+                decade_acc_prices_rows(acc, &blk, b0, b1);
+            }
+        }
+
+        if (metrics & METRIC_RETURNS) {
+            // the return from the previous block's last row
+            if (base + b0 > lo)
+                decade_acc_add_return(acc, prev_day, prev_close, blk.close[b0]);
+
+            if (one_decade && z->bad_close == 0) {
+                double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+                double sum_sq[4] = { 0.0, 0.0, 0.0, 0.0 };
+                long count = 0;
+                int i = b0;
+                for (; i + 4 <= b1 - 1; i += 4)
+                    for (int j = 0; j < 4; j++) {
+                        const double *c = blk.close + i + j;
+                        double r = (c[1] - c[0]) / c[0];
+                        int keep = fabs(r) <= 1.0;
+                        sum[j]    += keep ? r : 0.0;
+                        sum_sq[j] += keep ? r * r : 0.0;
+                        count     += keep;
+                    }
+                for (; i < b1 - 1; i++) {
+                    double r = (blk.close[i + 1] - blk.close[i]) / blk.close[i];
+                    int keep = fabs(r) <= 1.0;
+                    sum[0]    += keep ? r : 0.0;
+                    sum_sq[0] += keep ? r * r : 0.0;
+                    count     += keep;
+                }
+                acc->sum_ret[d]    += (sum[0] + sum[1]) + (sum[2] + sum[3]);
+                acc->sum_ret_sq[d] += (sum_sq[0] + sum_sq[1]) + (sum_sq[2] + sum_sq[3]);
+                acc->ret_count[d]  += count;
+            } else {
+                decade_acc_returns_rows(acc, &blk, b0, b1 - 1);
+            }
+            prev_day = blk.day[b1 - 1];
+            prev_close = blk.close[b1 - 1];
+        }
+    }
+}
+
+// Compare per-decade statistics with those of the reference (double)
+// path, given the relative error `price_err` of one stored price, and
+// print one line per decade.  The row and return counts must be equal
+// (the cache guardrail keeps every cleaning decision); the mean price may
+// be off by price_err relative, and a daily return |r| <= 1 by
+// 2 (1 + |r|) price_err <= 4 price_err, which also bounds the error of
+// their mean and of the volatility.  Returns the number of decades out
+// of bounds.
+static inline int decade_acc_validate(const DecadeAcc *ref, const DecadeAcc *got,
+                                      double price_err) {
+    double price_tol = price_err + 1e-12;
+    double ret_tol = 4.0 * price_err + 1e-12;
+    int failures = 0;
+
+    for (int d = 0; d < MAX_DECADES; d++) {
+        if (ref->rows[d] == 0 && ref->ret_count[d] == 0 &&
+            got->rows[d] == 0 && got->ret_count[d] == 0)
+            continue;
+
+        double price_rel = 0.0, mean_err = 0.0, vol_err = 0.0;
+        if (ref->rows[d] > 0 && got->rows[d] > 0) {
+            double a = ref->sum_avg[d] / ref->rows[d];
+            double b = got->sum_avg[d] / got->rows[d];
+            price_rel = fabs(a - b) / fabs(a);
+        }
+        if (ref->ret_count[d] > 0 && got->ret_count[d] > 0) {
+            double ma = ref->sum_ret[d] / ref->ret_count[d];
+            double mb = got->sum_ret[d] / got->ret_count[d];
+            double va = ref->sum_ret_sq[d] / ref->ret_count[d] - ma * ma;
+            double vb = got->sum_ret_sq[d] / got->ret_count[d] - mb * mb;
+            mean_err = fabs(ma - mb);
+            vol_err = fabs(sqrt(va > 0.0 ? va : 0.0) - sqrt(vb > 0.0 ? vb : 0.0));
+        }
+
+        int ok = ref->rows[d] == got->rows[d] && ref->ret_count[d] == got->ret_count[d] &&
+                 price_rel <= price_tol && mean_err <= ret_tol && vol_err <= ret_tol;
+        failures += !ok;
+
+        int start = MIN_YEAR_GLOBAL + 10 * d;
+        printf("  Decade %d-%d: rows %ld/%ld, price rel err %.2e, "
+               "return err %.2e, volatility err %.2e  %s\n",
+               start, start == 2010 ? 2020 : start + 9, got->rows[d], ref->rows[d],
+               price_rel, mean_err, vol_err, ok ? "OK" : "OUT OF BOUNDS");
+    }
+    printf("  Bounds: price %.2e relative, returns and volatility %.2e\n",
+           price_tol, ret_tol);
+    return failures;
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef DECIMAL_PARSE_H
+#define DECIMAL_PARSE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fast parsing of the short decimals found in the price files
+// ("123.456789", "62546300").
+//
+// Up to eight digits are converted at once with SWAR (SIMD within a
+// register): the bytes are loaded into one 64-bit word, checked to be
+// digits, and folded pairwise with three multiply-adds.  The integer and
+// fraction digits give an exact integer mantissa m and a digit count f;
+// when m < 2^53 the result m / 10^f is a single correctly rounded IEEE
+// division of two exact doubles (Clinger's fast path), i.e. bit-identical
+// to strtod.  Anything unusual (sign, exponent, spaces, more than 15
+// significant digits, ...) goes to strtod.
+//
+// The loads may read up to 8 bytes past the end of the field, so the
+// caller's buffer needs DECIMAL_PAD readable bytes after the text.
+
+#define DECIMAL_PAD 16
+
+static const double decimal_pow10[16] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+static inline uint64_t decimal_load8(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);       // little-endian: p[0] is the low byte
+    return v;
+}
+
+// Are all eight bytes ASCII digits?
+static inline int decimal_all_digits(uint64_t v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+             (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+            == 0x3333333333333333ULL);
+}
+
+// Value of `len` (1..8) ASCII digits at p, or -1 if one is not a digit
+static inline int64_t decimal_swar_digits(const char *p, int len) {
+    uint64_t v = decimal_load8(p);
+
+    // left-pad with '0' so the digits fill the word
+    if (len < 8)
+        v = (v << (8 * (8 - len))) | (0x3030303030303030ULL >> (8 * len));
+    if (!decimal_all_digits(v))
+        return -1;
+
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);                                   // pairs
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (int64_t)v;
+}
+
+// Value of `len` (0..16) digits at p, or -1
+static inline int64_t decimal_digits(const char *p, int len) {
+    if (len == 0) return 0;
+    if (len <= 8) return decimal_swar_digits(p, len);
+
+    int64_t hi = decimal_swar_digits(p, len - 8);
+    int64_t lo = decimal_swar_digits(p + len - 8, 8);
+    if (hi < 0 || lo < 0) return -1;
+    return hi * 100000000 + lo;
+}
+
+// Position of the first '.' in p[0..len), or -1.  Eight bytes are tested
+// at once: x = v ^ "........" has a zero byte exactly where the dots are.
+static inline int decimal_find_dot(const char *p, int len) {
+    for (int base = 0; base < len; base += 8) {
+        uint64_t x = decimal_load8(p + base) ^ 0x2E2E2E2E2E2E2E2EULL;
+        uint64_t z = (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+        if (z) {
+            int i = base + (__builtin_ctzll(z) >> 3);
+            return i < len ? i : -1;
+        }
+    }
+    return -1;
+}
+
+// Full parser for everything the fast path does not take
+static inline int decimal_parse_slow(const char *p, const char *end, double *out) {
+    char *stop;
+    *out = strtod(p, &stop);
+    return stop == end ? 0 : -1;
+}
+
+// Parse the decimal number spanning exactly [p, end).
+// Returns 0 on success, -1 if the text is not a number.
+static inline int parse_decimal(const char *p, const char *end, double *out) {
+    int len = (int)(end - p);
+    if (len <= 0) return -1;
+    if (len > 17) return decimal_parse_slow(p, end, out);
+
+    int int_len = len, frac_len = 0;
+    int dot = decimal_find_dot(p, len);
+    if (dot >= 0) {
+        int_len = dot;
+        frac_len = len - dot - 1;
+    }
+    if (int_len == 0 || int_len > 16 || frac_len > 8 || int_len + frac_len > 15)
+        return decimal_parse_slow(p, end, out);
+
+    int64_t ip = decimal_digits(p, int_len);
+    int64_t fp = frac_len ? decimal_swar_digits(p + dot + 1, frac_len) : 0;
+    if (ip < 0 || fp < 0)
+        return decimal_parse_slow(p, end, out);
+
+    // m < 10^15 < 2^53: both operands exact, one correctly rounded division
+    int64_t m = ip * (int64_t)decimal_pow10[frac_len] + fp;
+    *out = (double)m / decimal_pow10[frac_len];
+    return 0;
+}
+
+#endif
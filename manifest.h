@@ -0,0 +1,269 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "catalog.h"
+
+// Binary manifest of a catalog (--manifest=FILE).
+//
+// Listing and stat'ing a directory of 100k+ files costs seconds on a
+// network file system, and much more when every MPI rank does it.  The
+// manifest stores a built catalog (paths, sizes, mtimes, ticker ids,
+// largest first) in one file laid out exactly like the Catalog arrays:
+//
+//   ManifestHeader | CatalogEntry[count] | CatalogDir[dir_count] | paths
+//
+// so opening it is one mmap and no parsing; the pages are shared by all
+// processes of a machine through the page cache.  The listed directories
+// and their mtimes are stored too: a file added, removed or renamed
+// anywhere in the tree changes one of them, which makes the manifest
+// stale and it is rebuilt.  A file rewritten in place keeps its
+// directory's mtime, so that check alone does not see it; the deep check
+// (MANIFEST_CHECK_FILES, used for the cache's own manifest) also stats
+// every file, which still saves the directory listing.
+//
+// The same layout is the wire format the MPI driver gathers the hash
+// partitions of a parallel listing in (manifest_pack / manifest_view).
+
+#define MANIFEST_MAGIC "STKMAN02"
+
+// How manifest_open checks that a manifest is current
+#define MANIFEST_CHECK_NONE  0
+#define MANIFEST_CHECK_DIRS  1      // directory mtimes
+#define MANIFEST_CHECK_FILES 2      // ... and the size and mtime of every file
+
+typedef struct {
+    char magic[8];
+    uint32_t entry_size;        // sizeof(CatalogEntry), rejects other builds
+    uint32_t dir_size;          // sizeof(CatalogDir)
+    int32_t count;
+    int32_t dir_count;
+    int32_t tickers;
+    int32_t sorted;
+    int32_t recursive;
+    int32_t reserved;
+    uint64_t path_bytes;
+    uint64_t entries_off;       // section offsets from the start of the file
+    uint64_t dirs_off;
+    uint64_t paths_off;
+    long long total_bytes;
+} ManifestHeader;
+
+static inline size_t manifest_align(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// Serialize `c`; returns a malloc'ed buffer of *len bytes or NULL
+static inline void *manifest_pack(const Catalog *c, size_t *len) {
+    ManifestHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MANIFEST_MAGIC, 8);
+    h.entry_size = sizeof(CatalogEntry);
+    h.dir_size = sizeof(CatalogDir);
+    h.count = c->count;
+    h.dir_count = c->dir_count;
+    h.tickers = c->tickers;
+    h.sorted = c->sorted;
+    h.recursive = c->recursive;
+    h.path_bytes = c->path_bytes;
+    h.entries_off = manifest_align(sizeof(h));
+    h.dirs_off = manifest_align(h.entries_off + (size_t)c->count * sizeof(CatalogEntry));
+    h.paths_off = manifest_align(h.dirs_off + (size_t)c->dir_count * sizeof(CatalogDir));
+    h.total_bytes = c->total_bytes;
+
+    *len = h.paths_off + c->path_bytes;
+    char *buf = (char *)calloc(1, *len);
+    if (!buf) return NULL;
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + h.entries_off, c->entries, (size_t)c->count * sizeof(CatalogEntry));
+    memcpy(buf + h.dirs_off, c->dirs, (size_t)c->dir_count * sizeof(CatalogDir));
+    memcpy(buf + h.paths_off, c->paths, c->path_bytes);
+    return buf;
+}
+
+// Point `c` at the catalog serialized in `buf` (nothing is copied, and
+// `c` must not be freed; c->map is left for the caller to set).
+// Returns 0, or -1 if the buffer is not a well-formed manifest.
+static inline int manifest_view(Catalog *c, const void *buf, size_t len) {
+    const ManifestHeader *h = (const ManifestHeader *)buf;
+    memset(c, 0, sizeof(*c));
+    if (len < sizeof(*h) || memcmp(h->magic, MANIFEST_MAGIC, 8) != 0 ||
+        h->entry_size != sizeof(CatalogEntry) || h->dir_size != sizeof(CatalogDir) ||
+        h->count < 0 || h->dir_count < 1 || h->path_bytes == 0)
+        return -1;
+    if (h->entries_off + (uint64_t)h->count * sizeof(CatalogEntry) > h->dirs_off ||
+        h->dirs_off + (uint64_t)h->dir_count * sizeof(CatalogDir) > h->paths_off ||
+        h->paths_off + h->path_bytes != len || (h->entries_off | h->dirs_off) & 7)
+        return -1;
+
+    const char *base = (const char *)buf;
+    c->paths = (char *)base + h->paths_off;
+    c->path_bytes = c->path_cap = h->path_bytes;
+    c->entries = (CatalogEntry *)(base + h->entries_off);
+    c->count = c->cap = h->count;
+    c->dirs = (CatalogDir *)(base + h->dirs_off);
+    c->dir_count = c->dir_cap = h->dir_count;
+    c->total_bytes = h->total_bytes;
+    c->tickers = h->tickers;
+    c->sorted = h->sorted;
+    c->recursive = h->recursive;
+
+    // every path offset must land on a NUL-terminated string
+    if (c->paths[c->path_bytes - 1] != '\0')
+        return -1;
+    for (int i = 0; i < c->count; i++)
+        if (c->entries[i].path_off >= c->path_bytes) return -1;
+    for (int d = 0; d < c->dir_count; d++)
+        if (c->dirs[d].path_off >= c->path_bytes) return -1;
+    return 0;
+}
+
+// Append the files and directories of `part` (a listing of the same root)
+// to `into`; the root itself is only kept once.  Returns 0 or -1.
+static inline int manifest_merge(Catalog *into, const Catalog *part) {
+    // the root was opened once per part: keep the oldest view of it
+    if (into->dirs[0].mtime_ns == 0 || part->dirs[0].mtime_ns < into->dirs[0].mtime_ns)
+        into->dirs[0].mtime_ns = part->dirs[0].mtime_ns;
+    for (int d = 1; d < part->dir_count; d++) {
+        const char *p = part->paths + part->dirs[d].path_off;
+        size_t off = catalog_push_string(into, p, strlen(p));
+        if (off == (size_t)-1 || catalog_add_dir(into, off, part->dirs[d].mtime_ns) != 0)
+            return -1;
+    }
+    for (int i = 0; i < part->count; i++) {
+        const char *p = catalog_path(part, i);
+        size_t off = catalog_push_string(into, p, strlen(p));
+        if (off == (size_t)-1 || catalog_add(into, off) != 0)
+            return -1;
+        into->entries[into->count - 1] = part->entries[i];
+        into->entries[into->count - 1].path_off = off;
+    }
+    into->total_bytes += part->total_bytes;
+    into->sorted = 0;
+    into->recursive = part->recursive;
+    return 0;
+}
+
+// Write the manifest of `c` to `file` (through a temporary name and a
+// rename, so readers never map a half-written file).  Returns 0 or -1.
+static inline int manifest_write(const Catalog *c, const char *file) {
+    size_t len;
+    void *buf = manifest_pack(c, &len);
+    if (!buf) return -1;
+
+    char tmp[4096 + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", file, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int err = fd < 0;
+    for (size_t done = 0; !err && done < len; ) {
+        ssize_t w = write(fd, (char *)buf + done, len - done);
+        if (w <= 0) err = 1;
+        else done += (size_t)w;
+    }
+    if (fd >= 0 && close(fd) != 0) err = 1;
+    free(buf);
+    if (err || rename(tmp, file) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// The directories of `c` are unchanged since it was listed (and with
+// `files`, every file still has its size and mtime, stat'ed in parallel
+// when asked to)
+static inline int manifest_fresh(const Catalog *c, int files, int parallel) {
+    for (int d = 0; d < c->dir_count; d++) {
+        struct stat st;
+        if (stat(c->paths + c->dirs[d].path_off, &st) != 0 ||
+            catalog_mtime_ns(&st) != c->dirs[d].mtime_ns)
+            return 0;
+    }
+    if (!files)
+        return 1;
+
+    int changed = 0;
+    #pragma omp parallel for schedule(dynamic, 256) reduction(+:changed) if (parallel)
+    for (int i = 0; i < c->count; i++) {
+        struct stat st;
+        if (stat(catalog_path(c, i), &st) != 0 ||
+            (long long)st.st_size != c->entries[i].size ||
+            (long long)st.st_mtime != c->entries[i].mtime)
+            changed++;
+    }
+    return changed == 0;
+}
+
+// Map the manifest `file` of directory `dirpath` into `c` (read-only; the
+// entries are used in place), checking it is current as `check`
+// (MANIFEST_CHECK_*) asks.  Returns 0 on success, 1 if the manifest is missing,
+// stale, of another directory or listing (`recursive` or not) or not
+// readable as a manifest.  `parallel` is passed on to manifest_fresh.
+static inline int manifest_open(Catalog *c, const char *file, const char *dirpath,
+                                int recursive, int check, int parallel) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ManifestHeader)) {
+        close(fd);
+        return 1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    // the root is stored like catalog_init_root stores it
+    size_t root_len = strlen(dirpath);
+    while (root_len > 1 && dirpath[root_len - 1] == '/') root_len--;
+    if (manifest_view(c, map, len) != 0 || strlen(c->paths) != root_len ||
+        memcmp(c->paths, dirpath, root_len) != 0 || c->recursive != recursive ||
+        (check && !manifest_fresh(c, check == MANIFEST_CHECK_FILES, parallel))) {
+        munmap(map, len);
+        memset(c, 0, sizeof(*c));
+        return 1;
+    }
+    c->map = map;
+    c->map_len = len;
+    return 0;
+}
+
+// Write the manifest of a listed catalog (numbering its tickers and
+// sorting it largest first, unless it came from a manifest)
+static inline int manifest_save(Catalog *c, const char *file) {
+    if (!c->map) {
+        if (c->count > 0 && c->entries[0].ticker < 0 && catalog_assign_tickers(c) != 0)
+            return -1;
+        catalog_sort_by_size(c);
+    }
+    return manifest_write(c, file);
+}
+
+// Catalog of `dirpath` through the manifest `file`: mapped if it is
+// current (checked as `check` asks), else listed (with its subdirectories
+// if `recursive`), numbered, sorted largest first and saved for the next
+// run.  Both the check and the listing use threads only if `parallel`.
+// *built tells which happened.  Returns 0, or -1 if the directory cannot
+// be read.
+static inline int manifest_catalog(Catalog *c, const char *dirpath, const char *file,
+                                   int recursive, int check, int parallel, int *built) {
+    *built = 0;
+    if (manifest_open(c, file, dirpath, recursive, check, parallel) == 0)
+        return 0;
+    *built = 1;
+    if (catalog_build(c, dirpath, recursive, parallel) != 0)
+        return -1;
+    if (manifest_save(c, file) != 0)
+        fprintf(stderr, "Cannot write manifest: %s\n", file);
+    return 0;
+}
+
+#endif
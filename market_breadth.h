@@ -0,0 +1,349 @@
+#ifndef MARKET_BREADTH_H
+#define MARKET_BREADTH_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "decade_stats.h"
+#include "market_merge.h"
+
+// Daily cross-sectional breadth and dispersion (--market): per trading
+// day the advancers and decliners, the mean, standard deviation and
+// median of the tickers' returns and the number of tickers at a new high
+// or low, rolled up by decade.
+//
+// Everything but the median is a sum over the rows of a day, so it is
+// accumulated straight from the runs into dense per-day arrays indexed by
+// day - first day: each thread adds whole runs into arrays of its own,
+// and the threads' arrays are then added together day by day, a loop the
+// compiler vectorizes.  No hash map and no merge by date is needed.  To
+// keep the per-thread arrays in cache whatever span of dates the data
+// covers, the days go through in tiles of BREADTH_TILE.
+//
+// The median is an order statistic of the whole cross-section, so it is
+// taken per day on the merged rows (market_stats.h, breadth_median).
+//
+// A ticker's return is counted as in the market index (daily_return_ok);
+// all daily figures are over the tickers with a return that day.  A new
+// high (low) is a close above (below) every valid close of the ticker's
+// previous BREADTH_WINDOW rows, so a ticker needs that much history first.
+
+#define BREADTH_WINDOW 252              // rows looked back for a new high / low (a trading year)
+#define BREADTH_TILE   4096             // days per tile of the per-thread arrays
+#define BREADTH_BLOCK  256              // days per unit of work when adding them up
+
+#define BREADTH_HIGH 1
+#define BREADTH_LOW  2
+
+typedef struct {
+    long   days[MAX_DECADES];           // trading days with at least one return
+    long   spread_days[MAX_DECADES];    // ... with at least two (a dispersion)
+    long   advancers[MAX_DECADES];
+    long   decliners[MAX_DECADES];
+    long   highs[MAX_DECADES];
+    long   lows[MAX_DECADES];
+    double sum_mean[MAX_DECADES];       // daily cross-sectional means
+    double sum_std[MAX_DECADES];        // ... standard deviations (spread days)
+    double sum_median[MAX_DECADES];     // ... medians
+} BreadthAcc;
+
+static inline void breadth_acc_init(BreadthAcc *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+static inline void breadth_acc_merge(BreadthAcc *into, const BreadthAcc *from) {
+    for (int d = 0; d < MAX_DECADES; d++) {
+        into->days[d]        += from->days[d];
+        into->spread_days[d] += from->spread_days[d];
+        into->advancers[d]   += from->advancers[d];
+        into->decliners[d]   += from->decliners[d];
+        into->highs[d]       += from->highs[d];
+        into->lows[d]        += from->lows[d];
+        into->sum_mean[d]    += from->sum_mean[d];
+        into->sum_std[d]     += from->sum_std[d];
+        into->sum_median[d]  += from->sum_median[d];
+    }
+}
+
+// Median of a[0..n-1] (n >= 1), reordering a; the mean of the two middle
+// values when n is even
+static inline double breadth_median(double *a, int n) {
+    int k = n / 2, lo = 0, hi = n - 1;
+    while (lo < hi) {
+        // Hoare partition around the median of three
+        int mid = lo + (hi - lo) / 2;
+        double x = a[lo], y = a[mid], z = a[hi];
+        double pivot = x < y ? (y < z ? y : (x < z ? z : x)) : (x < z ? x : (y < z ? z : y));
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (a[i] < pivot) i++;
+            while (a[j] > pivot) j--;
+            if (i <= j) {
+                double t = a[i]; a[i] = a[j]; a[j] = t;
+                i++;
+                j--;
+            }
+        }
+        if (k <= j) hi = j;
+        else if (k >= i) lo = i;
+        else break;
+    }
+    if (n & 1)
+        return a[k];
+    double below = a[0];                // a[0..k-1] <= a[k]: the largest of them
+    for (int i = 1; i < k; i++)
+        if (a[i] > below) below = a[i];
+    return 0.5 * (below + a[k]);
+}
+
+// Flag the rows of `run` that close at a new high or low (BREADTH_HIGH /
+// BREADTH_LOW in mark[i]).  The window's highest and lowest closes are
+// kept in two monotonic deques of row numbers, `ring` (2 * (BREADTH_WINDOW
+// + 1) ints), so each row costs O(1).
+static inline void breadth_marks(const MergeRun *run, unsigned char *mark, int *ring) {
+    const int cap = BREADTH_WINDOW + 1;
+    int *hq = ring, *lq = ring + cap;   // closes decreasing / increasing
+    int hh = 0, ht = 0, lh = 0, lt = 0; // head, tail (positions, mod cap)
+    const double *c = run->close;
+
+    for (int i = 0; i < run->n; i++) {
+        while (hh < ht && hq[hh % cap] < i - BREADTH_WINDOW) hh++;
+        while (lh < lt && lq[lh % cap] < i - BREADTH_WINDOW) lh++;
+        mark[i] = 0;
+        if (i >= BREADTH_WINDOW && hh < ht) {
+            if (c[i] > c[hq[hh % cap]]) mark[i] |= BREADTH_HIGH;
+            if (c[i] < c[lq[lh % cap]]) mark[i] |= BREADTH_LOW;
+        }
+        if (!(c[i] >= MIN_PRICE && c[i] <= MAX_PRICE))
+            continue;
+        while (hh < ht && c[hq[(ht - 1) % cap]] <= c[i]) ht--;
+        hq[ht++ % cap] = i;
+        while (lh < lt && c[lq[(lt - 1) % cap]] >= c[i]) lt--;
+        lq[lt++ % cap] = i;
+    }
+}
+
+// breadth_marks for rows that arrive one at a time (the year layout hands
+// out a ticker's rows day by day instead of as a run): the same two
+// deques, with the closes kept next to the row numbers
+typedef struct {
+    int rows;                           // rows seen so far
+    int hh, ht, lh, lt;
+    int *hq, *lq;                       // BREADTH_WINDOW + 1 row numbers each
+    double *hc, *lc;                    // ... and their closes
+} BreadthTrack;
+
+// Mark (BREADTH_HIGH / BREADTH_LOW) of the ticker's next row, closing at c
+static inline int breadth_track_next(BreadthTrack *b, double c) {
+    const int cap = BREADTH_WINDOW + 1;
+    int i = b->rows++;
+    while (b->hh < b->ht && b->hq[b->hh % cap] < i - BREADTH_WINDOW) b->hh++;
+    while (b->lh < b->lt && b->lq[b->lh % cap] < i - BREADTH_WINDOW) b->lh++;
+    int mark = 0;
+    if (i >= BREADTH_WINDOW && b->hh < b->ht) {
+        if (c > b->hc[b->hh % cap]) mark |= BREADTH_HIGH;
+        if (c < b->lc[b->lh % cap]) mark |= BREADTH_LOW;
+    }
+    if (!(c >= MIN_PRICE && c <= MAX_PRICE))
+        return mark;
+    while (b->hh < b->ht && b->hc[(b->ht - 1) % cap] <= c) b->ht--;
+    b->hq[b->ht % cap] = i;
+    b->hc[b->ht++ % cap] = c;
+    while (b->lh < b->lt && b->lc[(b->lt - 1) % cap] >= c) b->lt--;
+    b->lq[b->lt % cap] = i;
+    b->lc[b->lt++ % cap] = c;
+    return mark;
+}
+
+// Per-day sums of one tile of days, one set per thread
+typedef struct {
+    int *count, *adv, *dec, *highs, *lows;
+    double *sum, *sum_sq;
+} BreadthTile;
+
+// Add the returns of `run` on days [t0, t1) to tile `b` (index day - t0),
+// starting at row *pos and leaving *pos at the first row of a later tile
+static inline void breadth_tile_add(const BreadthTile *b, const MergeRun *run,
+                                    const unsigned char *mark, int *pos, int t0, int t1) {
+    int i = *pos;
+    for (; i < run->n && run->day[i] < t1; i++) {
+        double r;
+        if (i == 0 || !daily_return_ok(run->close[i - 1], run->close[i], &r))
+            continue;
+        int k = run->day[i] - t0;
+        b->count[k]  += 1;
+        b->adv[k]    += r > 0.0;
+        b->dec[k]    += r < 0.0;
+        b->highs[k]  += (mark[i] & BREADTH_HIGH) != 0;
+        b->lows[k]   += (mark[i] & BREADTH_LOW) != 0;
+        b->sum[k]    += r;
+        b->sum_sq[k] += r * r;
+    }
+    *pos = i;
+}
+
+// Add the tiles of threads 1..threads-1 into tile 0 over days [k0, k1),
+// roll those days up into `acc` (days from t0) and clear them for the
+// next tile
+static inline void breadth_tile_fold(BreadthTile *tiles, int threads, int k0, int k1,
+                                     int t0, BreadthAcc *acc) {
+    BreadthTile *b = &tiles[0];
+    for (int t = 1; t < threads; t++) {
+        const BreadthTile *o = &tiles[t];
+        #pragma omp simd
+        for (int k = k0; k < k1; k++) {
+            b->count[k]  += o->count[k];
+            b->adv[k]    += o->adv[k];
+            b->dec[k]    += o->dec[k];
+            b->highs[k]  += o->highs[k];
+            b->lows[k]   += o->lows[k];
+            b->sum[k]    += o->sum[k];
+            b->sum_sq[k] += o->sum_sq[k];
+        }
+    }
+
+    for (int k = k0; k < k1; k++) {
+        int n = b->count[k];
+        if (n == 0)
+            continue;
+        int d = decade_index_of_year(day_year(t0 + k));
+        if (d < 0)
+            continue;
+        double mean = b->sum[k] / n;
+        acc->days[d]      += 1;
+        acc->advancers[d] += b->adv[k];
+        acc->decliners[d] += b->dec[k];
+        acc->highs[d]     += b->highs[k];
+        acc->lows[d]      += b->lows[k];
+        acc->sum_mean[d]  += mean;
+        if (n > 1) {
+            // population standard deviation of the day's returns
+            double var = b->sum_sq[k] / n - mean * mean;
+            acc->spread_days[d] += 1;
+            acc->sum_std[d]     += sqrt(var > 0.0 ? var : 0.0);
+        }
+    }
+
+    size_t len = (size_t)(k1 - k0);
+    for (int t = 0; t < threads; t++) {
+        BreadthTile *o = &tiles[t];
+        memset(o->count + k0, 0, len * sizeof(int));
+        memset(o->adv + k0, 0, len * sizeof(int));
+        memset(o->dec + k0, 0, len * sizeof(int));
+        memset(o->highs + k0, 0, len * sizeof(int));
+        memset(o->lows + k0, 0, len * sizeof(int));
+        memset(o->sum + k0, 0, len * sizeof(double));
+        memset(o->sum_sq + k0, 0, len * sizeof(double));
+    }
+}
+
+// Breadth of all runs, added into `out` (all but the medians), in parallel
+// unless `parallel` is 0.  Returns 0, or -1 if out of memory.
+static inline int breadth_compute(const MarketRuns *m, BreadthAcc *out, int parallel) {
+    if (m->count == 0)
+        return 0;
+    int first = m->runs[0].day[0], last = m->runs[0].day[m->runs[0].n - 1];
+    for (int r = 1; r < m->count; r++) {
+        if (m->runs[r].day[0] < first) first = m->runs[r].day[0];
+        if (m->runs[r].day[m->runs[r].n - 1] > last) last = m->runs[r].day[m->runs[r].n - 1];
+    }
+
+    int threads = parallel ? omp_get_max_threads() : 1;
+    size_t tile_bytes = (size_t)BREADTH_TILE * (5 * sizeof(int) + 2 * sizeof(double));
+    unsigned char *mark = (unsigned char *)malloc((size_t)m->rows);
+    long long *mark_off = (long long *)malloc((size_t)m->count * sizeof(long long));
+    int *pos = (int *)calloc((size_t)m->count, sizeof(int));
+    char *tile_mem = (char *)calloc((size_t)threads, tile_bytes);
+    BreadthTile *tiles = (BreadthTile *)malloc((size_t)threads * sizeof(BreadthTile));
+    BreadthAcc *acc = (BreadthAcc *)malloc((size_t)threads * sizeof(BreadthAcc));
+    int *ring = (int *)malloc((size_t)threads * 2 * (BREADTH_WINDOW + 1) * sizeof(int));
+    int failed = !mark || !mark_off || !pos || !tile_mem || !tiles || !acc || !ring;
+
+    if (!failed) {
+        long long off = 0;
+        for (int r = 0; r < m->count; r++) {
+            mark_off[r] = off;
+            off += m->runs[r].n;
+        }
+        for (int t = 0; t < threads; t++) {
+            char *p = tile_mem + (size_t)t * tile_bytes;
+            int *ints = (int *)p;
+            double *dbl = (double *)(p + (size_t)BREADTH_TILE * 5 * sizeof(int));
+            tiles[t].count = ints;
+            tiles[t].adv   = ints + BREADTH_TILE;
+            tiles[t].dec   = ints + 2 * BREADTH_TILE;
+            tiles[t].highs = ints + 3 * BREADTH_TILE;
+            tiles[t].lows  = ints + 4 * BREADTH_TILE;
+            tiles[t].sum    = dbl;
+            tiles[t].sum_sq = dbl + BREADTH_TILE;
+            breadth_acc_init(&acc[t]);
+        }
+    }
+
+    #pragma omp parallel if (parallel) num_threads(threads)
+    if (!failed) {
+        int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+        #pragma omp for schedule(dynamic, 16)
+        for (int r = 0; r < m->count; r++)
+            breadth_marks(&m->runs[r], mark + mark_off[r], ring + (size_t)tid * 2 * (BREADTH_WINDOW + 1));
+
+        for (long long t0 = first; t0 <= last; t0 += BREADTH_TILE) {
+            int len = (int)(last + 1 - t0 < BREADTH_TILE ? last + 1 - t0 : BREADTH_TILE);
+            #pragma omp for schedule(dynamic, 16)
+            for (int r = 0; r < m->count; r++)
+                breadth_tile_add(&tiles[tid], &m->runs[r], mark + mark_off[r], &pos[r],
+                                 (int)t0, (int)t0 + len);
+            #pragma omp for schedule(static)
+            for (int k0 = 0; k0 < len; k0 += BREADTH_BLOCK)
+                breadth_tile_fold(tiles, nt, k0, k0 + BREADTH_BLOCK < len ? k0 + BREADTH_BLOCK : len,
+                                  (int)t0, &acc[tid]);
+        }
+    }
+
+    if (!failed)
+        for (int t = 0; t < threads; t++)
+            breadth_acc_merge(out, &acc[t]);
+    free(mark);
+    free(mark_off);
+    free(pos);
+    free(tile_mem);
+    free(tiles);
+    free(acc);
+    free(ring);
+    return failed ? -1 : 0;
+}
+
+static inline void breadth_print(const BreadthAcc *b, int min_year, const char *dash) {
+    printf("\nMarket Breadth by Decade (daily cross-section of returns):\n");
+    printf("----------------------------------------------------------\n");
+
+    int first_decade = (min_year / 10) * 10;
+    for (int decade_start = first_decade; decade_start <= 2010; decade_start += 10) {
+        int d = (decade_start - MIN_YEAR_GLOBAL) / 10;
+        if (d < 0 || d >= MAX_DECADES || b->days[d] == 0)
+            continue;
+
+        double days = (double)b->days[d];
+        double mean = b->sum_mean[d] / days;
+        double median = b->sum_median[d] / days;
+        double spread = b->spread_days[d] ? b->sum_std[d] / (double)b->spread_days[d] : 0.0;
+        int decade_end = (decade_start == 2010) ? 2020 : (decade_start + 9);
+
+        printf("Decade %d%s%d:\n", decade_start, dash, decade_end);
+        printf("  Trading days:          %ld\n", b->days[d]);
+        printf("  Advancers per day:     %.1f\n", b->advancers[d] / days);
+        printf("  Decliners per day:     %.1f\n", b->decliners[d] / days);
+        if (b->decliners[d] > 0)
+            printf("  Advance/decline ratio: %.3f\n", (double)b->advancers[d] / b->decliners[d]);
+        printf("  Cross-section mean:    %.6f (%.4f%%)\n", mean, mean * 100.0);
+        printf("  Cross-section median:  %.6f (%.4f%%)\n", median, median * 100.0);
+        printf("  Cross-section std:     %.4f (%.4f%%)\n", spread, spread * 100.0);
+        printf("  New highs per day:     %.2f\n", b->highs[d] / days);
+        printf("  New lows per day:      %.2f\n\n", b->lows[d] / days);
+    }
+}
+
+#endif
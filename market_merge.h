@@ -0,0 +1,345 @@
+#ifndef MARKET_MERGE_H
+#define MARKET_MERGE_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "arena.h"
+#include "catalog.h"
+#include "stock_cache.h"
+#include "stock_data.h"
+#include "stock_loader.h"
+
+// Market-wide, time-ordered view of a dataset (--market).
+//
+// Cross-ticker analytics need every ticker's rows of a day together, but
+// the files are sorted per ticker.  The day and close columns of every
+// file are loaded as one sorted run each, and the runs are merged with a
+// tournament (loser) tree: the root holds the run with the smallest next
+// day, and advancing it replays only the log2(k) matches on its path.
+//
+// The merge is parallel by time: the date range is cut into intervals
+// holding about the same number of rows (quantiles of a sample of the
+// day keys), each run is cut at the interval bounds by binary search,
+// and threads merge whole intervals independently.  An interval never
+// splits a day, so the rows of one day are handed to a reducer together
+// (MarketDay) and nothing but the current day is ever materialized.
+
+#define MARKET_SAMPLES 64               // day keys sampled per interval
+
+// One file's rows in chronological order
+typedef struct {
+    int *day;
+    double *close;
+    int n;
+} MergeRun;
+
+// The rows of one day: row[j] of run[j], runs in ascending order
+typedef struct {
+    int day;
+    int count;
+    const int *run;
+    const int *row;
+} MarketDay;
+
+// Reducer called once per day, in day order within an interval.  The
+// reducer may look at earlier rows of a run (row - 1 is the previous day
+// of that ticker), whichever interval they were merged in.
+typedef void (*MarketDayFn)(void *state, const MergeRun *runs, const MarketDay *d);
+
+typedef struct {
+    MergeRun *runs;
+    int count;
+    long long rows;
+} MarketRuns;
+
+static inline void market_runs_free(MarketRuns *m) {
+    for (int r = 0; r < m->count; r++) {
+        free(m->runs[r].day);
+        free(m->runs[r].close);
+    }
+    free(m->runs);
+    memset(m, 0, sizeof(*m));
+}
+
+// Copy rows [lo, hi) of a series into a run (n = 0 if out of memory)
+static inline void market_run_copy(MergeRun *run, const StockSeries *s, int lo, int hi) {
+    int n = hi - lo;
+    run->day = (int *)malloc((size_t)(n > 0 ? n : 1) * sizeof(int));
+    run->close = (double *)malloc((size_t)(n > 0 ? n : 1) * sizeof(double));
+    run->n = run->day && run->close ? n : 0;
+    if (run->n == 0) return;
+    memcpy(run->day, s->day + lo, (size_t)n * sizeof(int));
+    memcpy(run->close, s->close + lo, (size_t)n * sizeof(double));
+}
+
+// Rows of cache view `v` in [from_day, to_day] into a run
+static inline int market_run_cached(MergeRun *run, const CacheView *v, int from_day, int to_day) {
+    int lo = from_day == DAY_RANGE_MIN ? 0 : cache_lower_bound(v, from_day);
+    int hi = to_day == DAY_RANGE_MAX ? v->series.n : cache_lower_bound(v, to_day + 1);
+    if (lo < 0 || hi < 0) return -1;
+    if (!v->chunks) {
+        market_run_copy(run, &v->series, lo, hi);
+        return run->n == hi - lo ? 0 : -1;
+    }
+
+    // compressed: decode the close column of the blocks that hold the rows
+    int n = hi - lo, block_rows = (int)v->hdr->block_rows;
+    run->day = (int *)malloc((size_t)(n > 0 ? n : 1) * sizeof(int));
+    run->close = (double *)malloc((size_t)(n > 0 ? n : 1) * sizeof(double));
+    run->n = 0;
+    if (!run->day || !run->close) return -1;
+    for (int b = lo / block_rows; n > 0 && b <= (hi - 1) / block_rows; b++) {
+        StockSeries blk;
+        if (cache_block(v, b, COL_CLOSE, &blk) != 0) return -1;
+        int base = b * block_rows;
+        int first = lo > base ? lo - base : 0;
+        int last = hi - base < blk.n ? hi - base : blk.n;
+        memcpy(run->day + run->n, blk.day + first, (size_t)(last - first) * sizeof(int));
+        memcpy(run->close + run->n, blk.close + first, (size_t)(last - first) * sizeof(double));
+        run->n += last - first;
+    }
+    return 0;
+}
+
+// Load the day and close columns in [from_day, to_day] of every file of
+// the catalog (from the column cache when `cache_dir` is set), in
+// parallel unless `parallel` is 0.  Files with fewer than two rows are left
+// out, as the decade report leaves them out.  *bytes = CSV bytes parsed.
+// Returns 0 or -1.
+static inline int market_load(MarketRuns *m, const Catalog *c, const char *cache_dir,
+                              unsigned cache_flags, int from_day, int to_day, int parallel,
+                              double *bytes) {
+    memset(m, 0, sizeof(*m));
+    MergeRun *all = (MergeRun *)calloc(c->count ? c->count : 1, sizeof(MergeRun));
+    if (!all) return -1;
+    LoadSpec spec = { COL_CLOSE, from_day, to_day };
+    int failed = 0;
+    double parsed = 0.0;
+
+    #pragma omp parallel if (parallel) reduction(+:failed, parsed)
+    {
+        NodeArena arena;
+        arena_init(&arena, -1);
+        StockSeries data;
+        #pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < c->count; i++) {
+            if (cache_dir) {
+                CacheView view;
+                if (stock_cache_load(&view, cache_dir, c, i, &arena, cache_flags) == 0) {
+                    parsed += (double)view.text_bytes;
+                    if (market_run_cached(&all[i], &view, from_day, to_day) != 0) failed++;
+                    stock_cache_close(&view);
+                    continue;
+                }
+            }
+            int n = read_csv(catalog_path(c, i), &data, &arena, &spec);
+            parsed += (double)data.text_bytes;
+            if (n <= 1)
+                continue;
+            market_run_copy(&all[i], &data, 0, n);
+            if (all[i].n != n) failed++;
+        }
+        arena_release(&arena);
+    }
+    *bytes = parsed;
+
+    // keep the runs a reducer can use, in catalog order
+    for (int i = 0; i < c->count; i++) {
+        if (all[i].n > 1) {
+            all[m->count++] = all[i];
+            m->rows += all[i].n;
+        } else {
+            free(all[i].day);
+            free(all[i].close);
+        }
+    }
+    m->runs = all;
+    if (failed) {
+        market_runs_free(m);
+        return -1;
+    }
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------
+// Loser tree
+// ---------------------------------------------------------------------
+
+// k leaves (runs) are nodes k..2k-1 of an implicit binary tree; node[n]
+// (1 <= n < k) keeps the loser of the match played there and node[0] the
+// overall winner.  A leaf's key is the day at its cursor (INT_MAX once
+// exhausted); equal days go to the lower run, so the order is stable.
+typedef struct {
+    int k;
+    int *node;
+    int *leaf_run;              // run of each leaf
+    int *pos, *end;             // cursor and end of each leaf
+    const MergeRun *runs;
+} LoserTree;
+
+static inline int loser_key(const LoserTree *t, int leaf) {
+    return t->pos[leaf] < t->end[leaf] ? t->runs[t->leaf_run[leaf]].day[t->pos[leaf]] : INT_MAX;
+}
+
+// Leaf a is ahead of leaf b
+static inline int loser_before(const LoserTree *t, int a, int b) {
+    int ka = loser_key(t, a), kb = loser_key(t, b);
+    return ka < kb || (ka == kb && a < b);
+}
+
+static inline void loser_build(LoserTree *t, int *winner) {
+    int k = t->k;
+    for (int i = 0; i < k; i++) winner[k + i] = i;
+    for (int n = k - 1; n >= 1; n--) {
+        int a = winner[2 * n], b = winner[2 * n + 1];
+        if (loser_before(t, a, b)) { winner[n] = a; t->node[n] = b; }
+        else                       { winner[n] = b; t->node[n] = a; }
+    }
+    t->node[0] = k > 1 ? winner[1] : 0;
+}
+
+// Advance the winner's cursor and replay its path to the root
+static inline void loser_advance(LoserTree *t) {
+    int cur = t->node[0];
+    t->pos[cur]++;
+    for (int n = (cur + t->k) / 2; n >= 1; n /= 2)
+        if (loser_before(t, t->node[n], cur)) {
+            int l = t->node[n];
+            t->node[n] = cur;
+            cur = l;
+        }
+    t->node[0] = cur;
+}
+
+static inline int market_lower(const MergeRun *r, int day) {
+    int lo = 0, hi = r->n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (r->day[mid] < day) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Merge the rows of days [lo_day, hi_day) and hand them to `fn` day by
+// day.  Only runs with rows in the interval get a leaf.  Returns 0, or -1
+// if out of memory.
+static inline int market_merge_interval(const MarketRuns *m, int lo_day, int hi_day,
+                                        MarketDayFn fn, void *state) {
+    int k = m->count;
+    int *mem = (int *)malloc((size_t)(k ? k : 1) * 8 * sizeof(int));
+    if (!mem) return -1;
+    LoserTree t;
+    t.runs = m->runs;
+    t.node = mem;
+    t.leaf_run = mem + k;
+    t.pos = mem + 2 * k;
+    t.end = mem + 3 * k;
+    int *winner = mem + 4 * k;          // 2k, build only
+    int *day_run = mem + 6 * k, *day_row = mem + 7 * k;
+
+    t.k = 0;
+    for (int r = 0; r < k; r++) {
+        int lo = market_lower(&m->runs[r], lo_day), hi = market_lower(&m->runs[r], hi_day);
+        if (lo == hi) continue;
+        t.leaf_run[t.k] = r;
+        t.pos[t.k] = lo;
+        t.end[t.k] = hi;
+        t.k++;
+    }
+    if (t.k == 0) {
+        free(mem);
+        return 0;
+    }
+    loser_build(&t, winner);
+
+    MarketDay d;
+    d.run = day_run;
+    d.row = day_row;
+    d.count = 0;
+    d.day = loser_key(&t, t.node[0]);
+    for (;;) {
+        int leaf = t.node[0];
+        int day = loser_key(&t, leaf);
+        if (day != d.day && d.count > 0) {
+            fn(state, m->runs, &d);
+            d.count = 0;
+        }
+        if (day == INT_MAX)
+            break;
+        d.day = day;
+        day_run[d.count] = t.leaf_run[leaf];
+        day_row[d.count] = t.pos[leaf];
+        d.count++;
+        loser_advance(&t);
+    }
+    free(mem);
+    return 0;
+}
+
+static inline int market_cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Cut the days of the runs into `parts` intervals of about equal rows:
+// bounds[p] .. bounds[p + 1] (exclusive) is interval p.  Some intervals
+// may be empty when a few days hold most rows.  Returns 0 or -1.
+static inline int market_split(const MarketRuns *m, int parts, int *bounds) {
+    int first = INT_MAX, last = INT_MIN;
+    for (int r = 0; r < m->count; r++) {
+        if (m->runs[r].day[0] < first) first = m->runs[r].day[0];
+        if (m->runs[r].day[m->runs[r].n - 1] > last) last = m->runs[r].day[m->runs[r].n - 1];
+    }
+    bounds[0] = first;
+    for (int p = 1; p <= parts; p++) bounds[p] = last + 1;
+    if (parts == 1 || m->count == 0)
+        return 0;
+
+    // every stride-th row of every run, so big runs weigh more
+    long long stride = m->rows / ((long long)parts * MARKET_SAMPLES);
+    if (stride < 1) stride = 1;
+    long long samples = 0;
+    for (int r = 0; r < m->count; r++) samples += (m->runs[r].n + stride - 1) / stride;
+    int *s = (int *)malloc((size_t)samples * sizeof(int));
+    if (!s) return -1;
+    long long n = 0;
+    for (int r = 0; r < m->count; r++)
+        for (long long i = 0; i < m->runs[r].n; i += stride) s[n++] = m->runs[r].day[i];
+    qsort(s, (size_t)n, sizeof(int), market_cmp_int);
+    for (int p = 1; p < parts; p++) {
+        int b = s[n * p / parts];
+        bounds[p] = b > bounds[p - 1] ? b : bounds[p - 1];
+    }
+    free(s);
+    return 0;
+}
+
+// Merge all runs, the intervals dealt to the threads one at a time
+// (`parallel` = 0: one interval on the calling thread).  Thread t feeds
+// the reducer state states[t] (omp_get_max_threads() of them).
+// Returns 0 or -1.
+static inline int market_merge(const MarketRuns *m, int parallel, MarketDayFn fn,
+                               void **states) {
+    int parts = parallel ? omp_get_max_threads() * 4 : 1;
+    int *bounds = (int *)malloc((size_t)(parts + 1) * sizeof(int));
+    if (!bounds || market_split(m, parts, bounds) != 0) {
+        free(bounds);
+        return -1;
+    }
+    int failed = 0;
+    #pragma omp parallel for schedule(dynamic, 1) if (parallel) reduction(+:failed)
+    for (int p = 0; p < parts; p++)
+        if (bounds[p] < bounds[p + 1] &&
+            market_merge_interval(m, bounds[p], bounds[p + 1], fn,
+                                  states[omp_get_thread_num()]) != 0)
+            failed++;
+    free(bounds);
+    return failed ? -1 : 0;
+}
+
+#endif
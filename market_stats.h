@@ -0,0 +1,307 @@
+#ifndef MARKET_STATS_H
+#define MARKET_STATS_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "catalog.h"
+#include "decade_stats.h"
+#include "market_breadth.h"
+#include "market_merge.h"
+#include "year_layout.h"
+
+// Market-wide daily statistics (--market), computed on the merged,
+// time-ordered rows of all files (see market_merge.h) and rolled up by
+// decade like the main report.
+//
+// A ticker's return on day D runs from its previous close to its close
+// on D (the previous row of its file, within the --from/--to range) and
+// is cleaned like the decade returns (daily_return_ok).  Each day with at
+// least one return gives one equal-weight market return, the plain mean
+// of that day's returns; the index compounds them.  The breadth of the
+// same returns (market_breadth.h) is reported alongside.
+//
+// With --years the rows come from the year layout instead: its segments
+// are sorted by (day, ticker), so each day's cross-section is already one
+// contiguous run of rows and one pass over the years in order does the
+// work of the load, the merge and the breadth passes
+// (market_compute_years).
+
+typedef struct {
+    long   days[MAX_DECADES];           // trading days with at least one return
+    long   returns[MAX_DECADES];        // ticker returns those days averaged
+    double sum_ew[MAX_DECADES];         // equal-weight daily returns
+    double sum_ew_sq[MAX_DECADES];
+    double sum_log[MAX_DECADES];        // log growth of the equal-weight index
+    int min_year, max_year;
+    BreadthAcc breadth;
+} MarketAcc;
+
+static inline void market_acc_init(MarketAcc *m) {
+    memset(m, 0, sizeof(*m));
+    m->min_year = 9999;
+    m->max_year = 0;
+    breadth_acc_init(&m->breadth);
+}
+
+static inline void market_acc_merge(MarketAcc *into, const MarketAcc *from) {
+    for (int d = 0; d < MAX_DECADES; d++) {
+        into->days[d]      += from->days[d];
+        into->returns[d]   += from->returns[d];
+        into->sum_ew[d]    += from->sum_ew[d];
+        into->sum_ew_sq[d] += from->sum_ew_sq[d];
+        into->sum_log[d]   += from->sum_log[d];
+    }
+    if (from->min_year < into->min_year) into->min_year = from->min_year;
+    if (from->max_year > into->max_year) into->max_year = from->max_year;
+    breadth_acc_merge(&into->breadth, &from->breadth);
+}
+
+// Reducer state of one thread: its accumulators and room for the returns
+// of one day (one per run)
+typedef struct {
+    MarketAcc acc;
+    double *returns;
+} MarketThread;
+
+// MarketDayFn: one day of the cross-section
+static inline void market_acc_day(void *state, const MergeRun *runs, const MarketDay *d) {
+    MarketThread *s = (MarketThread *)state;
+    MarketAcc *m = &s->acc;
+    int year = day_year(d->day);
+    int decade_index = decade_index_of_year(year);
+    if (decade_index < 0)
+        return;
+
+    double sum = 0.0;
+    int n = 0;
+    for (int j = 0; j < d->count; j++) {
+        const MergeRun *run = &runs[d->run[j]];
+        int i = d->row[j];
+        double r;
+        if (i > 0 && daily_return_ok(run->close[i - 1], run->close[i], &r)) {
+            s->returns[n++] = r;
+            sum += r;
+        }
+    }
+    if (n == 0)
+        return;
+
+    double ew = sum / n;
+    m->days[decade_index]      += 1;
+    m->returns[decade_index]   += n;
+    m->sum_ew[decade_index]    += ew;
+    m->sum_ew_sq[decade_index] += ew * ew;
+    m->sum_log[decade_index]   += log1p(ew);
+    m->breadth.sum_median[decade_index] += breadth_median(s->returns, n);
+    if (year < m->min_year) m->min_year = year;
+    if (year > m->max_year) m->max_year = year;
+}
+
+// What a --market pass read and how long it took
+typedef struct {
+    int runs;
+    long long rows;
+    double bytes;               // CSV bytes parsed to load the runs
+                                // (column bytes read with --years)
+    double load_time, merge_time, breadth_time;
+    int segments;               // year segments read (--years), else 0
+} MarketInfo;
+
+// Load every file of the catalog (through the cache when `cache_dir` is
+// set) and merge them into `out`, in parallel unless `parallel` is 0.
+// Returns 0, or -1 if out of memory.
+static inline int market_compute(MarketAcc *out, MarketInfo *info, const Catalog *c,
+                                 const char *cache_dir, unsigned cache_flags,
+                                 int from_day, int to_day, int parallel) {
+    market_acc_init(out);
+    memset(info, 0, sizeof(*info));
+    double t0 = omp_get_wtime();
+    MarketRuns m;
+    if (market_load(&m, c, cache_dir, cache_flags, from_day, to_day, parallel, &info->bytes) != 0)
+        return -1;
+    info->runs = m.count;
+    info->rows = m.rows;
+    double t1 = omp_get_wtime();
+    info->load_time = t1 - t0;
+
+    int threads = parallel ? omp_get_max_threads() : 1;
+    MarketThread *thr = (MarketThread *)calloc((size_t)threads, sizeof(MarketThread));
+    void **states = (void **)malloc((size_t)threads * sizeof(void *));
+    int err = !thr || !states;
+    for (int t = 0; !err && t < threads; t++) {
+        market_acc_init(&thr[t].acc);
+        thr[t].returns = (double *)malloc((size_t)(m.count ? m.count : 1) * sizeof(double));
+        states[t] = &thr[t];
+        if (!thr[t].returns) err = 1;
+    }
+    if (!err)
+        err = market_merge(&m, parallel, market_acc_day, states) != 0;
+    for (int t = 0; !err && t < threads; t++)
+        market_acc_merge(out, &thr[t].acc);
+    double t2 = omp_get_wtime();
+    info->merge_time = t2 - t1;
+
+    if (!err)
+        err = breadth_compute(&m, &out->breadth, parallel) != 0;
+    info->breadth_time = omp_get_wtime() - t2;
+
+    for (int t = 0; thr && t < threads; t++)
+        free(thr[t].returns);
+    free(thr);
+    free(states);
+    market_runs_free(&m);
+    return err ? -1 : 0;
+}
+
+// The same statistics from the year layout `L`, in one sequential pass
+// over the years the range overlaps.  A ticker's previous close and its
+// new high / low window (BreadthTrack) carry over from one year into the
+// next.  Tickers with fewer than two rows in the range are left out, as
+// market_load leaves out such files.  info->runs counts the tickers used,
+// load_time is the time to find them and merge_time the scan.  Returns 0,
+// or -1 if out of memory or a segment cannot be read.
+static inline int market_compute_years(MarketAcc *out, MarketInfo *info, const YearLayout *L,
+                                       int from_day, int to_day) {
+    market_acc_init(out);
+    memset(info, 0, sizeof(*info));
+    double t0 = omp_get_wtime();
+    const int cap = BREADTH_WINDOW + 1;
+    size_t tickers = (size_t)(L->tickers ? L->tickers : 1);
+    unsigned char *ok = (unsigned char *)malloc(tickers);
+    double *prev = (double *)malloc(tickers * sizeof(double));
+    double *returns = (double *)malloc(tickers * sizeof(double));
+    BreadthTrack *track = (BreadthTrack *)calloc(tickers, sizeof(BreadthTrack));
+    int *rows = (int *)malloc(tickers * 2 * cap * sizeof(int));
+    double *closes = (double *)malloc(tickers * 2 * cap * sizeof(double));
+    int err = !ok || !prev || !returns || !track || !rows || !closes ||
+              year_layout_active(L, from_day, to_day, ok) != 0;
+    for (int t = 0; !err && t < L->tickers; t++) {
+        track[t].hq = rows + (size_t)t * 2 * cap;
+        track[t].lq = track[t].hq + cap;
+        track[t].hc = closes + (size_t)t * 2 * cap;
+        track[t].lc = track[t].hc + cap;
+        info->runs += ok[t];
+    }
+    double t1 = omp_get_wtime();
+    info->load_time = t1 - t0;
+
+    int first, last;
+    year_layout_span(L, from_day, to_day, &first, &last);
+    for (int k = first; !err && k < last; k++) {
+        YearSegment s;
+        if (year_segment_map(&s, L, k) != 0) {
+            err = 1;
+            break;
+        }
+        long long lo, hi;
+        year_segment_range(&s, from_day, to_day, &lo, &hi);
+        const int32_t *day = s.day, *tk = s.ticker;
+        const double *close = s.col[3];
+        int year = s.h->year;
+        int d = decade_index_of_year(year);
+        BreadthAcc *b = &out->breadth;
+
+        // one day at a time
+        for (long long i0 = lo, i1; i0 < hi; i0 = i1) {
+            int n = 0, adv = 0, dec = 0, highs = 0, lows = 0;
+            double sum = 0.0, sum_sq = 0.0;
+            for (i1 = i0; i1 < hi && day[i1] == day[i0]; i1++) {
+                int t = tk[i1];
+                if (!ok[t])
+                    continue;
+                double c = close[i1], r;
+                int seen = track[t].rows > 0;
+                int mark = breadth_track_next(&track[t], c);
+                int valid = seen && daily_return_ok(prev[t], c, &r);
+                prev[t] = c;
+                info->rows++;
+                if (!valid)
+                    continue;
+                returns[n++] = r;
+                sum    += r;
+                sum_sq += r * r;
+                adv    += r > 0.0;
+                dec    += r < 0.0;
+                highs  += (mark & BREADTH_HIGH) != 0;
+                lows   += (mark & BREADTH_LOW) != 0;
+            }
+            if (n == 0 || d < 0)
+                continue;
+
+            double ew = sum / n;
+            out->days[d]      += 1;
+            out->returns[d]   += n;
+            out->sum_ew[d]    += ew;
+            out->sum_ew_sq[d] += ew * ew;
+            out->sum_log[d]   += log1p(ew);
+            if (year < out->min_year) out->min_year = year;
+            if (year > out->max_year) out->max_year = year;
+
+            b->days[d]      += 1;
+            b->advancers[d] += adv;
+            b->decliners[d] += dec;
+            b->highs[d]     += highs;
+            b->lows[d]      += lows;
+            b->sum_mean[d]  += ew;
+            if (n > 1) {
+                double var = sum_sq / n - ew * ew;
+                b->spread_days[d] += 1;
+                b->sum_std[d]     += sqrt(var > 0.0 ? var : 0.0);
+            }
+            b->sum_median[d] += breadth_median(returns, n);
+        }
+        info->bytes += (double)(hi - lo) * (2 * sizeof(int32_t) + sizeof(double));
+        info->segments++;
+        year_segment_unmap(&s);
+    }
+    info->merge_time = omp_get_wtime() - t1;
+
+    free(ok);
+    free(prev);
+    free(returns);
+    free(track);
+    free(rows);
+    free(closes);
+    return err ? -1 : 0;
+}
+
+// Print the market sections; `dash` separates the years of a decade as the
+// decade report they follow does
+static inline void market_print(const MarketAcc *m, const MarketInfo *info, const char *dash) {
+    printf("\nEqual-weight Market by Decade (merged daily cross-section):\n");
+    printf("------------------------------------------------------------\n");
+
+    int first_decade = (m->min_year / 10) * 10;
+    for (int decade_start = first_decade; decade_start <= 2010; decade_start += 10) {
+        int d = (decade_start - MIN_YEAR_GLOBAL) / 10;
+        if (d < 0 || d >= MAX_DECADES || m->days[d] == 0)
+            continue;
+
+        double days = (double)m->days[d];
+        double mean = m->sum_ew[d] / days;
+        double var = m->sum_ew_sq[d] / days - mean * mean;
+        double vol = sqrt(var > 0.0 ? var : 0.0);
+        int decade_end = (decade_start == 2010) ? 2020 : (decade_start + 9);
+
+        printf("Decade %d%s%d:\n", decade_start, dash, decade_end);
+        printf("  Trading days:          %ld\n", m->days[d]);
+        printf("  Tickers per day:       %.1f\n", m->returns[d] / days);
+        printf("  Mean daily return:     %.6f (%.4f%%)\n", mean, mean * 100.0);
+        printf("  Index volatility:      %.4f (%.4f%%)\n", vol, vol * 100.0);
+        printf("  Index change:          %+.2f%%\n\n", expm1(m->sum_log[d]) * 100.0);
+    }
+    breadth_print(&m->breadth, m->min_year, dash);
+    if (info->segments)
+        printf("Market scan: %d tickers, %lld rows from %d year segments (%.1f MB of columns),"
+               " tickers %.6f s, scan %.6f s\n", info->runs, info->rows, info->segments,
+               info->bytes / 1e6, info->load_time, info->merge_time);
+    else
+        printf("Market merge: %d files, %lld rows, load %.6f s, merge %.6f s, breadth %.6f s\n",
+               info->runs, info->rows, info->load_time, info->merge_time, info->breadth_time);
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef MPI_NODE_H
+#define MPI_NODE_H
+
+#include <string.h>
+#include <mpi.h>
+
+// Node topology helpers for the MPI driver.
+//
+// The ranks of a job are grouped per shared-memory node
+// (MPI_COMM_TYPE_SHARED); the lowest rank of each node is its leader and
+// the leaders get a communicator of their own.  World rank 0 is always a
+// leader and rank 0 of the leader communicator.
+//
+// mpi_node_reduce is a two-level reduction on top of that: each rank
+// writes its value into its slot of a small shared window, the leader
+// combines the slots of its node in rank order, the leaders reduce among
+// themselves (the only step that crosses the interconnect) and the
+// result can be broadcast back the same way.  Slots are double-buffered
+// by call parity, so a rank starting the next reduction cannot overwrite
+// values its leader is still reading.
+
+// Bytes per rank and per call of the shared reduction slots; larger
+// values go through MPI_Reduce on the node communicator instead
+#ifndef MPI_NODE_SLOT
+#define MPI_NODE_SLOT 4096
+#endif
+
+typedef struct {
+    MPI_Comm node;              // ranks sharing memory with this one
+    MPI_Comm leaders;           // node leaders (MPI_COMM_NULL elsewhere)
+    int node_rank, node_size;
+    int nodes;                  // number of nodes
+    int node_index;             // 0 .. nodes-1, rank of the leader among the leaders
+    MPI_Win win;                // reduction slots, 2 * MPI_NODE_SLOT per rank
+    unsigned char *slots;       // slot 0 of the node (leader's segment)
+    unsigned calls;
+} MpiNodes;
+
+// Collective over `world`
+static inline void mpi_nodes_init(MpiNodes *t, MPI_Comm world) {
+    int rank;
+    MPI_Comm_rank(world, &rank);
+    MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &t->node);
+    MPI_Comm_rank(t->node, &t->node_rank);
+    MPI_Comm_size(t->node, &t->node_size);
+    MPI_Comm_split(world, t->node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &t->leaders);
+    int counts[2] = { 0, 0 };
+    if (t->leaders != MPI_COMM_NULL) {
+        MPI_Comm_size(t->leaders, &counts[0]);
+        MPI_Comm_rank(t->leaders, &counts[1]);
+    }
+    MPI_Bcast(counts, 2, MPI_INT, 0, t->node);
+    t->nodes = counts[0];
+    t->node_index = counts[1];
+
+    // one contiguous segment (all slots of the node) owned by the leader
+    MPI_Aint bytes = t->node_rank == 0 ? (MPI_Aint)t->node_size * 2 * MPI_NODE_SLOT : 0;
+    MPI_Win_allocate_shared(bytes, 1, MPI_INFO_NULL, t->node, &t->slots, &t->win);
+    MPI_Aint size;
+    int unit;
+    MPI_Win_shared_query(t->win, 0, &size, &unit, &t->slots);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, t->win);
+    t->calls = 0;
+}
+
+static inline void mpi_nodes_free(MpiNodes *t) {
+    MPI_Win_unlock_all(t->win);
+    MPI_Win_free(&t->win);
+    if (t->leaders != MPI_COMM_NULL) MPI_Comm_free(&t->leaders);
+    MPI_Comm_free(&t->node);
+}
+
+static inline unsigned char *mpi_node_slot(const MpiNodes *t, int node_rank) {
+    return t->slots + ((size_t)node_rank * 2 + (t->calls & 1)) * MPI_NODE_SLOT;
+}
+
+// Reduce `count` elements of `type` with `op` from every rank into `out`
+// on world rank 0, or on every rank if `bcast` is set.  Collective over
+// the communicator the topology was built from.  Inside a node the values
+// are combined in rank order; across nodes the order is MPI's, so `op`
+// should be commutative.
+static inline void mpi_node_reduce(MpiNodes *t, const void *in, void *out, int count,
+                                   MPI_Datatype type, MPI_Op op, int bcast) {
+    int elem;
+    MPI_Type_size(type, &elem);
+    size_t bytes = (size_t)count * elem;
+
+    // 1) inside the node, through the shared slots
+    if (bytes <= MPI_NODE_SLOT) {
+        memcpy(mpi_node_slot(t, t->node_rank), in, bytes);
+        MPI_Win_sync(t->win);
+        MPI_Barrier(t->node);
+        MPI_Win_sync(t->win);
+        if (t->node_rank == 0) {
+            memcpy(out, mpi_node_slot(t, 0), bytes);
+            for (int r = 1; r < t->node_size; r++)
+                MPI_Reduce_local(mpi_node_slot(t, r), out, count, type, op);
+        }
+    } else {
+        MPI_Reduce(in, out, count, type, op, 0, t->node);
+    }
+
+    // 2) among the node leaders
+    if (t->leaders != MPI_COMM_NULL && t->nodes > 1) {
+        int lrank;
+        MPI_Comm_rank(t->leaders, &lrank);
+        MPI_Reduce(lrank == 0 ? MPI_IN_PLACE : out, out, count, type, op, 0, t->leaders);
+        if (bcast)
+            MPI_Bcast(out, count, type, 0, t->leaders);
+    }
+
+    // 3) optionally back to every rank of the node
+    if (bcast) {
+        if (bytes <= MPI_NODE_SLOT) {
+            if (t->node_rank == 0)
+                memcpy(mpi_node_slot(t, 0), out, bytes);
+            MPI_Win_sync(t->win);
+            MPI_Barrier(t->node);
+            MPI_Win_sync(t->win);
+            if (t->node_rank != 0)
+                memcpy(out, mpi_node_slot(t, 0), bytes);
+        } else {
+            MPI_Bcast(out, count, type, 0, t->node);
+        }
+    }
+    t->calls++;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// Bounded multi-producer multi-consumer ring of pointers (D. Vyukov's
+// sequence-numbered design), for handing parsed batches between the
+// reader and compute stages of the OpenMP driver.
+//
+// Every slot carries a sequence number: slot i is free for the producer
+// holding ticket t when seq == t, and full for the consumer holding
+// ticket t when seq == t + 1.  A producer claims a ticket with one CAS on
+// `head`, a consumer with one CAS on `tail`; they meet only on the slot
+// itself, so there is no lock and no shared counter between the two
+// sides.  head, tail, the wait words and every slot sit on their own
+// cache line.
+//
+// Blocking calls spin on the try-calls briefly and then sleep on a futex
+// (one for "not empty", one for "not full").  Waking costs a syscall only
+// when somebody is asleep and not already being woken: the other side
+// checks the sleeper count after a full fence (a sleeper raises it before
+// its final retry).
+
+#define MPMC_LINE 64
+#ifndef MPMC_SPINS
+#define MPMC_SPINS 256
+#endif
+
+typedef struct {
+    size_t seq;
+    void *item;
+    char pad[MPMC_LINE - sizeof(size_t) - sizeof(void *)];
+} MpmcSlot;
+
+// wait word of one side: futex event counter, and sleepers << 32 | wakes
+// sent to them that have not been picked up yet
+typedef struct {
+    uint32_t event;
+    uint64_t state;
+    char pad[MPMC_LINE - 2 * sizeof(uint64_t)];
+} MpmcWait;
+
+typedef struct {
+    size_t head;                        // next ticket to push
+    char pad0[MPMC_LINE - sizeof(size_t)];
+    size_t tail;                        // next ticket to pop
+    char pad1[MPMC_LINE - sizeof(size_t)];
+    MpmcWait not_empty;
+    MpmcWait not_full;
+    MpmcSlot *slots;
+    size_t mask;
+} MpmcRing;
+
+// Ring of at least `capacity` slots (rounded up to a power of two).
+// Returns 0, or -1 if out of memory.
+static inline int mpmc_init(MpmcRing *r, size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) cap *= 2;
+    memset(r, 0, sizeof(*r));
+    if (posix_memalign((void **)&r->slots, MPMC_LINE, cap * sizeof(MpmcSlot)) != 0)
+        return -1;
+    for (size_t i = 0; i < cap; i++) {
+        r->slots[i].seq = i;
+        r->slots[i].item = NULL;
+    }
+    r->mask = cap - 1;
+    return 0;
+}
+
+static inline void mpmc_free(MpmcRing *r) {
+    free(r->slots);
+    r->slots = NULL;
+}
+
+// Returns 0 if `item` was added, -1 if the ring is full
+static inline int mpmc_try_push(MpmcRing *r, void *item) {
+    size_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    MpmcSlot *s;
+    for (;;) {
+        s = &r->slots[pos & r->mask];
+        size_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    s->item = item;
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Returns 0 and sets *item, or -1 if the ring is empty
+static inline int mpmc_try_pop(MpmcRing *r, void **item) {
+    size_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    MpmcSlot *s;
+    for (;;) {
+        s = &r->slots[pos & r->mask];
+        size_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+    *item = s->item;
+    __atomic_store_n(&s->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#define MPMC_SLEEPER ((uint64_t)1 << 32)
+
+// Leave the sleepers of `w` (after a retry succeeded or a futex return),
+// consuming one wake in flight if there is any
+static inline void mpmc_wait_leave(MpmcWait *w) {
+    uint64_t st = __atomic_load_n(&w->state, __ATOMIC_RELAXED), next;
+    do {
+        uint64_t sleepers = (st >> 32) - 1, woken = (uint32_t)st;
+        if (woken > 0) woken--;
+        if (woken > sleepers) woken = sleepers;
+        next = sleepers << 32 | woken;
+    } while (!__atomic_compare_exchange_n(&w->state, &st, next, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+}
+
+// Wake one sleeper of `w` unless every sleeper already has a wake on the
+// way, so a burst of pushes (pops) that finds a consumer (producer)
+// asleep costs one syscall, not one per item
+static inline void mpmc_wake(MpmcWait *w) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t st = __atomic_load_n(&w->state, __ATOMIC_RELAXED);
+    while ((st >> 32) > (uint32_t)st) {
+        if (__atomic_compare_exchange_n(&w->state, &st, st + 1, 1,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&w->event, 1, __ATOMIC_SEQ_CST);
+            syscall(SYS_futex, &w->event, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+            return;
+        }
+    }
+}
+
+// Announce a sleeper on `w`; returns the event to sleep on.  The caller
+// retries once more before mpmc_sleep, so a wake cannot slip in between.
+static inline uint32_t mpmc_wait_begin(MpmcWait *w) {
+    uint32_t ev = __atomic_load_n(&w->event, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&w->state, MPMC_SLEEPER, __ATOMIC_SEQ_CST);
+    return ev;
+}
+
+// Sleep until `w` moves past `ev` (returns at once if it already has)
+static inline void mpmc_sleep(MpmcWait *w, uint32_t ev) {
+    syscall(SYS_futex, &w->event, FUTEX_WAIT_PRIVATE, ev, NULL, NULL, 0);
+    mpmc_wait_leave(w);
+}
+
+// Add `item`, sleeping while the ring is full
+static inline void mpmc_push(MpmcRing *r, void *item) {
+    for (int spin = 0; mpmc_try_push(r, item) != 0; spin++) {
+        if (spin < MPMC_SPINS) continue;
+        uint32_t ev = mpmc_wait_begin(&r->not_full);
+        if (mpmc_try_push(r, item) == 0) {
+            mpmc_wait_leave(&r->not_full);
+            break;
+        }
+        mpmc_sleep(&r->not_full, ev);
+    }
+    mpmc_wake(&r->not_empty);
+}
+
+// Take the oldest item, sleeping while the ring is empty
+static inline void *mpmc_pop(MpmcRing *r) {
+    void *item;
+    for (int spin = 0; mpmc_try_pop(r, &item) != 0; spin++) {
+        if (spin < MPMC_SPINS) continue;
+        uint32_t ev = mpmc_wait_begin(&r->not_empty);
+        if (mpmc_try_pop(r, &item) == 0) {
+            mpmc_wait_leave(&r->not_empty);
+            break;
+        }
+        mpmc_sleep(&r->not_empty, ev);
+    }
+    mpmc_wake(&r->not_full);
+    return item;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef NUMA_SCHED_H
+#define NUMA_SCHED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <omp.h>
+
+// NUMA helpers for the OpenMP driver (Linux, no libnuma needed):
+//   - node topology read from /sys/devices/system/node
+//   - thread pinning that spreads workers over the nodes, unless the user
+//     already asked the OpenMP runtime to bind (OMP_PROC_BIND / OMP_PLACES)
+//   - one work queue of files per node, with stealing when a node runs dry
+
+#define NUMA_MAX_CPUS  1024
+#define NUMA_MAX_NODES 64
+
+typedef struct {
+    int num_nodes;
+    short cpu_node[NUMA_MAX_CPUS];      // node of each cpu, -1 if unknown
+    int node_cpus[NUMA_MAX_NODES];      // usable cpus per node
+    short node_cpu_list[NUMA_MAX_NODES][NUMA_MAX_CPUS];
+} NumaTopology;
+
+// Parse a kernel cpulist such as "0-15,32-47" and tag those cpus with `node`
+static inline void numa_parse_cpulist(NumaTopology *t, const char *list, int node) {
+    const char *p = list;
+    while (*p && *p != '\n') {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p) break;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        for (long c = lo; c <= hi && c < NUMA_MAX_CPUS; c++)
+            if (c >= 0) t->cpu_node[c] = (short)node;
+        p = (*end == ',') ? end + 1 : end;
+    }
+}
+
+// Build the cpu -> node map, restricted to the cpus this process may use.
+// Machines without /sys/devices/system/node are treated as a single node.
+static inline void numa_topology_load(NumaTopology *t) {
+    memset(t, 0, sizeof(*t));
+    for (int c = 0; c < NUMA_MAX_CPUS; c++) t->cpu_node[c] = -1;
+
+    int max_node = -1;
+    for (int node = 0; node < NUMA_MAX_NODES; node++) {
+        char path[96], buf[4096];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        if (fgets(buf, sizeof(buf), f)) {
+            numa_parse_cpulist(t, buf, node);
+            max_node = node;
+        }
+        fclose(f);
+    }
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        for (int c = 0; c < CPU_SETSIZE; c++) CPU_SET(c, &allowed);
+
+    if (max_node < 0) {
+        // no NUMA information: everything is node 0
+        max_node = 0;
+        for (int c = 0; c < NUMA_MAX_CPUS; c++) t->cpu_node[c] = 0;
+    }
+    t->num_nodes = max_node + 1;
+
+    for (int c = 0; c < NUMA_MAX_CPUS && c < CPU_SETSIZE; c++) {
+        int node = t->cpu_node[c];
+        if (node < 0 || !CPU_ISSET(c, &allowed)) continue;
+        t->node_cpu_list[node][t->node_cpus[node]++] = (short)c;
+    }
+}
+
+// True when the user configured binding through the OpenMP runtime;
+// in that case we leave placement to the runtime.
+static inline int numa_runtime_binds(void) {
+    return getenv("OMP_PROC_BIND") != NULL ||
+           getenv("OMP_PLACES") != NULL ||
+           omp_get_proc_bind() != omp_proc_bind_false;
+}
+
+// Node the calling thread is running on right now
+static inline int numa_current_node(const NumaTopology *t) {
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= NUMA_MAX_CPUS || t->cpu_node[cpu] < 0)
+        return 0;
+    return t->cpu_node[cpu];
+}
+
+// Pin the calling OpenMP thread with a "spread" policy: consecutive thread
+// ids go to different nodes, then to different cpus inside each node.
+// Must be called from inside the parallel region.  Returns the thread node.
+static inline int numa_pin_thread(const NumaTopology *t, int pin) {
+    if (pin) {
+        int tid = omp_get_thread_num();
+
+        // only nodes that own usable cpus take part in the spread
+        int usable[NUMA_MAX_NODES], n_usable = 0;
+        for (int n = 0; n < t->num_nodes; n++)
+            if (t->node_cpus[n] > 0) usable[n_usable++] = n;
+
+        if (n_usable > 0) {
+            int node = usable[tid % n_usable];
+            int slot = (tid / n_usable) % t->node_cpus[node];
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(t->node_cpu_list[node][slot], &set);
+            sched_setaffinity(0, sizeof(set), &set);   // 0 = calling thread
+        }
+    }
+    return numa_current_node(t);
+}
+
+
+// One queue of file indices per node.  Files are dealt round-robin, so
+// each node gets a similar share; a thread first drains its own node's
+// queue and then steals from the others.
+typedef struct {
+    int *items;
+    int count;
+    _Alignas(64) int next;          // cursor, alone on its cache line
+} NodeQueue;
+
+typedef struct {
+    int num_nodes;
+    NodeQueue *queues;
+    int *storage;
+} NodeQueues;
+
+static inline int node_queues_init(NodeQueues *qs, int num_nodes, int item_count) {
+    if (num_nodes < 1) num_nodes = 1;
+    qs->num_nodes = num_nodes;
+    qs->queues  = (NodeQueue *)aligned_alloc(64, sizeof(NodeQueue) * num_nodes);
+    qs->storage = (int *)malloc(sizeof(int) * (item_count > 0 ? item_count : 1));
+    if (!qs->queues || !qs->storage) {
+        free(qs->queues);
+        free(qs->storage);
+        return -1;
+    }
+
+    // queue n owns items n, n + num_nodes, n + 2*num_nodes, ...
+    int pos = 0;
+    for (int n = 0; n < num_nodes; n++) {
+        NodeQueue *q = &qs->queues[n];
+        q->next  = 0;
+        q->count = 0;
+        q->items = qs->storage + pos;
+        for (int i = n; i < item_count; i += num_nodes)
+            q->items[q->count++] = i;
+        pos += q->count;
+    }
+    return 0;
+}
+
+// Next item for a thread on `node`, or -1 when every queue is empty
+static inline int node_queues_next(NodeQueues *qs, int node) {
+    for (int k = 0; k < qs->num_nodes; k++) {
+        NodeQueue *q = &qs->queues[(node + k) % qs->num_nodes];
+        int slot;
+        #pragma omp atomic capture
+        slot = q->next++;
+        if (slot < q->count)
+            return q->items[slot];
+    }
+    return -1;
+}
+
+static inline void node_queues_free(NodeQueues *qs) {
+    free(qs->queues);
+    free(qs->storage);
+}
+
+#endif
@@ -1,318 +1,645 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include <omp.h>
-#include <dirent.h>
 
-#define MAX_LINE_LEN 256
+#include "arena.h"
+#include "autotune.h"
+#include "catalog.h"
+#include "decade_stats.h"
+#include "manifest.h"
+#include "market_stats.h"
+#include "mpmc_ring.h"
+#include "numa_sched.h"
+#include "perf_counters.h"
+#include "stock_cache.h"
+#include "stock_loader.h"
+#include "stock_options.h"
+#include "year_layout.h"
+
+// How every file of a run is read and analysed
+typedef struct {
+    const char *cache_dir;      // binary column cache (NULL = read the CSVs)
+    unsigned cache_flags;
+    LoadSpec spec;
+    unsigned metrics;
+    int chunk_rows;             // > 0: stream in chunks of this many rows
+    long long split_bytes;      // plain CSVs this large are split into tasks
+} ScanPlan;
+
+// Read catalog entry i and add its rows to the thread's accumulators;
+// only the columns the requested metrics need, and only the rows of the
+// requested date range, are parsed.  With a cache directory the rows come
+// from the mapped binary cache instead (built from the CSV on a miss).
+// With `chunk_rows` set the file is streamed (--mem-budget); otherwise
+// large plain CSVs are split into tasks that idle threads help with.
+// Returns the number of CSV bytes parsed.
+static size_t process_file(const Catalog *catalog, int i, const ScanPlan *plan,
+                           NodeArena *arena, DecadeAcc *acc) {
+    const LoadSpec *spec = &plan->spec;
+    if (plan->cache_dir) {
+        CacheView view;
+        if (stock_cache_load(&view, plan->cache_dir, catalog, i, arena, plan->cache_flags) == 0) {
+            size_t bytes = view.text_bytes;
+            decade_acc_add_cached(acc, &view, plan->metrics, spec->from_day, spec->to_day);
+            stock_cache_close(&view);
+            return bytes;
+        }
+    }
+
+    if (plan->chunk_rows > 0)
+        return decade_acc_add_streamed(acc, catalog_path(catalog, i), arena, spec,
+                                       plan->metrics, plan->chunk_rows, NULL);
+
+    if (catalog->entries[i].size >= plan->split_bytes) {
+        long long bytes = decade_acc_add_tasks(acc, catalog_path(catalog, i), spec,
+                                               plan->metrics);
+        if (bytes >= 0)
+            return (size_t)bytes;
+    }
+
+    return decade_acc_add_file(acc, catalog_path(catalog, i), arena, spec, plan->metrics);
+}
 
-// Logical price bounds used to clean unrealistic stock prices
-#define MIN_PRICE 0.01
-#define MAX_PRICE 10000.0
+// --pipeline: one parsed file on its way from a reader to a compute thread
+typedef struct {
+    int file;                   // catalog index
+    int rows;                   // rows read
+    StockSeries data;
+    NodeArena arena;            // owns the rows; reused for the next file
+} FileBatch;
 
-// Allowed year range for safety (maps years to decade indices)
-#define MIN_YEAR_GLOBAL 1900
-#define MAX_YEAR_GLOBAL 2100
-#define MAX_DECADES (((MAX_YEAR_GLOBAL - MIN_YEAR_GLOBAL) / 10) + 1)
+// Parsed files in flight per compute thread (one analysed, one queued)
+#define PIPELINE_DEPTH 2
 
-// Structure representing **one daily record** of stock data
-// date, OHLC (open, high, low, close), and volume
 typedef struct {
-    char date[20];
-    double open, high, low, close, volume;
-} StockData;
-
-// Safe strdup implementation (for portability)
-// Some compilers or environments may not provide strdup by default.
-// This function allocates a new string and copies the content of `s`.
-static char *my_strdup(const char *s) {
-    size_t len = strlen(s) + 1;
-    char *p = (char *)malloc(len);
-    if (p) memcpy(p, s, len);
-    return p;
+    MpmcRing full;              // parsed batches, NULL = no more files
+    MpmcRing empty;             // batches free for the readers
+    FileBatch *batches;
+    int n_batches;
+    int readers;
+    int next_file;              // next catalog entry to read
+    int readers_left;
+} Pipeline;
+
+static int pipeline_init(Pipeline *p, int readers, int threads) {
+    int compute = threads - readers;
+    p->n_batches = PIPELINE_DEPTH * compute;
+    p->readers = readers;
+    p->next_file = 0;
+    p->readers_left = readers;
+    p->batches = (FileBatch *)calloc(p->n_batches, sizeof(FileBatch));
+    if (!p->batches || mpmc_init(&p->full, p->n_batches + compute) != 0 ||
+        mpmc_init(&p->empty, p->n_batches) != 0) {
+        free(p->batches);
+        return -1;
+    }
+    for (int b = 0; b < p->n_batches; b++) {
+        arena_init(&p->batches[b].arena, -1);
+        mpmc_push(&p->empty, &p->batches[b]);
+    }
+    return 0;
 }
 
+static void pipeline_free(Pipeline *p) {
+    for (int b = 0; b < p->n_batches; b++)
+        arena_release(&p->batches[b].arena);
+    free(p->batches);
+    mpmc_free(&p->full);
+    mpmc_free(&p->empty);
+}
 
-int read_csv(const char *filename, StockData **data_out) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Cannot open file: %s\n", filename);
-        *data_out = NULL;
+// Body of one thread of the parallel region.  The first `readers` threads
+// read and parse files, largest first, into free batches and push them to
+// the full ring; the others pop them, add them to their accumulators and
+// hand the batch back.  A batch is only ever touched by the thread that
+// popped it, so the two rings are all the stages share.  The last reader
+// to run out of files pushes one NULL per compute thread.  Returns the
+// CSV bytes analysed by the calling thread.
+static size_t pipeline_work(Pipeline *p, const Catalog *catalog, const ScanPlan *plan,
+                            DecadeAcc *acc) {
+    size_t bytes = 0;
+    if (omp_get_thread_num() < p->readers) {
+        int f;
+        while ((f = __atomic_fetch_add(&p->next_file, 1, __ATOMIC_RELAXED)) < catalog->count) {
+            FileBatch *b = (FileBatch *)mpmc_pop(&p->empty);
+            b->file = f;
+            b->rows = read_csv(catalog_path(catalog, f), &b->data, &b->arena, &plan->spec);
+            mpmc_push(&p->full, b);
+        }
+        if (__atomic_sub_fetch(&p->readers_left, 1, __ATOMIC_ACQ_REL) == 0)
+            for (int c = p->readers; c < omp_get_num_threads(); c++)
+                mpmc_push(&p->full, NULL);
         return 0;
     }
 
-    char line[MAX_LINE_LEN];
-    int count = 0, capacity = 0;
-    StockData *data = NULL;
-
-    // Skip header line
-    fgets(line, sizeof(line), file);
-
-    // Read each subsequent line and parse fields
-    while (fgets(line, sizeof(line), file)) {
-        // Grow array if needed
-        if (count >= capacity) {
-            int new_cap = (capacity == 0) ? 1024 : capacity * 2;
-            StockData *tmp = realloc(data, new_cap * sizeof(StockData));
-            if (!tmp) {
-                fprintf(stderr, "Memory allocation failed in read_csv\n");
-                free(data);
-                fclose(file);
-                *data_out = NULL;
-                return 0;
+    FileBatch *b;
+    while ((b = (FileBatch *)mpmc_pop(&p->full)) != NULL) {
+        if (b->rows > 1)
+            decade_acc_add_series(acc, &b->data, plan->metrics);
+        bytes += b->data.text_bytes;
+        mpmc_push(&p->empty, b);
+    }
+    return bytes;
+}
+
+// --ring-bench[=P,C]: stress and throughput check of the ring above.  P
+// producers push RING_BENCH_ITEMS tagged items each through a small ring
+// to C consumers, which check that each producer's items arrive in order
+// and exactly once.  The same traffic then goes through the ring behind
+// a mutex and two condition variables, i.e. a classic locked queue, for
+// comparison.
+#define RING_BENCH_ITEMS (1 << 21)
+#define RING_BENCH_SLOTS 64
+
+typedef struct {
+    MpmcRing ring;
+    int locked;                 // go through the mutex instead
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} BenchQueue;
+
+static void bench_push(BenchQueue *q, void *item) {
+    if (!q->locked) {
+        mpmc_push(&q->ring, item);
+        return;
+    }
+    pthread_mutex_lock(&q->lock);
+    while (mpmc_try_push(&q->ring, item) != 0)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *bench_pop(BenchQueue *q) {
+    if (!q->locked)
+        return mpmc_pop(&q->ring);
+    void *item;
+    pthread_mutex_lock(&q->lock);
+    while (mpmc_try_pop(&q->ring, &item) != 0)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+// Items per second of one run; adds the problems found to *errors
+static double ring_bench_run(int producers, int consumers, int locked, long long *errors) {
+    long long total = (long long)producers * RING_BENCH_ITEMS;
+    unsigned char *seen = (unsigned char *)calloc((size_t)(total + 7) / 8, 1);
+    BenchQueue q;
+    if (!seen || mpmc_init(&q.ring, RING_BENCH_SLOTS) != 0) {
+        free(seen);
+        (*errors)++;
+        return 0.0;
+    }
+    q.locked = locked;
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.not_empty, NULL);
+    pthread_cond_init(&q.not_full, NULL);
+    int producers_left = producers;
+    long long popped = 0, bad = 0;
+
+    double t0 = omp_get_wtime();
+    #pragma omp parallel num_threads(producers + consumers) reduction(+:popped, bad)
+    {
+        int id = omp_get_thread_num();
+        if (omp_get_num_threads() != producers + consumers) {
+            bad++;
+        } else if (id < producers) {
+            // item = producer * RING_BENCH_ITEMS + k + 1 (NULL stops a consumer)
+            for (long long k = 0; k < RING_BENCH_ITEMS; k++)
+                bench_push(&q, (void *)(uintptr_t)((long long)id * RING_BENCH_ITEMS + k + 1));
+            if (__atomic_sub_fetch(&producers_left, 1, __ATOMIC_ACQ_REL) == 0)
+                for (int c = 0; c < consumers; c++)
+                    bench_push(&q, NULL);
+        } else {
+            long long *last = (long long *)malloc(producers * sizeof(long long));
+            if (!last) bad++;
+            for (int p = 0; last && p < producers; p++) last[p] = -1;
+            void *item;
+            while ((item = bench_pop(&q)) != NULL) {
+                long long v = (long long)(uintptr_t)item - 1;
+                int p = (int)(v / RING_BENCH_ITEMS);
+                long long k = v % RING_BENCH_ITEMS;
+                if (p < 0 || p >= producers) { bad++; continue; }
+                if (last && k <= last[p]) bad++;            // out of order
+                if (last) last[p] = k;
+                if (__atomic_fetch_or(&seen[v >> 3], 1 << (v & 7), __ATOMIC_RELAXED) & (1 << (v & 7)))
+                    bad++;                                  // delivered twice
+                popped++;
             }
-            data = tmp;
-            capacity = new_cap;
+            free(last);
         }
+    }
+    double t = omp_get_wtime() - t0;
+
+    if (popped != total) bad++;                             // lost items
+    *errors += bad;
+    pthread_mutex_destroy(&q.lock);
+    pthread_cond_destroy(&q.not_empty);
+    pthread_cond_destroy(&q.not_full);
+    mpmc_free(&q.ring);
+    free(seen);
+    return t > 0.0 ? total / t : 0.0;
+}
+
+static int ring_bench(const char *arg) {
+    int half = omp_get_num_procs() / 2;
+    int producers = half > 0 ? half : 1, consumers = producers;
+    if (arg && (sscanf(arg, "%d,%d", &producers, &consumers) != 2 ||
+                producers < 1 || consumers < 1)) {
+        fprintf(stderr, "Bad ring bench threads: %s (expected PRODUCERS,CONSUMERS)\n", arg);
+        return 1;
+    }
+    omp_set_dynamic(0);
+    printf("Ring bench: %d producers, %d consumers, %d slots, %lld items\n",
+           producers, consumers, RING_BENCH_SLOTS, (long long)producers * RING_BENCH_ITEMS);
+    long long errors = 0;
+    double lockfree = ring_bench_run(producers, consumers, 0, &errors);
+    long long lockfree_errors = errors;
+    double locked = ring_bench_run(producers, consumers, 1, &errors);
+    printf("  Lock-free ring:        %.2f M items/s (%s)\n", lockfree / 1e6,
+           lockfree_errors ? "FAILED" : "ok");
+    printf("  Mutex queue:           %.2f M items/s (%s)\n", locked / 1e6,
+           errors > lockfree_errors ? "FAILED" : "ok");
+    return errors ? 1 : 0;
+}
+
+// Seconds for one pass over the sample files with `threads` threads and
+// the current runtime schedule (results are discarded)
+static double tune_trial(const Catalog *catalog, const int *sample, int n,
+                         const ScanPlan *plan, int threads) {
+    double t0 = omp_get_wtime();
+    #pragma omp parallel num_threads(threads)
+    {
+        DecadeAcc acc;
+        decade_acc_init(&acc);
+        NodeArena arena;
+        arena_init(&arena, -1);
+        #pragma omp for schedule(runtime)
+        for (int k = 0; k < n; k++)
+            process_file(catalog, sample[k], plan, &arena, &acc);
+        arena_release(&arena);
+    }
+    return omp_get_wtime() - t0;
+}
+
+// --autotune: reuse the stored profile of this dataset and host, or
+// measure one on a sample of the files (see autotune.h) and store it.
+// Returns 1 if the profile was reused, 0 if measured, -1 on failure.
+static int autotune(const Catalog *catalog, const StockOptions *opts, ScanPlan *plan,
+                    TuneProfile *prof) {
+    // hashed as raw bytes: zero the padding before budget first
+    struct { unsigned metrics; int from, to; unsigned cache_flags; int cached; size_t budget; }
+        work;
+    memset(&work, 0, sizeof(work));
+    work.metrics = opts->metrics;
+    work.from = opts->from_day;
+    work.to = opts->to_day;
+    work.cache_flags = opts->cache_flags;
+    work.cached = opts->cache_dir != NULL;
+    work.budget = opts->mem_budget;
+    uint64_t fp = autotune_fingerprint(catalog, &work, sizeof(work));
+    char host[AUTOTUNE_HOST_MAX], path[4096];
+    autotune_host(host, sizeof(host));
+    autotune_path(opts->autotune_file, path, sizeof(path));
+    if (autotune_load(path, fp, host, prof) == 0)
+        return 1;
+
+    int *sample = (int *)malloc(catalog->count * sizeof(int));
+    if (!sample) return -1;
+    int n = autotune_sample(catalog, sample);
+    long long sample_bytes = 0, total = 0, largest = catalog->entries[0].size;
+    for (int k = 0; k < n; k++) sample_bytes += catalog->entries[sample[k]].size;
+    for (int i = 0; i < catalog->count; i++) total += catalog->entries[i].size;
+
+    // I/O rate first (this also brings the sample into the page cache),
+    // then the compute rate of one thread; cache files are built first
+    prof->io_rate = autotune_read_rate(catalog, sample, n);
+    omp_set_schedule(omp_sched_dynamic, 1);
+    if (plan->cache_dir)
+        tune_trial(catalog, sample, n, plan, 1);
+    double t1 = tune_trial(catalog, sample, n, plan, 1);
+    prof->compute_rate = t1 > 0.0 ? sample_bytes / t1 : 0.0;
+
+    // threads beyond what the reads can feed only add contention
+    int procs = omp_get_num_procs();
+    int max_threads = procs;
+    if (prof->io_rate > 0.0 && prof->compute_rate > 0.0) {
+        int feed = (int)(prof->io_rate / prof->compute_rate) + 1;
+        if (feed < max_threads) max_threads = feed;
+    }
 
-        double adj_temp;
-        int parsed = sscanf(
-            line,
-            "%19[^,],%lf,%lf,%lf,%lf,%lf,%lf",
-            data[count].date,
-            &data[count].open,
-            &data[count].high,
-            &data[count].low,
-            &data[count].close,
-            &adj_temp,
-            &data[count].volume
-        );
-
-        // Only accept fully parsed lines
-        if (parsed == 7) {
-            count++;
+    // a file bigger than a thread's share is split so others can help
+    prof->split_bytes = DECADE_TASK_MIN_BYTES;
+    if (largest > total / max_threads) {
+        long long share = total / (4LL * max_threads);
+        prof->split_bytes = share > 2LL * DECADE_TASK_BYTES ? share : 2LL * DECADE_TASK_BYTES;
+        if (prof->split_bytes > DECADE_TASK_MIN_BYTES) prof->split_bytes = DECADE_TASK_MIN_BYTES;
+    }
+    plan->split_bytes = prof->split_bytes;
+
+    // thread count with dynamic,1 (largest-first order), then schedules
+    prof->threads = 1;
+    double best = t1;
+    for (int t = max_threads; t > 1; t /= 2) {
+        double tt = tune_trial(catalog, sample, n, plan, t);
+        if (tt < best) { best = tt; prof->threads = t; }
+    }
+    prof->schedule = omp_sched_dynamic;
+    prof->chunk = 1;
+    if (prof->threads > 1) {
+        int many = n / (prof->threads * 8);
+        struct { omp_sched_t kind; int chunk; } cand[] = {
+            { omp_sched_static, 0 }, { omp_sched_guided, 1 },
+            { omp_sched_dynamic, many > 1 ? many : 0 },
+        };
+        for (size_t c = 0; c < sizeof(cand) / sizeof(cand[0]); c++) {
+            if (cand[c].chunk == 0 && cand[c].kind == omp_sched_dynamic) continue;
+            omp_set_schedule(cand[c].kind, cand[c].chunk);
+            double tt = tune_trial(catalog, sample, n, plan, prof->threads);
+            if (tt < best) { best = tt; prof->schedule = cand[c].kind; prof->chunk = cand[c].chunk; }
         }
     }
+    free(sample);
 
-    fclose(file);
-    *data_out = data;
-    return count;
+    if (autotune_save(path, fp, host, prof) != 0)
+        fprintf(stderr, "Cannot store the autotune profile in %s\n", path);
+    return 0;
 }
 
 
 int main(int argc, char *argv[]) {
 
-    if (argc != 2) {
-        printf("Usage: %s <stocks_directory>\n", argv[0]);
+    if (argc == 2 && strncmp(argv[1], "--ring-bench", 12) == 0 &&
+        (argv[1][12] == '\0' || argv[1][12] == '='))
+        return ring_bench(argv[1][12] ? argv[1] + 13 : NULL);
+
+    StockOptions opts;
+    if (parse_options(argc, argv, &opts) != 0) {
+        printf("Usage: %s " STOCK_OPTIONS_USAGE "\n", argv[0]);
         return 1;
     }
 
-    const char *dirpath = argv[1];
+    const char *dirpath = opts.dirpath;
+    if (opts.validate) {
+        fprintf(stderr, "--validate is only supported by the serial version\n");
+        return 1;
+    }
 
-    // Open the directory containing CSV files
-    DIR *dir = opendir(dirpath);
-    if (!dir) {
+    // Build the file manifest: getdents64 listing, one path arena,
+    // parallel stat, largest files first for the scheduler
+    // (or map it from the --manifest file, already in that order, or from
+    // the manifest a --build-cache run left in the cache)
+    char cache_manifest[4096];
+    int manifest_check = MANIFEST_CHECK_DIRS;
+    if (!opts.manifest && opts.cache_dir && !opts.build_cache &&
+        stock_cache_manifest(cache_manifest, sizeof(cache_manifest), opts.cache_dir) == 0 &&
+        access(cache_manifest, F_OK) == 0) {
+        opts.manifest = cache_manifest;
+        manifest_check = MANIFEST_CHECK_FILES;
+    }
+    Catalog catalog;
+    int manifest_built = 0;
+    if ((opts.manifest ? manifest_catalog(&catalog, dirpath, opts.manifest, opts.recursive,
+                                          manifest_check, 1, &manifest_built)
+                       : catalog_build(&catalog, dirpath, opts.recursive, 1)) != 0) {
         fprintf(stderr, "Cannot open directory: %s\n", dirpath);
         return 1;
     }
+    catalog_sort_by_size(&catalog);
+    if (opts.cache_dir && stock_cache_prepare(opts.cache_dir) != 0)
+        opts.cache_dir = NULL;
+
+    // --build-cache: threads convert the files largest first, then the
+    // listing is left in the cache
+    if (opts.build_cache) {
+        if (!opts.cache_dir || stock_cache_manifest(cache_manifest, sizeof(cache_manifest),
+                                                    opts.cache_dir) != 0) {
+            catalog_free(&catalog);
+            return 1;
+        }
+        stock_cache_clean(opts.cache_dir);
+        CacheBuildStats built = { 0, 0, 0, 0 };
+        double t0 = omp_get_wtime();
+        #pragma omp parallel
+        {
+            CacheBuildStats mine = { 0, 0, 0, 0 };
+            NodeArena arena;
+            arena_init(&arena, -1);
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (int f = 0; f < catalog.count; f++) {
+                size_t bytes;
+                int status = stock_cache_build(opts.cache_dir, &catalog, f, &arena,
+                                               opts.cache_flags, &bytes);
+                cache_build_count(&mine, status, bytes);
+            }
+            arena_release(&arena);
+            #pragma omp critical
+            {
+                built.built += mine.built;
+                built.current += mine.current;
+                built.failed += mine.failed;
+                built.bytes += mine.bytes;
+            }
+        }
+        double seconds = omp_get_wtime() - t0;
+        if (manifest_save(&catalog, cache_manifest) != 0)
+            fprintf(stderr, "Cannot write manifest: %s\n", cache_manifest);
+        stock_cache_report(opts.cache_dir, &built, seconds);
+        catalog_free(&catalog);
+        return built.failed ? 1 : 0;
+    }
 
-    struct dirent *entry;
-    char filepath[1024];
-
-    // Dynamic list of file paths
-    char **file_list = NULL;
-    int file_count = 0;
-    int file_cap   = 0;
-
-  
-    while ((entry = readdir(dir)) != NULL) {
-        const char *name = entry->d_name;
-
-        // Skip "." and ".."
-        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-            continue;
+    int file_count = catalog.count;
+    if (file_count == 0) {
+        printf("No CSV files found in directory: %s\n", dirpath);
+        catalog_free(&catalog);
+        return 0;
+    }
 
-        // Only keep files ending with ".csv"
-        size_t len = strlen(name);
-        if (len < 4 || strcmp(name + len - 4, ".csv") != 0)
-            continue;
+    // --years: the rows come from the year layout, built first (by all
+    // threads) if it is missing or stale
+    YearLayout years;
+    int years_built = 0;
+    double years_build_time = 0.0;
+    if (opts.years_dir) {
+        double t0 = omp_get_wtime();
+        years_built = year_layout_prepare(&years, opts.years_dir, &catalog, 1);
+        years_build_time = omp_get_wtime() - t0;
+        if (years_built < 0) {
+            fprintf(stderr, "Cannot build the year layout in %s\n", opts.years_dir);
+            catalog_free(&catalog);
+            return 1;
+        }
+    }
 
-        // Build full path: dirpath/filename
-        snprintf(filepath, sizeof(filepath), "%s/%s", dirpath, name);
-
-        // Grow file_list if needed
-        if (file_count >= file_cap) {
-            int new_cap = (file_cap == 0) ? 128 : file_cap * 2;
-            char **tmp = (char **)realloc(file_list, new_cap * sizeof(char *));
-            if (!tmp) {
-                fprintf(stderr, "Memory allocation failed for file list\n");
-                closedir(dir);
-                for (int i = 0; i < file_count; i++) free(file_list[i]);
-                free(file_list);
-                return 1;
-            }
-            file_list = tmp;
-            file_cap  = new_cap;
+    ScanPlan plan = { opts.cache_dir, opts.cache_flags,
+                      { metric_columns(opts.metrics), opts.from_day, opts.to_day },
+                      opts.metrics, 0, DECADE_TASK_MIN_BYTES };
+
+    // --autotune: threads, schedule and file splitting from the profile
+    TuneProfile prof;
+    int tuned = -1;
+    if (opts.autotune) {
+        tuned = autotune(&catalog, &opts, &plan, &prof);
+        if (tuned >= 0) {
+            omp_set_num_threads(prof.threads);
+            omp_set_schedule(prof.schedule, prof.chunk);
+            plan.split_bytes = prof.split_bytes;
         }
+    }
 
-        // Store a copy of the full path
-        file_list[file_count] = my_strdup(filepath);
-        if (!file_list[file_count]) {
-            fprintf(stderr, "Memory allocation failed for filepath\n");
-            closedir(dir);
-            for (int i = 0; i < file_count; i++) free(file_list[i]);
-            free(file_list);
+    // --mem-budget: every thread streams within its share of the budget
+    if (opts.mem_budget) {
+        int threads = omp_get_max_threads();
+        plan.chunk_rows = csv_stream_rows(opts.mem_budget / threads, plan.spec.columns);
+        if (plan.chunk_rows == 0) {
+            fprintf(stderr, "--mem-budget too small: %d threads need at least %zu MB\n",
+                    threads, (threads * CSV_STREAM_MIN_BUDGET + (1u << 20) - 1) >> 20);
+            catalog_free(&catalog);
             return 1;
         }
-        file_count++;
     }
 
-    closedir(dir);
-
-    if (file_count == 0) {
-        printf("No CSV files found in directory: %s\n", dirpath);
-        return 0;
+    // --pipeline: reader threads feed the others through a ring
+    Pipeline pipe;
+    if (opts.readers) {
+        int threads = omp_get_max_threads();
+        if (opts.readers >= threads) {
+            fprintf(stderr, "--pipeline=%d needs more threads than readers (%d threads)\n",
+                    opts.readers, threads);
+            catalog_free(&catalog);
+            return 1;
+        }
+        omp_set_dynamic(0);
+        if (pipeline_init(&pipe, opts.readers, threads) != 0) {
+            fprintf(stderr, "Memory allocation failed for the pipeline\n");
+            catalog_free(&catalog);
+            return 1;
+        }
     }
 
     printf("\nOpenMP Stock Analysis - Market Metrics by Decade (Cleaned)\n");
     printf("Directory: %s\n", dirpath);
     printf("Files found: %d\n", file_count);
+    if (opts.manifest)
+        printf("Manifest: %s (%s, %d tickers)\n", opts.manifest,
+               manifest_built ? "built now" : "mapped", catalog.tickers);
+    if (opts.years_dir) {
+        printf("Year layout: %s (%d years, %d tickers, ", opts.years_dir, years.segments,
+               years.tickers);
+        if (years_built)
+            printf("built now in %.2f seconds)\n", years_build_time);
+        else
+            printf("current)\n");
+    }
+    if (tuned >= 0)
+        printf("Autotune profile: %d threads, schedule %s,%d, split files >= %lld MB "
+               "(%s; I/O %.0f MB/s, compute %.0f MB/s per thread)\n",
+               prof.threads, autotune_schedule_name(prof.schedule), prof.chunk,
+               prof.split_bytes >> 20,
+               tuned ? "reused" : "measured now", prof.io_rate / 1e6, prof.compute_rate / 1e6);
     printf("============================================================\n\n");
 
     // Global accumulators per decade (shared across all threads)
-    double sum_avg_decade[MAX_DECADES]    = {0.0};
-    long   count_rows_decade[MAX_DECADES] = {0};
-
-    double sum_ret_decade[MAX_DECADES]    = {0.0};
-    double sum_ret_sq_decade[MAX_DECADES] = {0.0};
-    long   count_ret_decade[MAX_DECADES]  = {0};
+    DecadeAcc totals;
+    decade_acc_init(&totals);
+    double bytes_parsed = 0.0;
+
+    // NUMA layout: pin threads (unless OMP_PROC_BIND / OMP_PLACES already
+    // bind them) and, on multi-socket machines, hand out files from one
+    // queue per node so each thread mostly reads into node-local memory.
+    static NumaTopology topo;
+    numa_topology_load(&topo);
+    int pin_threads = !numa_runtime_binds();
+    int use_node_queues = (topo.num_nodes > 1);
+
+    NodeQueues queues;
+    if (use_node_queues && node_queues_init(&queues, topo.num_nodes, file_count) != 0) {
+        fprintf(stderr, "Memory allocation failed for node queues\n");
+        use_node_queues = 0;
+    }
 
-    // Global min/max years found across all data
-    int global_min_year = 9999;
-    int global_max_year = 0;
+    // --counters: misses summed over the threads (-1 = unavailable)
+    long long dtlb_misses = 0;
+    long faults = perf_minor_faults();
 
     // Start timing the parallel computation
     double start = omp_get_wtime();
 
-    // (2) Parallel region: process files in parallel using OpenMP
-    //     Each thread accumulates results in its own local arrays.
-    #pragma omp parallel
-    {
-        // Thread-local accumulators (to avoid data races)
-        double local_sum_avg[MAX_DECADES]    = {0.0};
-        long   local_rows[MAX_DECADES]       = {0};
-
-        double local_sum_ret[MAX_DECADES]    = {0.0};
-        double local_sum_ret_sq[MAX_DECADES] = {0.0};
-        long   local_ret_count[MAX_DECADES]  = {0};
-
-        int local_min_year = 9999;
-        int local_max_year = 0;
-
-        #pragma omp for schedule(runtime)
-        for (int idx_file = 0; idx_file < file_count; idx_file++) {
-
-            const char *filename = file_list[idx_file];
-
-            StockData *data = NULL;
-            int n = read_csv(filename, &data);
-            if (n <= 1 || !data) {
-                if (data) free(data);
-                continue;
-            }
-
-            // Update local min/max year for this thread
-            for (int i = 0; i < n; i++) {
-                int year = 0;
-                sscanf(data[i].date, "%d", &year);
-                if (year < local_min_year) local_min_year = year;
-                if (year > local_max_year) local_max_year = year;
-            }
-
-            // Collect daily average prices
-            for (int i = 0; i < n; i++) {
-                double o = data[i].open;
-                double h = data[i].high;
-                double l = data[i].low;
-                double c = data[i].close;
-
-                int year = 0;
-                sscanf(data[i].date, "%d", &year);
-
-                // Filter invalid years
-                if (year < MIN_YEAR_GLOBAL || year > MAX_YEAR_GLOBAL)
-                    continue;
-
-                int decade_index = (year - MIN_YEAR_GLOBAL) / 10;
-                if (decade_index < 0 || decade_index >= MAX_DECADES)
-                    continue;
-
-                // Filter unrealistic prices
-                if (o >= MIN_PRICE && o <= MAX_PRICE &&
-                    h >= MIN_PRICE && h <= MAX_PRICE &&
-                    l >= MIN_PRICE && l <= MAX_PRICE &&
-                    c >= MIN_PRICE && c <= MAX_PRICE)
-                {
-                    double avg = (o + h + l + c) / 4.0;
-                    local_sum_avg[decade_index]    += avg;
-                    local_rows[decade_index]       += 1;
-                }
-            }
-
-            // Collect daily returns
-            // r = (q - p) / p  between consecutive closes
-             for (int i = 0; i < n - 1; i++) {
-                double p = data[i].close;
-                double q = data[i + 1].close;
-
-                int year = 0;
-                sscanf(data[i].date, "%d", &year);
-
-                // Filter invalid years
-                if (year < MIN_YEAR_GLOBAL || year > MAX_YEAR_GLOBAL)
-                    continue;
-
-                int decade_index = (year - MIN_YEAR_GLOBAL) / 10;
-                if (decade_index < 0 || decade_index >= MAX_DECADES)
-                    continue;
-
-                // Filter unrealistic / invalid prices and zero division
-                if (p >= MIN_PRICE && p <= MAX_PRICE &&
-                    q >= MIN_PRICE && q <= MAX_PRICE &&
-                    p != 0.0)
-                {
-                    double r = (q - p) / p;
-
-                    // Exclude extreme outliers (> 100% daily move)
-                    if (fabs(r) > 1.0)
-                        continue;
-
-                    local_sum_ret[decade_index]    += r;
-                    local_sum_ret_sq[decade_index] += r * r;
-                    local_ret_count[decade_index]  += 1;
-                }
-            }
-
-            // Free memory for this file
-            free(data);
-        } // end for files
-
-        // (3) Merge local thread results into global accumulators
-        //     Critical section protects shared global arrays.
-        #pragma omp critical
+    // --years: threads take whole years instead of files (no per-thread
+    // dTLB counters on this path)
+    int segments_read = 0;
+    if (opts.years_dir) {
+        dtlb_misses = -1;
+        if (year_layout_scan(&years, &totals, opts.metrics, opts.from_day, opts.to_day, 0, 1, 1,
+                             &segments_read, &bytes_parsed) != 0) {
+            fprintf(stderr, "Cannot read the year layout in %s\n", opts.years_dir);
+            year_layout_free(&years);
+            catalog_free(&catalog);
+            if (use_node_queues) node_queues_free(&queues);
+            return 1;
+        }
+    } else {
+        // (2) Parallel region: process files in parallel using OpenMP
+        //     Each thread accumulates results in its own local arrays.
+        #pragma omp parallel
         {
-            for (int d = 0; d < MAX_DECADES; d++) {
-                sum_avg_decade[d]    += local_sum_avg[d];
-                count_rows_decade[d] += local_rows[d];
-
-                sum_ret_decade[d]    += local_sum_ret[d];
-                sum_ret_sq_decade[d] += local_sum_ret_sq[d];
-                count_ret_decade[d]  += local_ret_count[d];
+            int node = numa_pin_thread(&topo, pin_threads);
+
+            // Thread-local accumulators (to avoid data races)
+            DecadeAcc acc;
+            decade_acc_init(&acc);
+
+            // Thread-owned buffer, first-touched on this thread's node
+            NodeArena arena;
+            arena_init(&arena, node);
+            double local_bytes = 0.0;
+            int dtlb_fd = opts.counters ? perf_dtlb_open() : -1;
+
+            if (opts.readers) {
+                local_bytes += pipeline_work(&pipe, &catalog, &plan, &acc);
+            } else if (use_node_queues) {
+                // socket-local queues, stealing from other nodes at the end
+                int idx_file;
+                while ((idx_file = node_queues_next(&queues, node)) >= 0)
+                    local_bytes += process_file(&catalog, idx_file, &plan, &arena, &acc);
+            } else {
+                #pragma omp for schedule(runtime)
+                for (int idx_file = 0; idx_file < file_count; idx_file++)
+                    local_bytes += process_file(&catalog, idx_file, &plan, &arena, &acc);
             }
 
-            if (local_min_year < global_min_year) global_min_year = local_min_year;
-            if (local_max_year > global_max_year) global_max_year = local_max_year;
-        }
-    } // end parallel region
+            long long local_misses = perf_dtlb_close(dtlb_fd);
+            arena_release(&arena);
+
+            // (3) Merge local thread results into global accumulators
+            //     Critical section protects shared global arrays.
+            #pragma omp critical
+            {
+                decade_acc_merge(&totals, &acc);
+                bytes_parsed += local_bytes;
+                if (local_misses < 0 || dtlb_misses < 0)
+                    dtlb_misses = -1;
+                else
+                    dtlb_misses += local_misses;
+            }
+        } // end parallel region
+    }
 
     double end = omp_get_wtime();
+    faults = perf_minor_faults() - faults;
 
     // (4) Print market summary per decade
     printf("Market Summary by Decade (OpenMP):\n");
     printf("------------------------------------------------------------\n");
 
-    int first_decade = (global_min_year / 10) * 10;
+    int first_decade = (totals.min_year / 10) * 10;
     int last_decade  = 2010;  // final printed period: 2010–2020
 
     for (int decade_start = first_decade; decade_start <= last_decade; decade_start += 10) {
@@ -320,8 +647,8 @@ int main(int argc, char *argv[]) {
         if (d_idx < 0 || d_idx >= MAX_DECADES)
             continue;
 
-        long rows = count_rows_decade[d_idx];
-        long rets = count_ret_decade[d_idx];
+        long rows = totals.rows[d_idx];
+        long rets = totals.ret_count[d_idx];
 
         // Skip decades with no data
         if (rows == 0 && rets == 0)
@@ -334,13 +661,13 @@ int main(int argc, char *argv[]) {
 
         // Average daily price for this decade
         if (rows > 0) {
-            mean_price = sum_avg_decade[d_idx] / (double)rows;
+            mean_price = totals.sum_avg[d_idx] / (double)rows;
         }
 
         // Volatility and returns for this decade
         if (rets > 0) {
-            mean_r  = sum_ret_decade[d_idx] / (double)rets;  // mean daily return
-            double mean_r2 = sum_ret_sq_decade[d_idx] / (double)rets;
+            mean_r  = totals.sum_ret[d_idx] / (double)rets;  // mean daily return
+            double mean_r2 = totals.sum_ret_sq[d_idx] / (double)rets;
             double var = mean_r2 - mean_r * mean_r;
             if (var < 0.0) var = 0.0;
             vol = sqrt(var);
@@ -352,8 +679,16 @@ int main(int argc, char *argv[]) {
         int decade_end = (decade_start == 2010) ? 2020 : (decade_start + 9);
 
         printf("Decade %d–%d:\n", decade_start, decade_end);
-        printf("  Rows used:             %ld\n", rows);
-        printf("  Mean market price:     %.4f\n", mean_price);
+        if (opts.metrics & METRIC_PRICES) {
+            printf("  Rows used:             %ld\n", rows);
+            printf("  Mean market price:     %.4f\n", mean_price);
+        }
+
+        if (!(opts.metrics & METRIC_RETURNS)) {
+            printf("\n");
+            continue;
+        }
+
         printf("  Market volatility:     %.4f (%.4f%%)\n",
                vol, vol * 100.0);
 
@@ -368,17 +703,44 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    printf("Overall Years Range in Data: %d–%d\n", global_min_year, global_max_year);
+    printf("Overall Years Range in Data: %d–%d\n", totals.min_year, totals.max_year);
     printf("Execution time (OpenMP): %.6f seconds\n", end - start);
+    if (opts.years_dir)
+        printf("Scan throughput:         %.3f GB/s (%.1f MB of columns, %d of %d year segments)\n",
+               bytes_parsed / (end - start) / 1e9, bytes_parsed / 1e6, segments_read,
+               years.segments);
+    else
+        printf("Ingest throughput:       %.3f GB/s (%.1f MB of CSV)\n",
+               bytes_parsed / (end - start) / 1e9, bytes_parsed / 1e6);
+    if (opts.counters)
+        perf_report(dtlb_misses, faults, end - start, bytes_parsed);
+
+    // --market: all files merged by date, intervals of days per thread, or
+    // one pass over the year segments with --years
+    if (opts.market) {
+        MarketAcc market;
+        MarketInfo info;
+        if ((opts.years_dir
+             ? market_compute_years(&market, &info, &years, opts.from_day, opts.to_day)
+             : market_compute(&market, &info, &catalog, opts.cache_dir, opts.cache_flags,
+                              opts.from_day, opts.to_day, 1)) == 0)
+            market_print(&market, &info, "–");
+        else
+            fprintf(stderr, opts.years_dir ? "Cannot read the year layout for --market\n"
+                                           : "Memory allocation failed for the market merge\n");
+    }
 
-    // Free file paths
-    for (int i = 0; i < file_count; i++) free(file_list[i]);
-    free(file_list);
+    // Free the file manifest
+    catalog_free(&catalog);
+    if (use_node_queues) node_queues_free(&queues);
+    if (opts.readers) pipeline_free(&pipe);
+    if (opts.years_dir) year_layout_free(&years);
 
     return 0;
 }
 
 // gcc -O3 -fopenmp openMP_Version.c -o omp
+// gcc -O3 -fopenmp -DHAVE_ZLIB -DHAVE_ZSTD openMP_Version.c -o omp -lz -lzstd   (.csv.gz / .csv.zst input)
 // export OMP_NUM_THREADS=2
 // export OMP_NUM_THREADS=4
 // export OMP_NUM_THREADS=8
@@ -387,3 +749,14 @@ int main(int argc, char *argv[]) {
 // export OMP_SCHEDULE="dynamic,1000"
 // export OMP_SCHEDULE="guided,1000"   
 // ./omp stocks
+// ./omp stocks --autotune   (measures threads / schedule once, then reuses the profile)
+// OMP_NUM_THREADS=8 ./omp stocks --pipeline=2   (2 reader threads feed 6 compute threads)
+// ./omp stocks --years=years --from=2000 --to=2009   (year layout, built on first use; reads 10 years)
+// ./omp stocks --market   (equal-weight market and daily breadth from all files merged by date)
+// ./omp stocks --years=years --market   (the same from one pass over the year segments)
+// ./omp --ring-bench=4,4     (stress + throughput of the ring, vs. a mutex queue)
+//
+// NUMA check on a 2-socket box (remote traffic with and without pinning):
+// OMP_PROC_BIND=false perf stat -e node-loads,node-load-misses ./omp stocks
+// perf stat -e node-loads,node-load-misses ./omp stocks
+// OMP_PLACES=cores OMP_PROC_BIND=close ./omp stocks   (runtime binding wins)
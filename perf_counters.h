@@ -0,0 +1,71 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "arena.h"
+
+// Counters mode (--counters): dTLB load misses of the scanning threads,
+// minor page faults of the process and the scan time, to see what the
+// page policy (--huge-pages, --populate) buys.  The misses are counted
+// per thread in user space only, which perf_event_paranoid <= 2 allows;
+// machines without PMU access (e.g. many VMs) report them as unavailable.
+
+// Start counting the calling thread's dTLB load misses.
+// Returns the counter, or -1 if the machine does not provide it.
+static inline int perf_dtlb_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    return fd;
+}
+
+// Misses counted since perf_dtlb_open, closing the counter; -1 if fd < 0
+static inline long long perf_dtlb_close(int fd) {
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    long long count = -1;
+    if (read(fd, &count, sizeof(count)) != (ssize_t)sizeof(count))
+        count = -1;
+    close(fd);
+    return count;
+}
+
+static inline long perf_minor_faults(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_minflt : 0;
+}
+
+// Print the counters block; `dtlb` < 0 means unavailable
+static inline void perf_report(long long dtlb, long faults, double seconds, double bytes) {
+    const char *pages = arena_page_mode == PAGES_HUGETLB ? "hugetlbfs 2MB" :
+                        arena_page_mode == PAGES_THP     ? "transparent 2MB" : "4K";
+    printf("\nCounters (%s pages%s):\n", pages, arena_populate ? ", prefaulted" : "");
+    if (dtlb >= 0)
+        printf("  dTLB load misses:      %lld (%.1f per MB of input)\n",
+               dtlb, bytes > 0.0 ? dtlb / (bytes / 1e6) : 0.0);
+    else
+        printf("  dTLB load misses:      unavailable (no PMU access)\n");
+    printf("  Minor page faults:     %ld\n", faults);
+    printf("  Scan time:             %.6f seconds\n", seconds);
+}
+
+#endif
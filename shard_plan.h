@@ -0,0 +1,146 @@
+#ifndef SHARD_PLAN_H
+#define SHARD_PLAN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "catalog.h"
+
+// Placement of a dataset on node-local disks (MPI --shard / --local).
+//
+// shard_plan maps every file of a catalog to one of `nodes` nodes: the
+// tickers are dealt largest first to the node holding the fewest bytes
+// (LPT), so all files of a ticker land on the same node and the nodes
+// get about the same amount of data.  The plan depends only on the
+// catalog and the node count, so the sharding run and later analysis
+// runs agree on it without storing anything.
+//
+// A file is resident on a node when <local root>/<relative path> exists
+// with the catalog's size and mtime (shard_copy keeps the mtime).
+
+typedef struct {
+    long long bytes;
+    int ticker;
+} ShardTicker;
+
+static inline int shard_cmp_bytes_desc(const void *a, const void *b) {
+    const ShardTicker *x = (const ShardTicker *)a, *y = (const ShardTicker *)b;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return x->ticker - y->ticker;
+}
+
+// node_of[i] = node of catalog entry i (the catalog must have tickers
+// assigned).  Returns 0, or -1 if out of memory.
+static inline int shard_plan(const Catalog *c, int nodes, int *node_of) {
+    ShardTicker *t = (ShardTicker *)calloc(c->tickers ? c->tickers : 1, sizeof(*t));
+    int *ticker_node = (int *)malloc((c->tickers ? c->tickers : 1) * sizeof(int));
+    long long *load = (long long *)calloc(nodes, sizeof(long long));
+    if (!t || !ticker_node || !load) {
+        free(t);
+        free(ticker_node);
+        free(load);
+        return -1;
+    }
+
+    for (int k = 0; k < c->tickers; k++) t[k].ticker = k;
+    for (int i = 0; i < c->count; i++) t[c->entries[i].ticker].bytes += c->entries[i].size;
+    qsort(t, c->tickers, sizeof(*t), shard_cmp_bytes_desc);
+
+    for (int k = 0; k < c->tickers; k++) {
+        int best = 0;
+        for (int n = 1; n < nodes; n++)
+            if (load[n] < load[best]) best = n;
+        load[best] += t[k].bytes;
+        ticker_node[t[k].ticker] = best;
+    }
+    for (int i = 0; i < c->count; i++)
+        node_of[i] = ticker_node[c->entries[i].ticker];
+
+    free(t);
+    free(ticker_node);
+    free(load);
+    return 0;
+}
+
+// "<root>/<relative path of entry i>"; returns 0, or -1 if it does not fit
+static inline int shard_local_path(char *out, size_t cap, const char *root,
+                                   const Catalog *c, int i) {
+    int len = snprintf(out, cap, "%s/%s", root, catalog_relpath(c, i));
+    return len < 0 || (size_t)len >= cap ? -1 : 0;
+}
+
+// Entry i of `c` is present at `path` (same size and mtime)
+static inline int shard_resident(const char *path, const Catalog *c, int i) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+           (long long)st.st_size == c->entries[i].size &&
+           (long long)st.st_mtime == c->entries[i].mtime;
+}
+
+// Create the parent directories of `path`
+static inline int shard_mkdirs(const char *path) {
+    char dir[4096];
+    size_t len = strlen(path);
+    if (len >= sizeof(dir)) return -1;
+    memcpy(dir, path, len + 1);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return 0;
+}
+
+// Copy entry i of `c` to `dst` (through a temporary name and a rename, so
+// an interrupted copy never looks resident) and give it the source mtime.
+// Returns 0 or -1.
+static inline int shard_copy(const Catalog *c, int i, const char *dst) {
+    char tmp[4096 + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", dst, (int)getpid());
+    if (shard_mkdirs(dst) != 0) return -1;
+
+    int in = open(catalog_path(c, i), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return -1;
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+
+    char *buf = (char *)malloc(1 << 20);
+    int err = !buf;
+    long long copied = 0;
+    while (!err) {
+        ssize_t r = read(in, buf, 1 << 20);
+        if (r == 0) break;
+        if (r < 0) { err = 1; break; }
+        for (ssize_t done = 0; !err && done < r; ) {
+            ssize_t w = write(out, buf + done, r - done);
+            if (w <= 0) err = 1;
+            else done += w;
+        }
+        copied += r;
+    }
+    free(buf);
+    close(in);
+
+    // the catalog's size and mtime are what makes the copy resident
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = (time_t)c->entries[i].mtime;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    if (copied != c->entries[i].size || futimens(out, times) != 0) err = 1;
+    if (close(out) != 0) err = 1;
+    if (err || rename(tmp, dst) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
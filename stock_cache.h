@@ -0,0 +1,632 @@
+#ifndef STOCK_CACHE_H
+#define STOCK_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "catalog.h"
+#include "column_codec.h"
+#include "stock_data.h"
+#include "stock_loader.h"
+
+// Binary columnar cache of the stocks directory (--cache=DIR).
+//
+// Every CSV file gets one cache file holding its rows already parsed,
+// sorted and de-duplicated, column by column:
+//
+//   CacheHeader | CacheZone[blocks] | day int32[rows] | open | high | low
+//               | close | volume (double[rows] each, 64-byte aligned)
+//
+// A cache file is mmapped and the StockSeries points straight into the
+// mapping, so a warm run does no parsing and no copying, and only the
+// pages of the columns (and rows) a query touches are read.
+//
+// The rows are cut into blocks of CACHE_BLOCK_ROWS; each block has a
+// zone map with the date range, the min/max of each OHLC column and the
+// number of rows that fail the MIN_PRICE/MAX_PRICE rules.  Scans use it
+// to skip blocks outside a date range and to run the cleaning-free path
+// on blocks that are known to be clean (decade_acc_add_cached).
+//
+// With --cache-compress the columns are stored encoded instead
+// (column_codec.h: delta-of-delta days, scaled-integer delta prices,
+// frame-of-reference volumes), as one CodecChunk per block and column:
+//
+//   CacheHeader | CacheZone[blocks] | CodecChunk[blocks][6] | payloads
+//
+// Scans then decode only the blocks and columns they need, one block at a
+// time into a per-thread buffer, and feed it straight to the aggregation.
+//
+// --cache-precision=float32 or =micro stores the OHLC columns as float32
+// or as int64 micro-units in the same chunked layout (accumulation stays
+// in double).  As a guardrail, a chunk whose rounded values would change
+// a cleaning decision (the MIN_PRICE/MAX_PRICE test, or the > 100% move
+// test between consecutive closes) is kept in double precision, so
+// reduced precision never adds or drops rows or returns.
+//
+// A cache file remembers the size and mtime of its CSV; when they no
+// longer match (or the file is missing or damaged, or was written with
+// the other compression setting) it is rebuilt from the CSV on first use.
+// Files are written under a temporary name and renamed into place.
+//
+// --build-cache converts the whole directory up front, in parallel, and
+// leaves the directory listing as a manifest in the cache (see
+// manifest.h); later runs with --cache map it instead of listing the
+// CSV directory.  Files that are already current are skipped, so an
+// interrupted build is simply run again.
+
+#ifndef CACHE_BLOCK_ROWS
+#define CACHE_BLOCK_ROWS 4096
+#endif
+#define CACHE_MAGIC   "STKCACHE"
+#define CACHE_VERSION 2
+#define CACHE_ALIGN   64
+#define CACHE_TMP_SUFFIX ".tmp"
+#define CACHE_MANIFEST   "catalog.manifest"     // listing saved by --build-cache
+
+// CacheHeader.flags; any of them selects the chunked layout
+#define CACHE_COMPRESSED (1u << 0)
+#define CACHE_FLOAT32    (1u << 1)      // OHLC as float32
+#define CACHE_MICRO      (1u << 2)      // OHLC as int64 micro-units
+#define CACHE_FLAGS      (CACHE_COMPRESSED | CACHE_FLOAT32 | CACHE_MICRO)
+
+// Stored columns: the day key, then the COL_* columns
+#define CACHE_COLUMNS (1 + SERIES_COLUMNS)
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t block_rows;
+    uint32_t flags;                     // CACHE_* layout and precision
+    uint32_t pad;
+    int64_t  rows;
+    int64_t  blocks;
+    int64_t  src_size;                  // CSV the cache was built from
+    int64_t  src_mtime;
+    uint64_t day_off;                   // byte offsets of the columns
+    uint64_t col_off[SERIES_COLUMNS];   // (uncompressed files)
+    uint64_t file_size;
+} CacheHeader;
+
+// Zone map of one block of rows
+typedef struct {
+    int32_t min_day, max_day;
+    int32_t rows;
+    int32_t bad_prices;                 // rows with an OHLC price out of bounds
+    int32_t bad_close;                  // rows with the close out of bounds
+    int32_t pad;
+    double  min[4], max[4];             // per OHLC column (COL_* order)
+} CacheZone;
+
+// An open (mapped) cache file
+typedef struct {
+    void *map;
+    size_t map_len;
+    const CacheHeader *hdr;
+    const CacheZone *zones;
+    const CodecChunk *chunks;           // [block * CACHE_COLUMNS + column]
+    StockSeries series;                 // all rows, pointing into the map
+                                        // (only n is set when compressed)
+    size_t text_bytes;                  // CSV bytes parsed to (re)build it
+} CacheView;
+
+static inline size_t cache_align(size_t off) {
+    return (off + CACHE_ALIGN - 1) & ~(size_t)(CACHE_ALIGN - 1);
+}
+
+static inline int cache_price_ok(double p) {
+    return p >= MIN_PRICE && p <= MAX_PRICE;
+}
+
+// Cache file of catalog entry i: "<dir>/<relative path, '/' -> '#'>.col"
+static inline int cache_file_path(char *out, size_t cap, const char *cache_dir,
+                                  const Catalog *c, int i) {
+    int len = snprintf(out, cap, "%s/%s.col", cache_dir, catalog_relpath(c, i));
+    if (len < 0 || (size_t)len >= cap) return -1;
+    for (char *p = out + strlen(cache_dir) + 1; *p; p++)
+        if (*p == '/') *p = '#';
+    return 0;
+}
+
+// Zone map of rows [lo, hi) of a full (COL_ALL) series
+static inline void cache_zone_of(const StockSeries *s, int lo, int hi, CacheZone *z) {
+    memset(z, 0, sizeof(*z));
+    z->min_day = s->day[lo];
+    z->max_day = s->day[hi - 1];
+    z->rows = hi - lo;
+    double first[4] = { s->open[lo], s->high[lo], s->low[lo], s->close[lo] };
+    for (int k = 0; k < 4; k++)
+        z->min[k] = z->max[k] = first[k];
+    for (int i = lo; i < hi; i++) {
+        double o = s->open[i], h = s->high[i], l = s->low[i], c = s->close[i];
+        double v[4] = { o, h, l, c };
+        for (int k = 0; k < 4; k++) {
+            if (v[k] < z->min[k]) z->min[k] = v[k];
+            if (v[k] > z->max[k]) z->max[k] = v[k];
+        }
+        if (!(cache_price_ok(o) && cache_price_ok(h) && cache_price_ok(l) && cache_price_ok(c)))
+            z->bad_prices++;
+        if (!cache_price_ok(c))
+            z->bad_close++;
+    }
+}
+
+static inline int cache_write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+// Bound on the relative error of one stored price under `flags`
+// (float32 rounding, or half a micro-unit on the smallest clean price)
+static inline double cache_price_error(unsigned flags) {
+    if (flags & CACHE_FLOAT32) return 0x1p-24;
+    if (flags & CACHE_MICRO)   return 0.5e-6 / MIN_PRICE;
+    return 0.0;
+}
+
+// Do the decoded values x2 make the same cleaning decisions as x?
+// (price bounds on every value, outlier test between closes)
+static inline int cache_same_decisions(const double *x, const double *x2, int n,
+                                       int is_close) {
+    for (int i = 0; i < n; i++) {
+        if (cache_price_ok(x[i]) != cache_price_ok(x2[i])) return 0;
+        if (is_close && i + 1 < n && x[i] != 0.0 && x2[i] != 0.0 &&
+            (fabs((x[i + 1] - x[i]) / x[i]) > 1.0) !=
+            (fabs((x2[i + 1] - x2[i]) / x2[i]) > 1.0))
+            return 0;
+    }
+    return 1;
+}
+
+// Encode one block of price column k (COL_* order) under `flags`
+static inline size_t cache_encode_column(const double *x, int n, int k, unsigned flags,
+                                         CodecChunk *c, uint8_t *out,
+                                         int64_t *m, uint64_t *tmp, double *check) {
+    if (k < 4 && (flags & (CACHE_FLOAT32 | CACHE_MICRO))) {
+        size_t bytes = (flags & CACHE_FLOAT32) ? codec_encode_f32(x, n, c, out)
+                                               : codec_encode_micro(x, n, c, out);
+        codec_decode_doubles(out, c, n, check, tmp);
+        if (cache_same_decisions(x, check, n, k == 3))
+            return bytes;
+        return codec_encode_raw(x, (size_t)n * sizeof(double), c, out);
+    }
+    if (flags & CACHE_COMPRESSED)
+        return codec_encode_doubles(x, n, k == 4, c, out, m, tmp);
+    return codec_encode_raw(x, (size_t)n * sizeof(double), c, out);
+}
+
+// Encode every block and column of a series.  Fills chunks (offsets
+// relative to the start of the payload) and returns the malloced payload,
+// or NULL; *bytes gets its size.
+static inline uint8_t *cache_encode(const StockSeries *s, int64_t blocks, unsigned flags,
+                                    CodecChunk *chunks, size_t *bytes) {
+    size_t cap = (size_t)s->n * (sizeof(int) + SERIES_COLUMNS * sizeof(double)) +
+                 (size_t)blocks * CACHE_COLUMNS * CODEC_PAD + CODEC_PAD;
+    uint8_t *out = (uint8_t *)malloc(cap);
+    int64_t *m = (int64_t *)malloc(CACHE_BLOCK_ROWS * sizeof(int64_t));
+    uint64_t *tmp = (uint64_t *)malloc(CACHE_BLOCK_ROWS * sizeof(uint64_t));
+    double *check = (double *)malloc(CACHE_BLOCK_ROWS * sizeof(double));
+    if (!out || !m || !tmp || !check) {
+        free(out); free(m); free(tmp); free(check);
+        return NULL;
+    }
+
+    size_t pos = 0;
+    for (int64_t b = 0; b < blocks; b++) {
+        int lo = (int)(b * CACHE_BLOCK_ROWS);
+        int n = lo + CACHE_BLOCK_ROWS < s->n ? CACHE_BLOCK_ROWS : s->n - lo;
+        CodecChunk *c = chunks + b * CACHE_COLUMNS;
+
+        if (flags & CACHE_COMPRESSED)
+            pos += codec_encode_days(s->day + lo, n, &c[0], out + pos, tmp);
+        else
+            pos += codec_encode_raw(s->day + lo, (size_t)n * sizeof(int), &c[0], out + pos);
+        c[0].off = pos - c[0].bytes;
+        for (int k = 0; k < SERIES_COLUMNS; k++) {
+            const double *col = *series_column((StockSeries *)s, k);
+            pos += cache_encode_column(col + lo, n, k, flags, &c[1 + k], out + pos,
+                                       m, tmp, check);
+            c[1 + k].off = pos - c[1 + k].bytes;
+        }
+    }
+    memset(out + pos, 0, CODEC_PAD);    // room for the decoders' 8-byte loads
+
+    free(m);
+    free(tmp);
+    free(check);
+    *bytes = pos + CODEC_PAD;
+    return out;
+}
+
+// Move a fully written temporary file into place (or drop it after an
+// error); readers mapping the old file keep their pages.  Returns 0 or -1.
+static inline int cache_publish(const char *tmp, const char *path, int err) {
+    if (err || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Write a sorted COL_ALL series as a cache file (`flags`: CACHE_*),
+// through a temporary name and a rename, so a reader or an interrupted
+// build never sees a half-written file.  Returns 0 or -1.
+static inline int stock_cache_write(const char *path, const StockSeries *s,
+                                    long long src_size, long long src_mtime,
+                                    unsigned flags) {
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, 8);
+    h.version = CACHE_VERSION;
+    h.block_rows = CACHE_BLOCK_ROWS;
+    h.flags = flags & CACHE_FLAGS;
+    h.rows = s->n;
+    h.blocks = (s->n + CACHE_BLOCK_ROWS - 1) / CACHE_BLOCK_ROWS;
+    h.src_size = src_size;
+    h.src_mtime = src_mtime;
+
+    CacheZone *zones = (CacheZone *)malloc((size_t)(h.blocks ? h.blocks : 1) * sizeof(CacheZone));
+    if (!zones) return -1;
+    for (int64_t b = 0; b < h.blocks; b++) {
+        int lo = (int)(b * CACHE_BLOCK_ROWS);
+        int hi = lo + CACHE_BLOCK_ROWS < s->n ? lo + CACHE_BLOCK_ROWS : s->n;
+        cache_zone_of(s, lo, hi, &zones[b]);
+    }
+
+    size_t meta = sizeof(h) + (size_t)h.blocks * sizeof(CacheZone);
+    CodecChunk *chunks = NULL;
+    uint8_t *payload = NULL;
+    size_t payload_bytes = 0;
+
+    if (h.flags) {
+        chunks = (CodecChunk *)calloc((size_t)(h.blocks ? h.blocks : 1) * CACHE_COLUMNS,
+                                      sizeof(CodecChunk));
+        payload = chunks ? cache_encode(s, h.blocks, h.flags, chunks, &payload_bytes) : NULL;
+        if (!payload) {
+            free(zones); free(chunks);
+            return -1;
+        }
+        meta += (size_t)h.blocks * CACHE_COLUMNS * sizeof(CodecChunk);
+        size_t base = cache_align(meta);
+        for (int64_t k = 0; k < h.blocks * CACHE_COLUMNS; k++)
+            chunks[k].off += base;
+        h.day_off = base;
+        h.file_size = base + payload_bytes;
+    } else {
+        size_t off = cache_align(meta);
+        h.day_off = off;
+        off = cache_align(off + (size_t)s->n * sizeof(int32_t));
+        for (int k = 0; k < SERIES_COLUMNS; k++) {
+            h.col_off[k] = off;
+            off = cache_align(off + (size_t)s->n * sizeof(double));
+        }
+        h.file_size = off;
+    }
+
+    char tmp[4096 + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d" CACHE_TMP_SUFFIX, path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(zones); free(chunks); free(payload);
+        return -1;
+    }
+
+    static const char zeros[CACHE_ALIGN];
+    int err = cache_write_all(fd, &h, sizeof(h)) ||
+              cache_write_all(fd, zones, (size_t)h.blocks * sizeof(CacheZone));
+    size_t pos = sizeof(h) + (size_t)h.blocks * sizeof(CacheZone);
+
+    if (h.flags) {
+        err = err ||
+              cache_write_all(fd, chunks, (size_t)h.blocks * CACHE_COLUMNS * sizeof(CodecChunk)) ||
+              cache_write_all(fd, zeros, h.day_off - meta) ||
+              cache_write_all(fd, payload, payload_bytes);
+        free(zones); free(chunks); free(payload);
+        if (close(fd) != 0) err = 1;
+        return cache_publish(tmp, path, err);
+    }
+
+    // columns, each preceded by the padding up to its offset
+    const void *cols[1 + SERIES_COLUMNS] = { s->day, s->open, s->high, s->low,
+                                             s->close, s->volume };
+    const uint64_t offs[1 + SERIES_COLUMNS] = { h.day_off, h.col_off[0], h.col_off[1],
+                                                h.col_off[2], h.col_off[3], h.col_off[4] };
+    for (int k = 0; !err && k < 1 + SERIES_COLUMNS; k++) {
+        size_t width = k == 0 ? sizeof(int32_t) : sizeof(double);
+        err = cache_write_all(fd, zeros, offs[k] - pos) ||
+              cache_write_all(fd, cols[k], (size_t)s->n * width);
+        pos = offs[k] + (size_t)s->n * width;
+    }
+    if (!err)
+        err = cache_write_all(fd, zeros, h.file_size - pos);
+
+    free(zones);
+    if (close(fd) != 0) err = 1;
+    return cache_publish(tmp, path, err);
+}
+
+// Map a cache file.  Returns 0 if it is valid, was built from a CSV of
+// the given size and mtime and has the given flags, -1 otherwise.
+static inline int stock_cache_open(CacheView *v, const char *path,
+                                   long long src_size, long long src_mtime,
+                                   unsigned flags) {
+    memset(v, 0, sizeof(*v));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const CacheHeader *h = (const CacheHeader *)map;
+    if (memcmp(h->magic, CACHE_MAGIC, 8) != 0 || h->version != CACHE_VERSION ||
+        h->file_size != (uint64_t)st.st_size || h->block_rows == 0 ||
+        h->src_size != src_size || h->src_mtime != src_mtime || h->flags != flags) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    // the columns are scanned front to back: 2MB pages, optionally prefaulted
+    arena_advise_huge(map, (size_t)st.st_size);
+    if (arena_populate)
+        arena_prefault(map, (size_t)st.st_size, 0);
+
+    v->map = map;
+    v->map_len = (size_t)st.st_size;
+    v->hdr = h;
+    v->zones = (const CacheZone *)(h + 1);
+
+    unsigned char *base = (unsigned char *)map;
+    StockSeries *s = &v->series;
+    series_init(s, COL_ALL);
+    s->n = (int)h->rows;
+    s->cap = s->n;
+    if (h->flags) {
+        v->chunks = (const CodecChunk *)(v->zones + h->blocks);
+        return 0;
+    }
+    s->day = (int *)(base + h->day_off);
+    for (int k = 0; k < SERIES_COLUMNS; k++)
+        *series_column(s, k) = (double *)(base + h->col_off[k]);
+    return 0;
+}
+
+// Per-thread buffer compressed blocks are decoded into (cache_block);
+// it grows to the largest block decoded and is released when the thread
+// closes a view (stock_cache_close)
+typedef struct {
+    int *day;
+    double *col[SERIES_COLUMNS];
+    uint64_t *tmp;
+    int cap;
+} CacheDecodeBuf;
+
+static _Thread_local CacheDecodeBuf cache_decode_buf;
+
+static inline void cache_decode_release(void) {
+    CacheDecodeBuf *d = &cache_decode_buf;
+    free(d->day);
+    free(d->tmp);
+    for (int k = 0; k < SERIES_COLUMNS; k++) free(d->col[k]);
+    memset(d, 0, sizeof(*d));
+}
+
+// Rows of block b as a series (rows 0..zones[b].rows).  Uncompressed
+// files point into the map; compressed ones decode the day key and the
+// `columns` (COL_* bits) into the per-thread buffer, which stays valid
+// until the next call on this thread or until the thread closes a view.
+// Returns 0, or -1 if out of memory.
+static inline int cache_block(const CacheView *v, int b, unsigned columns,
+                              StockSeries *blk) {
+    CacheDecodeBuf *d = &cache_decode_buf;
+    const StockSeries *s = &v->series;
+    int base = b * (int)v->hdr->block_rows;
+    int n = v->zones[b].rows;
+    series_init(blk, COL_ALL);
+    blk->n = blk->cap = n;
+
+    if (!v->chunks) {
+        blk->day = s->day + base;
+        for (int k = 0; k < SERIES_COLUMNS; k++)
+            *series_column(blk, k) = *series_column((StockSeries *)s, k) + base;
+        return 0;
+    }
+
+    if (n > d->cap) {
+        cache_decode_release();
+        d->day = (int *)malloc((size_t)n * sizeof(int));
+        d->tmp = (uint64_t *)malloc((size_t)n * sizeof(uint64_t));
+        int ok = d->day && d->tmp;
+        for (int k = 0; k < SERIES_COLUMNS; k++) {
+            d->col[k] = (double *)malloc((size_t)n * sizeof(double));
+            ok = ok && d->col[k];
+        }
+        if (!ok) {
+            cache_decode_release();
+            return -1;
+        }
+        d->cap = n;
+    }
+
+    const unsigned char *map = (const unsigned char *)v->map;
+    const CodecChunk *c = v->chunks + (size_t)b * CACHE_COLUMNS;
+    codec_decode_days(map + c[0].off, &c[0], n, d->day, d->tmp);
+    blk->day = d->day;
+    for (int k = 0; k < SERIES_COLUMNS; k++) {
+        if (!(columns & (1u << k))) {
+            *series_column(blk, k) = NULL;
+            continue;
+        }
+        codec_decode_doubles(map + c[1 + k].off, &c[1 + k], n, d->col[k], d->tmp);
+        *series_column(blk, k) = d->col[k];
+    }
+    blk->columns = columns & COL_ALL;
+    return 0;
+}
+
+// Unmap a view and release this thread's decode buffer (blocks of other
+// views open on the thread have to be fetched again with cache_block)
+static inline void stock_cache_close(CacheView *v) {
+    if (v->chunks) cache_decode_release();
+    if (v->map) munmap(v->map, v->map_len);
+    memset(v, 0, sizeof(*v));
+}
+
+// (Re)build the cache file `path` of catalog entry i from its CSV.
+// *text_bytes receives the CSV bytes parsed.  Returns 0 or -1.
+static inline int cache_convert(const char *path, const Catalog *c, int i,
+                                NodeArena *arena, unsigned flags, size_t *text_bytes) {
+    const CatalogEntry *e = &c->entries[i];
+    StockSeries full;
+    LoadSpec all = { COL_ALL, DAY_RANGE_MIN, DAY_RANGE_MAX };
+    read_csv(catalog_path(c, i), &full, arena, &all);
+    *text_bytes = full.text_bytes;
+    if (stock_cache_write(path, &full, e->size, e->mtime, flags) != 0) {
+        fprintf(stderr, "Cannot write cache file: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Open the cache file of catalog entry i, (re)building it from the CSV
+// when it is missing or stale.  `arena` holds the rows while building.
+// Returns 0 on success, -1 if the cache cannot be used for this file.
+static inline int stock_cache_load(CacheView *v, const char *cache_dir,
+                                   const Catalog *c, int i, NodeArena *arena,
+                                   unsigned flags) {
+    char path[4096];
+    if (cache_file_path(path, sizeof(path), cache_dir, c, i) != 0)
+        return -1;
+
+    const CatalogEntry *e = &c->entries[i];
+    if (stock_cache_open(v, path, e->size, e->mtime, flags) == 0)
+        return 0;
+
+    size_t text_bytes;
+    if (cache_convert(path, c, i, arena, flags, &text_bytes) != 0 ||
+        stock_cache_open(v, path, e->size, e->mtime, flags) != 0)
+        return -1;
+    v->text_bytes = text_bytes;
+    return 0;
+}
+
+// --build-cache: make the cache file of catalog entry i current.  Returns
+// 1 if it already was (so a restarted build skips the files an earlier
+// run finished), 0 if it was built now (*text_bytes CSV bytes parsed),
+// -1 on failure.
+static inline int stock_cache_build(const char *cache_dir, const Catalog *c, int i,
+                                    NodeArena *arena, unsigned flags, size_t *text_bytes) {
+    char path[4096];
+    *text_bytes = 0;
+    if (cache_file_path(path, sizeof(path), cache_dir, c, i) != 0)
+        return -1;
+
+    CacheView v;
+    const CatalogEntry *e = &c->entries[i];
+    if (stock_cache_open(&v, path, e->size, e->mtime, flags) == 0) {
+        stock_cache_close(&v);
+        return 1;
+    }
+    return cache_convert(path, c, i, arena, flags, text_bytes);
+}
+
+// First row of the cache whose day is >= target: the zone maps narrow
+// the search to one block, then that block's day keys are searched.
+static inline int cache_lower_bound(const CacheView *v, int target) {
+    int blocks = (int)v->hdr->blocks;
+    int lo = 0, hi = blocks;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (v->zones[mid].max_day < target) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == blocks) return v->series.n;
+
+    StockSeries blk;
+    if (cache_block(v, lo, 0, &blk) != 0) return -1;
+    int r = 0, end = blk.n;
+    while (r < end) {
+        int mid = r + (end - r) / 2;
+        if (blk.day[mid] < target) r = mid + 1;
+        else end = mid;
+    }
+    return lo * (int)v->hdr->block_rows + r;
+}
+
+// Make the cache directory if it does not exist yet
+static inline int stock_cache_prepare(const char *cache_dir) {
+    if (mkdir(cache_dir, 0755) == 0 || errno == EEXIST)
+        return 0;
+    fprintf(stderr, "Cannot create cache directory: %s\n", cache_dir);
+    return -1;
+}
+
+// Remove the temporary files a killed build left behind (run before a
+// build, never next to one in progress).  Returns the number removed.
+static inline int stock_cache_clean(const char *cache_dir) {
+    DIR *d = opendir(cache_dir);
+    if (!d) return 0;
+    int removed = 0;
+    size_t suffix = strlen(CACHE_TMP_SUFFIX);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len > suffix && strcmp(de->d_name + len - suffix, CACHE_TMP_SUFFIX) == 0 &&
+            unlinkat(dirfd(d), de->d_name, 0) == 0)
+            removed++;
+    }
+    closedir(d);
+    return removed;
+}
+
+// --build-cache totals: files built now, already current, failed, and
+// the CSV bytes parsed
+typedef struct {
+    long long built, current, failed, bytes;
+} CacheBuildStats;
+
+static inline void cache_build_count(CacheBuildStats *st, int status, size_t bytes) {
+    if (status == 0)      st->built++;
+    else if (status > 0)  st->current++;
+    else                  st->failed++;
+    st->bytes += (long long)bytes;
+}
+
+static inline void stock_cache_report(const char *cache_dir, const CacheBuildStats *st,
+                                      double seconds) {
+    printf("Cache %s: %lld files built, %lld already current, %lld failed\n",
+           cache_dir, st->built, st->current, st->failed);
+    printf("Build time: %.6f seconds (%.1f MB of CSV, %.3f GB/s)\n", seconds,
+           st->bytes / 1e6, seconds > 0.0 ? st->bytes / seconds / 1e9 : 0.0);
+}
+
+// Manifest of a cache directory, "<dir>/catalog.manifest" (written when
+// a --build-cache run finishes).  Returns 0, or -1 if it does not fit.
+static inline int stock_cache_manifest(char *out, size_t cap, const char *cache_dir) {
+    int len = snprintf(out, cap, "%s/" CACHE_MANIFEST, cache_dir);
+    return len < 0 || (size_t)len >= cap ? -1 : 0;
+}
+
+#endif
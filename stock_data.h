@@ -0,0 +1,263 @@
+#ifndef STOCK_DATA_H
+#define STOCK_DATA_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Logical price bounds used to clean unrealistic stock prices
+#define MIN_PRICE 0.01
+#define MAX_PRICE 10000.0
+
+// Allowed year range for safety (maps years to decade indices)
+#define MIN_YEAR_GLOBAL 1900
+#define MAX_YEAR_GLOBAL 2100
+#define MAX_DECADES (((MAX_YEAR_GLOBAL - MIN_YEAR_GLOBAL) / 10) + 1)
+
+// Files with at least this many rows are sorted with parallel tasks
+#define SORT_PARALLEL_MIN (1 << 18)
+
+// Price columns a series can carry (the day column is always present)
+#define COL_OPEN    (1u << 0)
+#define COL_HIGH    (1u << 1)
+#define COL_LOW     (1u << 2)
+#define COL_CLOSE   (1u << 3)
+#define COL_VOLUME  (1u << 4)
+#define COL_ALL     (COL_OPEN | COL_HIGH | COL_LOW | COL_CLOSE | COL_VOLUME)
+#define SERIES_COLUMNS 5
+
+// All rows of one stock file, stored column by column.
+// `day` is the trading date as days since 1970-01-01, so ordering and
+// decade lookups are plain integer operations.  Only the columns in
+// `columns` are loaded; the others stay NULL.
+typedef struct {
+    int    *day;
+    double *open, *high, *low, *close, *volume;
+    int n;
+    int cap;
+    unsigned columns;       // COL_* bits that are loaded
+    size_t text_bytes;      // CSV bytes the rows were parsed from
+} StockSeries;
+
+// Column k (0..SERIES_COLUMNS-1, in COL_* bit order) of a series
+static inline double **series_column(StockSeries *s, int k) {
+    double **cols[SERIES_COLUMNS] = { &s->open, &s->high, &s->low, &s->close, &s->volume };
+    return cols[k];
+}
+
+
+// ---------------------------------------------------------------------
+// Day keys
+// ---------------------------------------------------------------------
+
+// Days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's
+// days_from_civil)
+static inline int days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Open ends of a day range (no --from / --to)
+#define DAY_RANGE_MIN INT_MIN
+#define DAY_RANGE_MAX INT_MAX
+
+// Calendar year of a day key (inverse of days_from_civil, year only)
+static inline int day_year(int day) {
+    int z = day + 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    return yoe + era * 400 + (mp >= 10);
+}
+
+// Parse "YYYY-MM-DD" (or YYYY/MM/DD) into a day key.
+// Returns 0 on success, -1 if the text is not such a date.
+static inline int parse_day(const char *s, int *day) {
+    for (int i = 0; i < 10; i++) {
+        if (i == 4 || i == 7) {
+            if (s[i] != '-' && s[i] != '/') return -1;
+        } else if (s[i] < '0' || s[i] > '9') {
+            return -1;
+        }
+    }
+    int y = (s[0] - '0') * 1000 + (s[1] - '0') * 100 + (s[2] - '0') * 10 + (s[3] - '0');
+    int m = (s[5] - '0') * 10 + (s[6] - '0');
+    int d = (s[8] - '0') * 10 + (s[9] - '0');
+    if (m < 1 || m > 12 || d < 1 || d > 31) return -1;
+    *day = days_from_civil(y, m, d);
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------
+// Storage
+// ---------------------------------------------------------------------
+
+// Grow the series to `new_cap` rows inside the arena.
+// The arena holds the loaded double columns (in COL_* order) followed by
+// the day column, each `cap` entries long; on growth the columns are
+// moved (last one first) to their new offsets.
+static inline int series_reserve(StockSeries *s, NodeArena *arena, int new_cap) {
+    if (new_cap <= s->cap) return 0;
+
+    int ncols = __builtin_popcount(s->columns & COL_ALL);
+    size_t bytes = (size_t)new_cap * (ncols * sizeof(double) + sizeof(int));
+    unsigned char *base = (unsigned char *)arena_reserve(arena, bytes);
+    if (!base) return -1;
+
+    size_t old_col = (size_t)s->cap * sizeof(double);
+    size_t new_col = (size_t)new_cap * sizeof(double);
+    if (s->n > 0) {
+        memmove(base + ncols * new_col, base + ncols * old_col, (size_t)s->n * sizeof(int));
+        for (int r = ncols - 1; r >= 1; r--)
+            memmove(base + r * new_col, base + r * old_col, (size_t)s->n * sizeof(double));
+    }
+
+    int r = 0;
+    for (int k = 0; k < SERIES_COLUMNS; k++)
+        *series_column(s, k) = (s->columns & (1u << k))
+                               ? (double *)(base + (r++) * new_col) : NULL;
+    s->day = (int *)(base + ncols * new_col);
+    s->cap = new_cap;
+    arena->used = bytes;
+    return 0;
+}
+
+// Empty series that will load the given COL_* columns
+static inline void series_init(StockSeries *s, unsigned columns) {
+    memset(s, 0, sizeof(*s));
+    s->columns = columns & COL_ALL;
+}
+
+static inline void series_clear(StockSeries *s) {
+    series_init(s, s->columns);
+}
+
+
+// ---------------------------------------------------------------------
+// Chronological order
+// ---------------------------------------------------------------------
+
+#define SORT_RADIX_BITS 11
+#define SORT_RADIX      (1 << SORT_RADIX_BITS)
+#define SORT_BLOCKS     64
+
+// One stable LSD pass over (key, row) pairs on the digit at `shift`.
+// Rows are cut into SORT_BLOCKS blocks; each block counts its digits and
+// scatters its own rows, so both loops run as tasks on large inputs.
+static inline void sort_radix_pass(const unsigned *key_in, const int *row_in,
+                                   unsigned *key_out, int *row_out,
+                                   int n, int shift, unsigned *counts, int parallel) {
+    int blocks = parallel ? SORT_BLOCKS : 1;
+    int per_block = (n + blocks - 1) / blocks;
+    memset(counts, 0, sizeof(unsigned) * SORT_RADIX * blocks);
+
+    #pragma omp taskloop grainsize(1) if (parallel)
+    for (int b = 0; b < blocks; b++) {
+        unsigned *cnt = counts + (size_t)b * SORT_RADIX;
+        int lo = b * per_block, hi = lo + per_block < n ? lo + per_block : n;
+        for (int i = lo; i < hi; i++)
+            cnt[(key_in[i] >> shift) & (SORT_RADIX - 1)]++;
+    }
+
+    // exclusive prefix sum in (digit, block) order keeps the pass stable
+    unsigned sum = 0;
+    for (int d = 0; d < SORT_RADIX; d++)
+        for (int b = 0; b < blocks; b++) {
+            unsigned c = counts[(size_t)b * SORT_RADIX + d];
+            counts[(size_t)b * SORT_RADIX + d] = sum;
+            sum += c;
+        }
+
+    #pragma omp taskloop grainsize(1) if (parallel)
+    for (int b = 0; b < blocks; b++) {
+        unsigned *off = counts + (size_t)b * SORT_RADIX;
+        int lo = b * per_block, hi = lo + per_block < n ? lo + per_block : n;
+        for (int i = lo; i < hi; i++) {
+            unsigned pos = off[(key_in[i] >> shift) & (SORT_RADIX - 1)]++;
+            key_out[pos] = key_in[i];
+            row_out[pos] = row_in[i];
+        }
+    }
+}
+
+// Apply the permutation `rows` (length m) to one double column
+static inline void sort_gather(double *col, const int *rows, int m,
+                               double *tmp, int parallel) {
+    #pragma omp taskloop num_tasks(SORT_BLOCKS) if (parallel)
+    for (int i = 0; i < m; i++)
+        tmp[i] = col[rows[i]];
+    memcpy(col, tmp, (size_t)m * sizeof(double));
+}
+
+// Sort the series ascending by day with an LSD radix sort on the day key,
+// permuting every column, and drop rows that repeat a date (the first row
+// of each date in file order is kept).  Returns the new row count, or -1
+// if memory runs out (the series is then left untouched).
+static inline int series_sort_by_day(StockSeries *s) {
+    int n = s->n;
+    if (n <= 1) return n;
+
+    int min_day = s->day[0], max_day = s->day[0];
+    for (int i = 1; i < n; i++) {
+        if (s->day[i] < min_day) min_day = s->day[i];
+        if (s->day[i] > max_day) max_day = s->day[i];
+    }
+    unsigned range = (unsigned)(max_day - min_day);
+
+    int parallel = (n >= SORT_PARALLEL_MIN);
+    int blocks = parallel ? SORT_BLOCKS : 1;
+
+    unsigned *key_a = (unsigned *)malloc((size_t)n * sizeof(unsigned));
+    unsigned *key_b = (unsigned *)malloc((size_t)n * sizeof(unsigned));
+    int *row_a = (int *)malloc((size_t)n * sizeof(int));
+    int *row_b = (int *)malloc((size_t)n * sizeof(int));
+    unsigned *counts = (unsigned *)malloc(sizeof(unsigned) * SORT_RADIX * blocks);
+    double *tmp = (double *)malloc((size_t)n * sizeof(double));
+    if (!key_a || !key_b || !row_a || !row_b || !counts || !tmp) {
+        free(key_a); free(key_b); free(row_a); free(row_b); free(counts); free(tmp);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        key_a[i] = (unsigned)(s->day[i] - min_day);
+        row_a[i] = i;
+    }
+
+    // day ranges are small, so one or two 11-bit passes are typical
+    for (int shift = 0; shift < 32 && (shift == 0 || (range >> shift) != 0);
+         shift += SORT_RADIX_BITS) {
+        sort_radix_pass(key_a, row_a, key_b, row_b, n, shift, counts, parallel);
+        unsigned *kt = key_a; key_a = key_b; key_b = kt;
+        int *rt = row_a; row_a = row_b; row_b = rt;
+    }
+
+    // drop repeated dates while building the final permutation
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (m > 0 && key_a[i] == key_a[m - 1]) continue;
+        key_a[m] = key_a[i];
+        row_a[m] = row_a[i];
+        m++;
+    }
+
+    for (int k = 0; k < SERIES_COLUMNS; k++)
+        if (*series_column(s, k))
+            sort_gather(*series_column(s, k), row_a, m, tmp, parallel);
+    for (int i = 0; i < m; i++)
+        s->day[i] = (int)key_a[i] + min_day;
+    s->n = m;
+
+    free(key_a); free(key_b); free(row_a); free(row_b); free(counts); free(tmp);
+    return m;
+}
+
+#endif
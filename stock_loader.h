@@ -0,0 +1,431 @@
+#ifndef STOCK_LOADER_H
+#define STOCK_LOADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "csv_source.h"
+#include "csv_tokenizer.h"
+#include "decimal_parse.h"
+#include "stock_data.h"
+
+// Text window the tokenizer works on; it doubles whenever one line does
+// not fit, so there is no line-length limit.
+#define CSV_WINDOW (1 << 20)
+
+// Parse one numeric field spanning [p, end).  The number has to end
+// exactly at the separator (a trailing '\r' is allowed on the last field).
+static inline int parse_field_double(const char *p, const char *end, double *out) {
+    if (end > p && end[-1] == '\r') end--;
+    return parse_decimal(p, end, out);
+}
+
+// CSV field holding each COL_* column (field 0 is the date, 5 Adj Close)
+static const int csv_field_of_column[SERIES_COLUMNS] = { 1, 2, 3, 4, 6 };
+
+// What to load from a file: the column projection and the day range
+// (inclusive; DAY_RANGE_MIN / DAY_RANGE_MAX leave an end open)
+typedef struct {
+    unsigned columns;           // COL_* bits
+    int from_day;
+    int to_day;
+} LoadSpec;
+
+
+// ---------------------------------------------------------------------
+// Date-range pushdown
+// ---------------------------------------------------------------------
+
+// Plain files smaller than this are simply streamed and filtered
+#ifndef CSV_PUSHDOWN_MIN
+#define CSV_PUSHDOWN_MIN (256 * 1024)
+#endif
+
+// Start of the first line at or after byte `pos` (`size` if none)
+static inline size_t csv_line_at(const char *text, size_t size,
+                                 size_t data_start, size_t pos) {
+    if (pos <= data_start) return data_start;
+    const char *nl = (const char *)memchr(text + pos - 1, '\n', size - (pos - 1));
+    return nl ? (size_t)(nl - text) + 1 : size;
+}
+
+// Day key of the line starting at `line`; -1 if it has no date
+static inline int csv_line_day(const char *text, size_t size, size_t line, int *day) {
+    if (size - line < 10) return -1;
+    return parse_day(text + line, day);
+}
+
+// Byte range [lo, hi) of the rows of [from_day, to_day] in the CSV text
+// of a mapped file whose data starts at `data_start`.  Narrowing is only
+// safe when the whole file is in ascending date order (one row out of
+// place anywhere would be lost), so the date of every line is checked:
+// the lines are walked with memchr and only their leading date is
+// parsed, which is a fraction of the cost of tokenizing and converting
+// all the fields.  Returns 0, or -1 if a line is undated or the dates are
+// not strictly ascending (the file is then read and filtered in full).
+static inline int csv_pushdown_range(const char *text, size_t size, size_t data_start,
+                                     int from_day, int to_day, size_t *lo, size_t *hi) {
+    if (data_start >= size) return -1;
+    size_t l = size, h = size;
+    int prev = DAY_RANGE_MIN;
+    for (size_t line = data_start; line < size; ) {
+        const char *nl = (const char *)memchr(text + line, '\n', size - line);
+        size_t next = nl ? (size_t)(nl - text) + 1 : size;
+        int day;
+        if (next - line <= 2 && (text[line] == '\n' || text[line] == '\r')) {
+            line = next;                        // blank line
+            continue;
+        }
+        if (csv_line_day(text, size, line, &day) != 0 || (line > data_start && day <= prev))
+            return -1;
+        prev = day;
+        if (l == size && day >= from_day) l = line;
+        if (h == size && day > to_day) h = line;
+        line = next;
+    }
+    *lo = l < h ? l : h;
+    *hi = h;
+    return 0;
+}
+
+// Start of the line after the header of a mapped CSV file
+static inline size_t csv_data_start(const char *text, size_t size) {
+    const char *nl = (const char *)memchr(text, '\n', size);
+    return nl ? (size_t)(nl - text) + 1 : size;
+}
+
+// Open only the rows of [from_day, to_day] of a plain CSV file: the file
+// is mmapped, its line dates are checked to be in order and give the
+// first and last row of the range (csv_pushdown_range), and the source
+// serves just that slice (without the header line).
+// `bounded` is passed on to the slice source (see csv_source_open).
+// Returns 0 if the slice source is open, -1 to read the file normally.
+static inline int csv_pushdown_open(CsvSource *s, const char *path,
+                                    int from_day, int to_day, int bounded) {
+    size_t len = strlen(path);
+    if (!csv_has_suffix(path, len, ".csv")) return -1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < CSV_PUSHDOWN_MIN) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, size, MADV_SEQUENTIAL);
+    const char *text = (const char *)map;
+
+    size_t lo, hi;
+    if (csv_pushdown_range(text, size, csv_data_start(text, size),
+                           from_day, to_day, &lo, &hi) != 0) {
+        munmap(map, size);
+        return -1;
+    }
+
+    // only the slice is tokenized
+    csv_source_open_slice(s, map, size, lo, hi - lo);
+    s->bounded = bounded;
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------
+// Loader
+// ---------------------------------------------------------------------
+
+// Incremental reader of one CSV file: csv_stream_next() hands out the
+// rows in chunks of at most `max_rows`, so a file can be analysed in a
+// fixed amount of memory (see read_csv for the format and the parsing).
+typedef struct {
+    CsvSource file;
+    LoadSpec spec;
+    int n_proj;                 // fields to convert, as (CSV field,
+    int proj_field[SERIES_COLUMNS], proj_col[SERIES_COLUMNS];   // column)
+    int sliced;                 // only the rows of the day range are read
+    int header;                 // the next line is the header
+    int eof;
+    int ordered;                // dates strictly ascending so far
+    int last_day;               // day of the last row handed out
+    size_t have;                // bytes in the window
+    size_t n_sep;               // separators indexed so far
+    size_t row_start;           // byte where the next line starts
+    size_t k;                   // its first separator
+    size_t total, reported;     // text bytes read / already reported
+} CsvStream;
+
+// Memory a stream needs besides its row chunk: the text window, its
+// separator index and the source's two decoded blocks
+#define CSV_STREAM_FIXED ((size_t)CSV_WINDOW * (1 + sizeof(uint32_t)) + 2 * CSV_SOURCE_BLOCK)
+// Smallest budget a stream can work in (one minimal arena of rows)
+#define CSV_STREAM_MIN_BUDGET (CSV_STREAM_FIXED + ARENA_MIN_MAP)
+
+// Rows per chunk that keep one stream within `budget` bytes: the arena
+// left after the fixed buffers (rounded down to the power-of-two sizes
+// the arena maps) divided by the size of a row with `columns`.
+// Returns 0 if the budget does not cover the fixed buffers.
+static inline int csv_stream_rows(size_t budget, unsigned columns) {
+    if (budget < CSV_STREAM_MIN_BUDGET)
+        return 0;
+    size_t arena = ARENA_MIN_MAP;
+    while (arena * 2 <= budget - CSV_STREAM_FIXED && arena < ((size_t)1 << 40))
+        arena *= 2;
+    size_t row = sizeof(int) + (size_t)__builtin_popcount(columns & COL_ALL) * sizeof(double);
+    size_t rows = arena / row;
+    return rows > INT_MAX ? INT_MAX : (int)rows;
+}
+
+// per-thread text window and separator index, reused across files; a
+// thread has one stream open at a time
+static _Thread_local char *csv_win = NULL;
+static _Thread_local uint32_t *csv_idx = NULL;
+static _Thread_local size_t csv_win_cap = 0;
+
+// Projection and per-thread window shared by the csv_stream_open* calls.
+// Returns 0, or -1 if the window cannot be allocated.
+static inline int csv_stream_init(CsvStream *st, const LoadSpec *spec) {
+    memset(st, 0, sizeof(*st));
+    st->spec = *spec;
+    for (int c = 0; c < SERIES_COLUMNS; c++)
+        if (spec->columns & (1u << c)) {
+            st->proj_field[st->n_proj] = csv_field_of_column[c];
+            st->proj_col[st->n_proj++] = c;
+        }
+    st->ordered = 1;
+    st->last_day = DAY_RANGE_MIN;
+
+    // the window keeps DECIMAL_PAD spare bytes for the 8-byte number loads
+    if (!csv_win) {
+        csv_win = (char *)malloc(CSV_WINDOW + 1 + DECIMAL_PAD);
+        csv_idx = (uint32_t *)malloc((CSV_WINDOW + 1) * sizeof(uint32_t));
+        csv_win_cap = CSV_WINDOW;
+        if (!csv_win || !csv_idx) {
+            free(csv_win); free(csv_idx);
+            csv_win = NULL; csv_idx = NULL;
+            fprintf(stderr, "Memory allocation failed in read_csv\n");
+            return -1;
+        }
+        memset(csv_win + csv_win_cap + 1, 0, DECIMAL_PAD);
+    }
+    return 0;
+}
+
+// Open `filename` for csv_stream_next.  `pushdown` allows reading only
+// the slice of a sorted file that covers the day range; `bounded` keeps
+// the memory use independent of the file size (no whole-file decoding,
+// consumed slice pages are dropped).  Returns 0, or -1 on failure.
+static inline int csv_stream_open(CsvStream *st, const char *filename,
+                                  const LoadSpec *spec, int pushdown, int bounded) {
+    if (csv_stream_init(st, spec) != 0)
+        return -1;
+
+    int ranged = spec->from_day != DAY_RANGE_MIN || spec->to_day != DAY_RANGE_MAX;
+    if (pushdown && ranged)
+        st->sliced = csv_pushdown_open(&st->file, filename, spec->from_day,
+                                       spec->to_day, bounded) == 0;
+    if (!st->sliced && csv_source_open(&st->file, filename, bounded) != 0)
+        return -1;
+
+    st->header = !st->sliced;   // the first line is the header
+    return 0;
+}
+
+// Open whole CSV lines (no header) at `text` for csv_stream_next; the
+// text stays owned by the caller.  Returns 0, or -1 on failure.
+static inline int csv_stream_open_text(CsvStream *st, const char *text, size_t len,
+                                       const LoadSpec *spec) {
+    if (csv_stream_init(st, spec) != 0)
+        return -1;
+    csv_source_open_memory(&st->file, text, len);
+    st->sliced = 1;
+    return 0;
+}
+
+// Parse the next rows (at most `max_rows`, at least 1) into `series`,
+// whose columns live in `arena`; both are reset first.  Fewer than
+// `max_rows` rows means the file is finished.  `series->text_bytes` is
+// the text read for this chunk.  Returns the row count (0 at the end),
+// or -1 if memory runs out (message already printed).
+static inline int csv_stream_next(CsvStream *st, StockSeries *series, NodeArena *arena,
+                                  int max_rows) {
+    series_init(series, st->spec.columns);
+    arena_reset(arena);
+
+    char *win = csv_win;
+    uint32_t *idx = csv_idx;
+    int count = 0;
+    int failed = 0;
+
+    while (!failed) {
+        // (1) convert every complete line in the window
+        size_t row_start = st->row_start;
+        size_t k = st->k;
+        while (k < st->n_sep && count < max_rows) {
+            // find the end of the line
+            size_t e = k;
+            while (e < st->n_sep && win[idx[e]] != '\n') e++;
+            if (e == st->n_sep) break;              // incomplete line
+
+            size_t commas = e - k;
+            size_t line_end = idx[e];
+
+            if (st->header) {
+                st->header = 0;
+            } else if (commas >= 6) {
+                // Grow columns if needed
+                if (count >= series->cap) {
+                    int new_cap = (series->cap == 0) ? 1024 : series->cap * 2;
+                    if (new_cap > max_rows) new_cap = max_rows;
+                    series->n = count;
+                    if (series_reserve(series, arena, new_cap) != 0) {
+                        failed = 1;
+                        break;
+                    }
+                }
+
+                // field f spans [idx[k + f - 1] + 1, idx[k + f]); field 0
+                // starts at row_start
+                const char *t = win;
+                int day;
+                int ok = idx[k] - row_start >= 10 && parse_day(t + row_start, &day) == 0 &&
+                         day >= st->spec.from_day && day <= st->spec.to_day;
+                for (int j = 0; ok && j < st->n_proj; j++) {
+                    size_t f = (size_t)st->proj_field[j];
+                    double *col = *series_column(series, st->proj_col[j]);
+                    ok = parse_field_double(t + idx[k + f - 1] + 1, t + idx[k + f],
+                                            &col[count]) == 0;
+                }
+
+                // Only accept fully parsed lines with a valid date
+                if (ok) {
+                    series->day[count] = day;
+                    if (day <= st->last_day)
+                        st->ordered = 0;
+                    st->last_day = day;
+                    count++;
+                }
+            }
+
+            row_start = line_end + 1;
+            k = e + 1;
+        }
+        st->row_start = row_start;
+        st->k = k;
+        if (failed || count == max_rows || st->eof)
+            break;
+
+        // (2) keep the unfinished line at the front of the window
+        size_t rest = st->have - row_start;
+        memmove(win, win + row_start, rest);
+        for (size_t j = k; j < st->n_sep; j++)
+            idx[j - k] = idx[j] - (uint32_t)row_start;
+        st->n_sep -= k;
+        st->have = rest;
+        st->row_start = 0;
+        st->k = 0;
+
+        // (3) refill the window; grow it if one line fills it completely
+        if (st->have == csv_win_cap) {
+            size_t new_cap = csv_win_cap * 2;
+            char *w = (char *)realloc(csv_win, new_cap + 1 + DECIMAL_PAD);
+            if (w) csv_win = win = w;
+            uint32_t *x = (uint32_t *)realloc(csv_idx, (new_cap + 1) * sizeof(uint32_t));
+            if (x) csv_idx = idx = x;
+            if (!w || !x) { failed = 1; break; }
+            csv_win_cap = new_cap;
+            memset(win + csv_win_cap + 1, 0, DECIMAL_PAD);
+        }
+        long got = csv_source_read(&st->file, win + st->have, csv_win_cap - st->have);
+        if (got <= 0) {
+            st->eof = 1;
+        } else {
+            st->n_sep += csv_index_structurals(win, st->have, st->have + (size_t)got,
+                                               idx + st->n_sep);
+            st->have += (size_t)got;
+            st->total += (size_t)got;
+        }
+        if (st->eof && st->have > 0 && win[st->have - 1] != '\n') {
+            // last line without a newline
+            win[st->have] = '\n';
+            idx[st->n_sep++] = (uint32_t)st->have;
+            st->have++;
+        }
+    }
+
+    series->n = count;
+    series->text_bytes = st->total - st->reported;
+    st->reported = st->total;
+
+    if (failed) {
+        fprintf(stderr, "Memory allocation failed in read_csv\n");
+        series_clear(series);
+        return -1;
+    }
+    return count;
+}
+
+static inline void csv_stream_close(CsvStream *st) {
+    csv_source_close(&st->file);
+}
+
+// Read one CSV file into `series`, whose columns live in `arena`.
+// Expected CSV format: Date,Open,High,Low,Close,Adj Close,Volume
+//
+// `spec->columns` (COL_* bits) is the projection: only those fields are
+// converted and stored.  The other fields are skipped by jumping to the
+// next separator, so e.g. a returns-only run converts just date and close.
+// Rows outside [spec->from_day, spec->to_day] are dropped right after
+// their date is parsed; on large plain files whose dates are all in
+// order the range is pushed down further and only the rows inside it are
+// tokenized at all (see csv_pushdown_open).
+//
+// The text is read in large windows; csv_index_structurals() finds every
+// ',' and '\n' of a window in one SIMD pass and the fields are converted
+// straight from the separator positions (no fgets/sscanf, no line limit).
+//
+// The rows are written by the calling thread, so in the OpenMP driver the
+// pages are first-touched on the node of the thread that analyses them.
+// While parsing we check that the dates are strictly ascending; files
+// that come newest-first, shuffled or with repeated dates are put in
+// chronological order (duplicates dropped) before returning.
+// `pushdown` = 0 always reads the whole file.  Returns number of rows.
+static inline int read_csv_rows(const char *filename, StockSeries *series, NodeArena *arena,
+                                const LoadSpec *spec, int pushdown) {
+    CsvStream st;
+    if (csv_stream_open(&st, filename, spec, pushdown, 0) != 0) {
+        series_init(series, spec->columns);
+        return 0;
+    }
+    int n = csv_stream_next(&st, series, arena, INT_MAX);
+    int sliced = st.sliced, ordered = st.ordered;
+    csv_stream_close(&st);
+    if (n < 0)
+        return 0;
+
+    // a slice is only trusted if its rows really were in order
+    if (sliced && !ordered)
+        return read_csv_rows(filename, series, arena, spec, 0);
+
+    if (!ordered && series_sort_by_day(series) < 0) {
+        fprintf(stderr, "Memory allocation failed while sorting %s\n", filename);
+        series_clear(series);
+        return 0;
+    }
+    return series->n;
+}
+
+static inline int read_csv(const char *filename, StockSeries *series, NodeArena *arena,
+                           const LoadSpec *spec) {
+    return read_csv_rows(filename, series, arena, spec, 1);
+}
+
+#endif
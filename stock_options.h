@@ -0,0 +1,238 @@
+#ifndef STOCK_OPTIONS_H
+#define STOCK_OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decade_stats.h"
+
+// Command line options shared by the drivers:
+//   <stocks_directory> [--metrics=prices,returns] [--from=DATE] [--to=DATE]
+//                      [--cache=DIR] [--cache-compress]
+//                      [--cache-precision=double|float32|micro] [--validate]
+//                      [--mem-budget=MB] [--huge-pages=off|thp|hugetlb]
+//                      [--populate] [--counters] [--autotune[=FILE]]
+//                      [--pipeline=READERS] [--manifest=FILE] [--build-cache]
+//                      [--years=DIR] [--market] [--recursive]
+// DATE is YYYY or YYYY-MM-DD; both ends are inclusive, so
+// --from=2000 --to=2009 selects the 2000s.  --cache reads the files
+// through the binary column cache in DIR (built on first use),
+// --cache-compress keeps its columns encoded and --cache-precision
+// stores OHLC as float32 or int64 micro-units.  --validate (serial
+// version) checks the cached statistics against the double CSV path.
+// --mem-budget streams every file in fixed-size row chunks so the whole
+// run stays within MB megabytes of buffers, whatever the file sizes (the
+// OpenMP version splits the budget between its threads).
+// --huge-pages picks the pages of the row buffers and cache maps (see
+// arena.h), --populate prefaults them and --counters reports dTLB
+// misses, page faults and scan time.  --autotune (OpenMP version) picks
+// threads, schedule and file splitting from a profile stored in FILE
+// (default ~/.stock_autotune), measuring one first if there is none.
+// --pipeline (OpenMP version) dedicates READERS threads to reading and
+// parsing files and hands them to the other threads through a ring.
+// --manifest maps the file list from the binary manifest FILE, listing
+// the directory (and saving the manifest) only when it has changed.
+// --build-cache converts every file into the --cache directory, in
+// parallel, and exits; a cache built this way is used without listing
+// the CSV directory again.  --years reads the rows from the year layout
+// in DIR (see year_layout.h; built from the CSVs when it is missing or
+// stale), so workers take whole years and a date range only opens the
+// years it overlaps.  --market also merges the rows of all files by
+// date and reports the equal-weight market and the daily breadth and
+// dispersion of returns per decade (market_stats.h, market_breadth.h);
+// with --years it reads the same cross-sections straight from the year
+// segments in one pass instead of merging the files.
+// --recursive also analyses the files in the subdirectories of the
+// stocks directory (datasets sharded as stocks/A/AAPL.csv, ...).
+typedef struct {
+    const char *dirpath;
+    unsigned metrics;           // METRIC_* bits to compute
+    int from_day;               // day range to analyse (DAY_RANGE_* = open)
+    int to_day;
+    const char *cache_dir;      // binary column cache (NULL = read the CSVs)
+    unsigned cache_flags;       // CACHE_* layout and precision
+    int validate;
+    size_t mem_budget;          // streaming budget in bytes (0 = load whole files)
+    int page_mode;              // PAGES_* for large buffers
+    int populate;               // prefault large buffers
+    int counters;               // print the counters block
+    int autotune;               // use / measure a tuning profile
+    const char *autotune_file;  // profile store (NULL = default)
+    int readers;                // reader threads of --pipeline (0 = off)
+    const char *manifest;       // binary file list (NULL = list the directory)
+    int build_cache;            // convert the directory into the cache and exit
+    const char *years_dir;      // year layout (NULL = per-file reads)
+    int market;                 // also report the merged market-wide series
+    int recursive;              // list subdirectories too
+} StockOptions;
+
+#define STOCK_OPTIONS_USAGE \
+    "<stocks_directory> [--metrics=prices,returns] [--from=DATE] [--to=DATE]" \
+    " [--cache=DIR] [--cache-compress] [--cache-precision=double|float32|micro] [--validate]" \
+    " [--mem-budget=MB] [--huge-pages=off|thp|hugetlb] [--populate] [--counters]" \
+    " [--autotune[=FILE]] [--pipeline=READERS] [--manifest=FILE] [--build-cache] [--years=DIR]" \
+    " [--market] [--recursive]"
+
+// "prices,returns" -> METRIC_* bits (0 on an unknown name)
+static inline unsigned parse_metrics(const char *list) {
+    unsigned m = 0;
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        if (len == 6 && strncmp(list, "prices", 6) == 0)       m |= METRIC_PRICES;
+        else if (len == 7 && strncmp(list, "returns", 7) == 0) m |= METRIC_RETURNS;
+        else return 0;
+        list += len;
+        if (*list == ',') list++;
+    }
+    return m;
+}
+
+// "YYYY" or "YYYY-MM-DD" -> day key; a bare year means its first day, or
+// its last day when `end` is set.  Returns 0 on success, -1 otherwise.
+static inline int parse_date_bound(const char *text, int end, int *day) {
+    size_t len = strlen(text);
+    if (len == 10)
+        return parse_day(text, day);
+    if (len != 4 || strspn(text, "0123456789") != 4)
+        return -1;
+    int y = atoi(text);
+    *day = end ? days_from_civil(y, 12, 31) : days_from_civil(y, 1, 1);
+    return 0;
+}
+
+// Returns 0 on success, -1 on bad usage (message already printed)
+static inline int parse_options(int argc, char *argv[], StockOptions *o) {
+    o->dirpath = NULL;
+    o->metrics = METRIC_PRICES | METRIC_RETURNS;
+    o->from_day = DAY_RANGE_MIN;
+    o->to_day = DAY_RANGE_MAX;
+    o->cache_dir = NULL;
+    o->cache_flags = 0;
+    o->validate = 0;
+    o->mem_budget = 0;
+    o->page_mode = PAGES_THP;
+    o->populate = 0;
+    o->counters = 0;
+    o->autotune = 0;
+    o->autotune_file = NULL;
+    o->readers = 0;
+    o->manifest = NULL;
+    o->build_cache = 0;
+    o->years_dir = NULL;
+    o->market = 0;
+    o->recursive = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (strncmp(a, "--metrics=", 10) == 0) {
+            o->metrics = parse_metrics(a + 10);
+            if (!o->metrics) {
+                fprintf(stderr, "Unknown metric list: %s\n", a + 10);
+                return -1;
+            }
+        } else if (strncmp(a, "--from=", 7) == 0 || strncmp(a, "--to=", 5) == 0) {
+            int end = (a[2] == 't');
+            const char *date = strchr(a, '=') + 1;
+            if (parse_date_bound(date, end, end ? &o->to_day : &o->from_day) != 0) {
+                fprintf(stderr, "Bad date: %s (expected YYYY or YYYY-MM-DD)\n", date);
+                return -1;
+            }
+        } else if (strncmp(a, "--cache=", 8) == 0 && a[8]) {
+            o->cache_dir = a + 8;
+        } else if (strcmp(a, "--cache-compress") == 0) {
+            o->cache_flags |= CACHE_COMPRESSED;
+        } else if (strncmp(a, "--cache-precision=", 18) == 0) {
+            const char *mode = a + 18;
+            o->cache_flags &= ~(CACHE_FLOAT32 | CACHE_MICRO);
+            if (strcmp(mode, "float32") == 0)    o->cache_flags |= CACHE_FLOAT32;
+            else if (strcmp(mode, "micro") == 0) o->cache_flags |= CACHE_MICRO;
+            else if (strcmp(mode, "double") != 0) {
+                fprintf(stderr, "Unknown cache precision: %s\n", mode);
+                return -1;
+            }
+        } else if (strcmp(a, "--validate") == 0) {
+            o->validate = 1;
+        } else if (strncmp(a, "--mem-budget=", 13) == 0) {
+            char *stop;
+            unsigned long mb = strtoul(a + 13, &stop, 10);
+            if (mb == 0 || *stop) {
+                fprintf(stderr, "Bad memory budget: %s (expected megabytes)\n", a + 13);
+                return -1;
+            }
+            o->mem_budget = (size_t)mb << 20;
+        } else if (strncmp(a, "--huge-pages=", 13) == 0) {
+            const char *mode = a + 13;
+            if (strcmp(mode, "off") == 0)           o->page_mode = PAGES_SMALL;
+            else if (strcmp(mode, "thp") == 0)      o->page_mode = PAGES_THP;
+            else if (strcmp(mode, "hugetlb") == 0)  o->page_mode = PAGES_HUGETLB;
+            else {
+                fprintf(stderr, "Unknown page mode: %s\n", mode);
+                return -1;
+            }
+        } else if (strcmp(a, "--populate") == 0) {
+            o->populate = 1;
+        } else if (strcmp(a, "--counters") == 0) {
+            o->counters = 1;
+        } else if (strcmp(a, "--autotune") == 0 || strncmp(a, "--autotune=", 11) == 0) {
+            o->autotune = 1;
+            o->autotune_file = a[10] == '=' ? a + 11 : NULL;
+        } else if (strncmp(a, "--pipeline=", 11) == 0) {
+            char *stop;
+            long r = strtol(a + 11, &stop, 10);
+            if (r < 1 || r > 4096 || *stop) {
+                fprintf(stderr, "Bad reader count: %s\n", a + 11);
+                return -1;
+            }
+            o->readers = (int)r;
+        } else if (strncmp(a, "--manifest=", 11) == 0 && a[11]) {
+            o->manifest = a + 11;
+        } else if (strcmp(a, "--build-cache") == 0) {
+            o->build_cache = 1;
+        } else if (strncmp(a, "--years=", 8) == 0 && a[8]) {
+            o->years_dir = a + 8;
+        } else if (strcmp(a, "--market") == 0) {
+            o->market = 1;
+        } else if (strcmp(a, "--recursive") == 0) {
+            o->recursive = 1;
+        } else if (a[0] == '-' && a[1] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", a);
+            return -1;
+        } else if (!o->dirpath) {
+            o->dirpath = a;
+        } else {
+            return -1;
+        }
+    }
+    if (o->validate && !o->cache_dir) {
+        fprintf(stderr, "--validate needs --cache=DIR\n");
+        return -1;
+    }
+    if (o->build_cache && !o->cache_dir) {
+        fprintf(stderr, "--build-cache needs --cache=DIR\n");
+        return -1;
+    }
+    if (o->mem_budget && o->cache_dir) {
+        fprintf(stderr, "--mem-budget streams the CSVs and cannot be combined with --cache\n");
+        return -1;
+    }
+    if (o->readers && (o->cache_dir || o->mem_budget)) {
+        fprintf(stderr, "--pipeline reads whole CSV files and cannot be combined with"
+                        " --cache or --mem-budget\n");
+        return -1;
+    }
+    if (o->market && o->mem_budget) {
+        fprintf(stderr, "--market keeps the closes of every file in memory and cannot be"
+                        " combined with --mem-budget\n");
+        return -1;
+    }
+    if (o->years_dir && (o->cache_dir || o->mem_budget || o->readers || o->autotune)) {
+        fprintf(stderr, "--years reads the year layout and cannot be combined with --cache,"
+                        " --mem-budget, --pipeline or --autotune\n");
+        return -1;
+    }
+    arena_set_pages(o->page_mode, o->populate);
+    return o->dirpath ? 0 : -1;
+}
+
+#endif
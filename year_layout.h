@@ -0,0 +1,794 @@
+#ifndef YEAR_LAYOUT_H
+#define YEAR_LAYOUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include "arena.h"
+#include "catalog.h"
+#include "decade_stats.h"
+#include "stock_data.h"
+#include "stock_loader.h"
+
+// Time-partitioned copy of a dataset (--years=DIR).
+//
+// The CSVs hold one ticker each, so a decade (or a single day) touches
+// every file.  The year layout stores the same rows cut by calendar year
+// instead: DIR/<year>.seg holds the rows of every ticker in that year,
+// sorted by (day, ticker), column by column:
+//
+//   YearSegHeader | day int32[rows] | ticker int32[rows] | open | high | low
+//                 | close | volume (double[rows]) | count int32[tickers]
+//                 | carry_day int32[tickers] | carry_close double[tickers]
+//
+// `ticker` is the catalog's ticker id (the files of one ticker form one
+// series).  count[t] is the number of rows of ticker t in the year and
+// carry_* its last row before the year, so the return into a year's first
+// day is computed without opening the year before.  Segments are thus
+// independent: workers take whole years, a --from/--to query maps only
+// the years it overlaps, and the rows of one day are one contiguous run.
+//
+// DIR/years.idx lists the years and the ticker names and carries a
+// fingerprint of the catalog (paths, sizes, mtimes).  It is written last,
+// so a layout is either complete and current or rebuilt.  A build takes
+// two passes and holds at most one year per thread in memory: the threads
+// parse the files and spill their rows to one file per year, then every
+// year is sorted and written on its own.
+
+#define YEAR_SEG_MAGIC    "STKYSEG1"
+#define YEAR_INDEX_MAGIC  "STKYIDX1"
+#define YEAR_INDEX_FILE   "years.idx"
+#define YEAR_ALIGN        64
+#define YEAR_LAYOUT_YEARS 10000         // parse_day reads four-digit years
+#define YEAR_SPILL_ROWS   1024          // rows buffered per thread and year
+#define YEAR_NO_DAY       INT_MIN       // carry_day of a ticker with no earlier row
+
+typedef struct {
+    char magic[8];
+    int32_t year;
+    int32_t tickers;
+    int64_t rows;
+    uint64_t day_off, ticker_off;       // section offsets from the start of the file
+    uint64_t col_off[SERIES_COLUMNS];
+    uint64_t count_off, carry_day_off, carry_close_off;
+    uint64_t total_bytes;
+} YearSegHeader;
+
+// years.idx: YearIndexHeader | int32 years[segments] | int64 rows[segments]
+//            | ticker names (NUL terminated, in id order)
+typedef struct {
+    char magic[8];
+    uint64_t fingerprint;
+    int32_t tickers;
+    int32_t segments;
+    uint64_t names_bytes;
+} YearIndexHeader;
+
+typedef struct {
+    char dir[4096];
+    uint64_t fingerprint;
+    int tickers;
+    int segments;
+    int *years;                 // ascending
+    long long *rows;            // rows per segment
+    char *names;                // ticker names, NUL separated, in id order
+    size_t names_bytes;
+} YearLayout;
+
+// One mapped segment
+typedef struct {
+    const YearSegHeader *h;
+    size_t len;
+    const int32_t *day, *ticker;
+    const double *col[SERIES_COLUMNS];
+    const int32_t *count, *carry_day;
+    const double *carry_close;
+} YearSegment;
+
+// One row on its way through the spill files
+typedef struct {
+    int32_t day, ticker;
+    double col[SERIES_COLUMNS];
+} YearRow;
+
+static inline uint64_t year_align(uint64_t n) {
+    return (n + YEAR_ALIGN - 1) & ~(uint64_t)(YEAR_ALIGN - 1);
+}
+
+static inline uint64_t year_hash(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;          // FNV-1a
+    }
+    return h;
+}
+
+// Fingerprint of the files of a catalog: a sum of per-file hashes, so it
+// does not depend on the order the catalog lists them in
+static inline uint64_t year_layout_fingerprint(const Catalog *c) {
+    uint64_t fp = (uint64_t)c->count;
+    for (int i = 0; i < c->count; i++) {
+        const char *rel = catalog_relpath(c, i);
+        uint64_t h = year_hash(0xcbf29ce484222325ULL, rel, strlen(rel) + 1);
+        h = year_hash(h, &c->entries[i].size, sizeof(c->entries[i].size));
+        fp += year_hash(h, &c->entries[i].mtime, sizeof(c->entries[i].mtime));
+    }
+    return fp;
+}
+
+// Header (section offsets) of a segment of `rows` rows
+static inline void year_seg_header(YearSegHeader *h, int year, int tickers, long long rows) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, YEAR_SEG_MAGIC, 8);
+    h->year = year;
+    h->tickers = tickers;
+    h->rows = rows;
+    h->day_off = year_align(sizeof(*h));
+    h->ticker_off = year_align(h->day_off + (uint64_t)rows * sizeof(int32_t));
+    uint64_t off = year_align(h->ticker_off + (uint64_t)rows * sizeof(int32_t));
+    for (int k = 0; k < SERIES_COLUMNS; k++) {
+        h->col_off[k] = off;
+        off = year_align(off + (uint64_t)rows * sizeof(double));
+    }
+    h->count_off = off;
+    h->carry_day_off = year_align(h->count_off + (uint64_t)tickers * sizeof(int32_t));
+    h->carry_close_off = year_align(h->carry_day_off + (uint64_t)tickers * sizeof(int32_t));
+    h->total_bytes = h->carry_close_off + (uint64_t)tickers * sizeof(double);
+}
+
+static inline int year_seg_path(char *out, size_t cap, const char *dir, int year,
+                                const char *suffix) {
+    int len = snprintf(out, cap, "%s/%d.seg%s", dir, year, suffix);
+    return len < 0 || (size_t)len >= cap ? -1 : 0;
+}
+
+static inline int year_write_all(int fd, const void *buf, size_t len) {
+    for (size_t done = 0; done < len; ) {
+        ssize_t w = write(fd, (const char *)buf + done, len - done);
+        if (w <= 0) return -1;
+        done += (size_t)w;
+    }
+    return 0;
+}
+
+static inline void year_layout_free(YearLayout *L) {
+    free(L->years);
+    free(L->rows);
+    free(L->names);
+    memset(L, 0, sizeof(*L));
+}
+
+
+// ---------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------
+
+// Load DIR/years.idx.  Returns 0, or 1 if it is missing, damaged or was
+// built from other files than `fingerprint` describes.
+static inline int year_layout_open(YearLayout *L, const char *dir, uint64_t fingerprint) {
+    memset(L, 0, sizeof(*L));
+    char path[4096 + 32];
+    snprintf(path, sizeof(path), "%s/" YEAR_INDEX_FILE, dir);
+    FILE *f = fopen(path, "rb");
+    if (!f) return 1;
+
+    YearIndexHeader h;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, YEAR_INDEX_MAGIC, 8) == 0 &&
+             h.fingerprint == fingerprint && h.tickers >= 0 && h.segments >= 0 &&
+             h.names_bytes < (1ULL << 40);
+    if (ok) {
+        L->years = (int *)malloc((h.segments ? h.segments : 1) * sizeof(int));
+        L->rows = (long long *)malloc((h.segments ? h.segments : 1) * sizeof(long long));
+        L->names = (char *)malloc(h.names_bytes + 1);
+        ok = L->years && L->rows && L->names;
+    }
+    for (int k = 0; ok && k < h.segments; k++) {
+        int32_t y;
+        ok = fread(&y, sizeof(y), 1, f) == 1 && y >= 0 && y < YEAR_LAYOUT_YEARS &&
+             (k == 0 || y > L->years[k - 1]);
+        if (ok) L->years[k] = y;
+    }
+    for (int k = 0; ok && k < h.segments; k++) {
+        int64_t r;
+        ok = fread(&r, sizeof(r), 1, f) == 1 && r > 0;
+        if (ok) L->rows[k] = r;
+    }
+    ok = ok && fread(L->names, 1, h.names_bytes, f) == h.names_bytes;
+    fclose(f);
+    if (!ok) {
+        year_layout_free(L);
+        return 1;
+    }
+    L->names[h.names_bytes] = '\0';
+    snprintf(L->dir, sizeof(L->dir), "%s", dir);
+    L->fingerprint = fingerprint;
+    L->tickers = h.tickers;
+    L->segments = h.segments;
+    L->names_bytes = h.names_bytes;
+    return 0;
+}
+
+// Map segment k of the layout.  Returns 0, or -1 if it is missing or
+// does not match the index.
+static inline int year_segment_map(YearSegment *s, const YearLayout *L, int k) {
+    memset(s, 0, sizeof(*s));
+    char path[4096 + 32];
+    if (year_seg_path(path, sizeof(path), L->dir, L->years[k], "") != 0) return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(YearSegHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const YearSegHeader *h = (const YearSegHeader *)map;
+    YearSegHeader want;
+    year_seg_header(&want, L->years[k], L->tickers, L->rows[k]);
+    if (memcmp(h, &want, sizeof(want)) != 0 || h->total_bytes != len) {
+        munmap(map, len);
+        return -1;
+    }
+    const char *base = (const char *)map;
+    s->h = h;
+    s->len = len;
+    s->day = (const int32_t *)(base + h->day_off);
+    s->ticker = (const int32_t *)(base + h->ticker_off);
+    for (int c = 0; c < SERIES_COLUMNS; c++)
+        s->col[c] = (const double *)(base + h->col_off[c]);
+    s->count = (const int32_t *)(base + h->count_off);
+    s->carry_day = (const int32_t *)(base + h->carry_day_off);
+    s->carry_close = (const double *)(base + h->carry_close_off);
+    return 0;
+}
+
+static inline void year_segment_unmap(YearSegment *s) {
+    if (s->h) munmap((void *)s->h, s->len);
+    s->h = NULL;
+}
+
+// First row of a segment on or after `day`
+static inline long long year_segment_lower(const YearSegment *s, int day) {
+    long long lo = 0, hi = s->h->rows;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        if (s->day[mid] < day) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Rows [*lo, *hi) of a segment fall in [from_day, to_day]
+static inline void year_segment_range(const YearSegment *s, int from_day, int to_day,
+                                      long long *lo, long long *hi) {
+    *lo = from_day == DAY_RANGE_MIN ? 0 : year_segment_lower(s, from_day);
+    *hi = to_day == DAY_RANGE_MAX ? s->h->rows : year_segment_lower(s, to_day + 1);
+}
+
+// Segments [*first, *last) overlap [from_day, to_day]
+static inline void year_layout_span(const YearLayout *L, int from_day, int to_day,
+                                    int *first, int *last) {
+    int y0 = from_day == DAY_RANGE_MIN ? INT_MIN : day_year(from_day);
+    int y1 = to_day == DAY_RANGE_MAX ? INT_MAX : day_year(to_day);
+    *first = 0;
+    while (*first < L->segments && L->years[*first] < y0) (*first)++;
+    *last = *first;
+    while (*last < L->segments && L->years[*last] <= y1) (*last)++;
+}
+
+// Mark in ok[tickers] the tickers with at least two rows in [from_day,
+// to_day]: the CSV path skips a file it reads one row from, so those add
+// nothing here either.  Years inside the range take the stored counts,
+// the (at most two) cut years are counted row by row.  Returns 0 or -1.
+static inline int year_layout_active(const YearLayout *L, int from_day, int to_day,
+                                     unsigned char *ok) {
+    int first, last;
+    year_layout_span(L, from_day, to_day, &first, &last);
+    long long *rows = (long long *)calloc(L->tickers ? L->tickers : 1, sizeof(long long));
+    if (!rows) return -1;
+    for (int k = first; k < last; k++) {
+        YearSegment s;
+        if (year_segment_map(&s, L, k) != 0) {
+            free(rows);
+            return -1;
+        }
+        int y = L->years[k];
+        if (from_day <= days_from_civil(y, 1, 1) && to_day >= days_from_civil(y, 12, 31)) {
+            for (int t = 0; t < L->tickers; t++) rows[t] += s.count[t];
+        } else {
+            long long lo, hi;
+            year_segment_range(&s, from_day, to_day, &lo, &hi);
+            for (long long i = lo; i < hi; i++) rows[s.ticker[i]]++;
+        }
+        year_segment_unmap(&s);
+    }
+    for (int t = 0; t < L->tickers; t++) ok[t] = rows[t] > 1;
+    free(rows);
+    return 0;
+}
+
+// Add the rows of one segment in [from_day, to_day] of the tickers set in
+// `ok` (NULL = all) to `acc`, exactly as decade_acc_add_series adds them
+// per file: a return pairs a ticker's row with its previous row in the
+// range, which for the first row of the year is the carried-in row.
+// prev_day / prev_close are scratch arrays of L->tickers entries.
+static inline void year_segment_add(DecadeAcc *acc, const YearSegment *s, unsigned metrics,
+                                    int from_day, int to_day, const unsigned char *ok,
+                                    int *prev_day, double *prev_close) {
+    long long lo, hi;
+    year_segment_range(s, from_day, to_day, &lo, &hi);
+    const int32_t *tk = s->ticker;
+
+    int used = 0;
+    for (long long i = lo; i < hi && !used; i++)
+        used = !ok || ok[tk[i]];
+    if (!used)
+        return;
+    int year = s->h->year;
+    if (year < acc->min_year) acc->min_year = year;
+    if (year > acc->max_year) acc->max_year = year;
+
+    // one year is one decade
+    int decade_index = decade_index_of_year(year);
+    if ((metrics & METRIC_PRICES) && decade_index >= 0) {
+        const double *o = s->col[0], *h = s->col[1], *l = s->col[2], *c = s->col[3];
+        for (long long i = lo; i < hi; i++) {
+            if (ok && !ok[tk[i]])
+                continue;
+            if (o[i] >= MIN_PRICE && o[i] <= MAX_PRICE &&
+                h[i] >= MIN_PRICE && h[i] <= MAX_PRICE &&
+                l[i] >= MIN_PRICE && l[i] <= MAX_PRICE &&
+                c[i] >= MIN_PRICE && c[i] <= MAX_PRICE)
+            {
+                acc->sum_avg[decade_index] += (o[i] + h[i] + l[i] + c[i]) / 4.0;
+                acc->rows[decade_index]    += 1;
+            }
+        }
+    }
+
+    if (metrics & METRIC_RETURNS) {
+        int n = s->h->tickers;
+        for (int t = 0; t < n; t++) {
+            int cd = s->carry_day[t];
+            prev_day[t] = cd != YEAR_NO_DAY && cd >= from_day ? cd : YEAR_NO_DAY;
+            prev_close[t] = s->carry_close[t];
+        }
+        const double *close = s->col[3];
+        for (long long i = lo; i < hi; i++) {
+            int t = tk[i];
+            if (ok && !ok[t])
+                continue;
+            if (prev_day[t] != YEAR_NO_DAY)
+                decade_acc_add_return(acc, prev_day[t], prev_close[t], close[i]);
+            prev_day[t] = s->day[i];
+            prev_close[t] = close[i];
+        }
+    }
+}
+
+static inline int year_cmp_rows_desc(const void *a, const void *b, void *rows) {
+    long long x = ((const long long *)rows)[*(const int *)a];
+    long long y = ((const long long *)rows)[*(const int *)b];
+    if (x != y) return x < y ? 1 : -1;
+    return *(const int *)a - *(const int *)b;
+}
+
+// Decade statistics of the rows in [from_day, to_day]: the years the
+// range overlaps, largest first, are dealt round-robin to `parts` workers
+// (MPI ranks) and this one adds the years of `part`, one year at a time
+// per thread when `parallel` is set.  *touched counts the segments read
+// and *bytes their column bytes.  Returns 0, or -1 if a segment cannot be
+// read.
+static inline int year_layout_scan(const YearLayout *L, DecadeAcc *totals, unsigned metrics,
+                                   int from_day, int to_day, int part, int parts,
+                                   int parallel, int *touched, double *bytes) {
+    int first, last;
+    year_layout_span(L, from_day, to_day, &first, &last);
+    *touched = 0;
+    *bytes = 0.0;
+    if (first == last)
+        return 0;
+
+    unsigned char *ok = NULL;
+    if (from_day != DAY_RANGE_MIN || to_day != DAY_RANGE_MAX) {
+        ok = (unsigned char *)malloc(L->tickers ? L->tickers : 1);
+        if (!ok || year_layout_active(L, from_day, to_day, ok) != 0) {
+            free(ok);
+            return -1;
+        }
+    }
+    int *order = (int *)malloc((last - first) * sizeof(int));
+    if (!order) {
+        free(ok);
+        return -1;
+    }
+    int n = 0;
+    for (int k = first; k < last; k++) order[n++] = k;
+    qsort_r(order, n, sizeof(int), year_cmp_rows_desc, L->rows);
+    int mine = 0;
+    for (int j = part; j < n; j += parts) order[mine++] = order[j];
+
+    int failed = 0, mapped = 0;
+    double scanned = 0.0;
+    #pragma omp parallel if (parallel) reduction(+:failed, mapped, scanned)
+    {
+        DecadeAcc acc;
+        decade_acc_init(&acc);
+        int *prev_day = (int *)malloc((L->tickers ? L->tickers : 1) * sizeof(int));
+        double *prev_close = (double *)malloc((L->tickers ? L->tickers : 1) * sizeof(double));
+        if (!prev_day || !prev_close) failed++;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int j = 0; j < mine; j++) {
+            YearSegment s;
+            if (failed || year_segment_map(&s, L, order[j]) != 0) {
+                failed++;
+                continue;
+            }
+            year_segment_add(&acc, &s, metrics, from_day, to_day, ok, prev_day, prev_close);
+            mapped++;
+            scanned += (double)s.h->rows * (2 * sizeof(int32_t) +
+                                             __builtin_popcount(metric_columns(metrics)) *
+                                             sizeof(double));
+            year_segment_unmap(&s);
+        }
+        free(prev_day);
+        free(prev_close);
+
+        #pragma omp critical
+        decade_acc_merge(totals, &acc);
+    }
+    free(order);
+    free(ok);
+    *touched = mapped;
+    *bytes = scanned;
+    return failed ? -1 : 0;
+}
+
+
+// ---------------------------------------------------------------------
+// Building
+// ---------------------------------------------------------------------
+
+// Rows of one thread waiting to be appended to DIR/<year>.<thread>.spill
+typedef struct {
+    YearRow *rows[YEAR_LAYOUT_YEARS];
+    int fill[YEAR_LAYOUT_YEARS];
+    long long spilled[YEAR_LAYOUT_YEARS];
+} YearSpill;
+
+static inline int year_spill_path(char *out, size_t cap, const char *dir, int year, int thread) {
+    int len = snprintf(out, cap, "%s/%d.%d.spill", dir, year, thread);
+    return len < 0 || (size_t)len >= cap ? -1 : 0;
+}
+
+static inline int year_spill_flush(YearSpill *sp, const char *dir, int thread, int year) {
+    char path[4096 + 32];
+    if (year_spill_path(path, sizeof(path), dir, year, thread) != 0) return -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    int err = year_write_all(fd, sp->rows[year], (size_t)sp->fill[year] * sizeof(YearRow));
+    if (close(fd) != 0) err = -1;
+    sp->spilled[year] += sp->fill[year];
+    sp->fill[year] = 0;
+    return err;
+}
+
+// Append the rows of one file (ticker id `ticker`) to the spill buffers
+static inline int year_spill_series(YearSpill *sp, const char *dir, int thread,
+                                    const StockSeries *s, int ticker) {
+    for (int i = 0; i < s->n; i++) {
+        int y = day_year(s->day[i]);
+        if (y < 0 || y >= YEAR_LAYOUT_YEARS)
+            continue;
+        if (!sp->rows[y] && !(sp->rows[y] = (YearRow *)malloc(YEAR_SPILL_ROWS * sizeof(YearRow))))
+            return -1;
+        YearRow *r = &sp->rows[y][sp->fill[y]++];
+        r->day = s->day[i];
+        r->ticker = ticker;
+        r->col[0] = s->open[i];
+        r->col[1] = s->high[i];
+        r->col[2] = s->low[i];
+        r->col[3] = s->close[i];
+        r->col[4] = s->volume[i];
+        if (sp->fill[y] == YEAR_SPILL_ROWS && year_spill_flush(sp, dir, thread, y) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static inline int year_cmp_day_ticker(const void *a, const void *b) {
+    const YearRow *x = (const YearRow *)a, *y = (const YearRow *)b;
+    if (x->day != y->day) return x->day < y->day ? -1 : 1;
+    return x->ticker - y->ticker;
+}
+
+// Sort the spilled rows of `year` (from `threads` spill files, `rows` in
+// all) into DIR/<year>.seg.tmp, carry-in left empty, and record each
+// ticker's last row of the year in last_day / last_close.  Returns 0 or -1.
+static inline int year_segment_write(const char *dir, int year, long long rows, int threads,
+                                     int tickers, int *last_day, double *last_close) {
+    YearRow *r = (YearRow *)malloc((size_t)rows * sizeof(YearRow));
+    if (!r) return -1;
+    long long got = 0;
+    char path[4096 + 32];
+    for (int t = 0; t < threads; t++) {
+        if (year_spill_path(path, sizeof(path), dir, year, t) != 0) break;
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        ssize_t n;
+        while (got < rows &&
+               (n = read(fd, (char *)(r + got), (size_t)(rows - got) * sizeof(YearRow))) > 0)
+            got += n / (ssize_t)sizeof(YearRow);
+        close(fd);
+        unlink(path);
+    }
+    if (got != rows) {
+        free(r);
+        return -1;
+    }
+    qsort(r, rows, sizeof(YearRow), year_cmp_day_ticker);
+
+    YearSegHeader h;
+    year_seg_header(&h, year, tickers, rows);
+    char *out = (char *)calloc(1, h.carry_day_off);
+    if (!out) {
+        free(r);
+        return -1;
+    }
+    memcpy(out, &h, sizeof(h));
+    int32_t *day = (int32_t *)(out + h.day_off), *tk = (int32_t *)(out + h.ticker_off);
+    int32_t *count = (int32_t *)(out + h.count_off);
+    for (int t = 0; t < tickers; t++) last_day[t] = YEAR_NO_DAY;
+    for (long long i = 0; i < rows; i++) {
+        day[i] = r[i].day;
+        tk[i] = r[i].ticker;
+        for (int c = 0; c < SERIES_COLUMNS; c++)
+            ((double *)(out + h.col_off[c]))[i] = r[i].col[c];
+        count[r[i].ticker]++;
+        last_day[r[i].ticker] = r[i].day;
+        last_close[r[i].ticker] = r[i].col[3];
+    }
+    free(r);
+
+    int err = year_seg_path(path, sizeof(path), dir, year, ".tmp");
+    int fd = err ? -1 : open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || year_write_all(fd, out, h.carry_day_off) != 0 ||
+        ftruncate(fd, (off_t)h.total_bytes) != 0)
+        err = -1;
+    if (fd >= 0 && close(fd) != 0) err = -1;
+    free(out);
+    return err;
+}
+
+// Remove the index first (the layout stops being valid), then every
+// segment, spill and temporary file of a previous build
+static inline void year_layout_clear(const char *dir) {
+    char path[4096 + 32];
+    snprintf(path, sizeof(path), "%s/" YEAR_INDEX_FILE, dir);
+    unlink(path);
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if ((len > 4 && strcmp(de->d_name + len - 4, ".seg") == 0) ||
+            (len > 6 && strcmp(de->d_name + len - 6, ".spill") == 0) ||
+            (len > 4 && strcmp(de->d_name + len - 4, ".tmp") == 0))
+            unlinkat(dirfd(d), de->d_name, 0);
+    }
+    closedir(d);
+}
+
+// Fill in the carry-in of every temporary segment (each ticker's last row
+// in an earlier year), rename the segments into place and write the index
+static inline int year_layout_finish(const char *dir, const Catalog *c, uint64_t fingerprint,
+                                     const int *years, const long long *rows, int segments,
+                                     const int *last_day, const double *last_close) {
+    int tickers = c->tickers;
+    int *carry_day = (int *)malloc((tickers ? tickers : 1) * sizeof(int));
+    double *carry_close = (double *)calloc(tickers ? tickers : 1, sizeof(double));
+    if (!carry_day || !carry_close) {
+        free(carry_day);
+        free(carry_close);
+        return -1;
+    }
+    for (int t = 0; t < tickers; t++) carry_day[t] = YEAR_NO_DAY;
+
+    int err = 0;
+    char tmp[4096 + 64], path[4096 + 32];
+    for (int k = 0; k < segments && !err; k++) {
+        YearSegHeader h;
+        year_seg_header(&h, years[k], tickers, rows[k]);
+        year_seg_path(tmp, sizeof(tmp), dir, years[k], ".tmp");
+        year_seg_path(path, sizeof(path), dir, years[k], "");
+        int fd = open(tmp, O_WRONLY | O_CLOEXEC);
+        size_t dbytes = (size_t)tickers * sizeof(int), cbytes = (size_t)tickers * sizeof(double);
+        if (fd < 0 ||
+            pwrite(fd, carry_day, dbytes, (off_t)h.carry_day_off) != (ssize_t)dbytes ||
+            pwrite(fd, carry_close, cbytes, (off_t)h.carry_close_off) != (ssize_t)cbytes)
+            err = -1;
+        if (fd >= 0 && close(fd) != 0) err = -1;
+        if (!err && rename(tmp, path) != 0) err = -1;
+
+        const int *ld = last_day + (size_t)k * tickers;
+        const double *lc = last_close + (size_t)k * tickers;
+        for (int t = 0; t < tickers; t++)
+            if (ld[t] != YEAR_NO_DAY) {
+                carry_day[t] = ld[t];
+                carry_close[t] = lc[t];
+            }
+    }
+    free(carry_day);
+    free(carry_close);
+    if (err) return -1;
+
+    // ticker names in id order (a listed catalog numbers them by name)
+    const char **name = (const char **)calloc(tickers ? tickers : 1, sizeof(char *));
+    size_t *name_len = (size_t *)calloc(tickers ? tickers : 1, sizeof(size_t));
+    if (!name || !name_len) {
+        free(name);
+        free(name_len);
+        return -1;
+    }
+    YearIndexHeader ih;
+    memset(&ih, 0, sizeof(ih));
+    memcpy(ih.magic, YEAR_INDEX_MAGIC, 8);
+    ih.fingerprint = fingerprint;
+    ih.tickers = tickers;
+    ih.segments = segments;
+    for (int i = 0; i < c->count; i++) {
+        int t = c->entries[i].ticker;
+        if (!name[t]) {
+            name[t] = catalog_ticker(catalog_path(c, i), &name_len[t]);
+            ih.names_bytes += name_len[t] + 1;
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/" YEAR_INDEX_FILE, dir);
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    err = !f || fwrite(&ih, sizeof(ih), 1, f) != 1;
+    for (int k = 0; !err && k < segments; k++) {
+        int32_t y = years[k];
+        err = fwrite(&y, sizeof(y), 1, f) != 1;
+    }
+    for (int k = 0; !err && k < segments; k++) {
+        int64_t r = rows[k];
+        err = fwrite(&r, sizeof(r), 1, f) != 1;
+    }
+    for (int t = 0; !err && t < tickers; t++)
+        err = fwrite(name[t], 1, name_len[t], f) != name_len[t] || fputc('\0', f) == EOF;
+    if (f && fclose(f) != 0) err = 1;
+    free(name);
+    free(name_len);
+    if (err || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Build the layout of catalog `c` (tickers assigned) in `dir`: the files,
+// largest first, are parsed and spilled per year, then the years, largest
+// first, are sorted and written; both by all threads when `parallel` is set.
+// Returns 0 or -1.
+static inline int year_layout_build(const char *dir, const Catalog *c, uint64_t fingerprint,
+                                    int parallel) {
+    year_layout_clear(dir);
+    long long *year_rows = (long long *)calloc(YEAR_LAYOUT_YEARS, sizeof(long long));
+    if (!year_rows) return -1;
+    LoadSpec spec = { COL_ALL, DAY_RANGE_MIN, DAY_RANGE_MAX };
+    int failed = 0, threads = 1;
+
+    #pragma omp parallel if (parallel) reduction(+:failed)
+    {
+        int thread = omp_get_thread_num();
+        #pragma omp single
+        threads = omp_get_num_threads();
+        YearSpill *sp = (YearSpill *)calloc(1, sizeof(YearSpill));
+        NodeArena arena;
+        arena_init(&arena, -1);
+        StockSeries data;
+        if (!sp) failed++;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < c->count; i++) {
+            // a file with a single row adds nothing (see the drivers)
+            if (failed || read_csv(catalog_path(c, i), &data, &arena, &spec) <= 1)
+                continue;
+            if (year_spill_series(sp, dir, thread, &data, c->entries[i].ticker) != 0)
+                failed++;
+        }
+        arena_release(&arena);
+
+        for (int y = 0; sp && y < YEAR_LAYOUT_YEARS; y++) {
+            if (sp->fill[y] > 0 && year_spill_flush(sp, dir, thread, y) != 0)
+                failed++;
+            free(sp->rows[y]);
+            if (sp->spilled[y] > 0) {
+                #pragma omp atomic
+                year_rows[y] += sp->spilled[y];
+            }
+        }
+        free(sp);
+    }
+
+    int segments = 0;
+    for (int y = 0; y < YEAR_LAYOUT_YEARS; y++)
+        if (year_rows[y] > 0) segments++;
+    int *years = (int *)malloc((segments ? segments : 1) * sizeof(int));
+    long long *rows = (long long *)malloc((segments ? segments : 1) * sizeof(long long));
+    int *order = (int *)malloc((segments ? segments : 1) * sizeof(int));
+    size_t per = (size_t)(c->tickers ? c->tickers : 1) * segments;
+    int *last_day = (int *)malloc((per ? per : 1) * sizeof(int));
+    double *last_close = (double *)malloc((per ? per : 1) * sizeof(double));
+    if (!years || !rows || !order || !last_day || !last_close) failed++;
+
+    if (!failed) {
+        for (int y = 0, k = 0; y < YEAR_LAYOUT_YEARS; y++)
+            if (year_rows[y] > 0) {
+                years[k] = y;
+                rows[k] = year_rows[y];
+                order[k] = k;
+                k++;
+            }
+        qsort_r(order, segments, sizeof(int), year_cmp_rows_desc, rows);
+
+        #pragma omp parallel for schedule(dynamic, 1) reduction(+:failed) if (parallel)
+        for (int j = 0; j < segments; j++) {
+            int k = order[j];
+            if (year_segment_write(dir, years[k], rows[k], threads, c->tickers,
+                                   last_day + (size_t)k * c->tickers,
+                                   last_close + (size_t)k * c->tickers) != 0)
+                failed++;
+        }
+    }
+    if (!failed && year_layout_finish(dir, c, fingerprint, years, rows, segments,
+                                      last_day, last_close) != 0)
+        failed++;
+    if (failed) year_layout_clear(dir);
+
+    free(year_rows);
+    free(years);
+    free(rows);
+    free(order);
+    free(last_day);
+    free(last_close);
+    return failed ? -1 : 0;
+}
+
+// Open the layout of catalog `c` in `dir`, building it first if it is
+// missing or stale (the catalog's tickers are numbered if they are not
+// yet; the build uses threads if `parallel`).  Returns 0 if it was
+// current, 1 if built now, -1 on failure.
+static inline int year_layout_prepare(YearLayout *L, const char *dir, Catalog *c,
+                                      int parallel) {
+    memset(L, 0, sizeof(*L));
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return -1;
+    if (c->count > 0 && c->entries[0].ticker < 0 && catalog_assign_tickers(c) != 0)
+        return -1;
+    uint64_t fp = year_layout_fingerprint(c);
+    if (year_layout_open(L, dir, fp) == 0)
+        return 0;
+    if (year_layout_build(dir, c, fp, parallel) != 0 || year_layout_open(L, dir, fp) != 0)
+        return -1;
+    return 1;
+}
+
+#endif